@@ -7,19 +7,26 @@ LOCAL_CFLAGS    := -Werror -DES_ANDROID
 LOCAL_SRC_FILES := \
 ESJNIDefs.cpp \
 ESJNI.cpp \
+../../src/ESBinaryLog.cpp \
 ../../src/ESErrorReporter.cpp \
 ../../src/ESErrorReporter_android.cpp \
 ../../src/ESFile.cpp \
 ../../src/ESFile_android.cpp \
 ../../src/ESFileArray.cpp \
+../../src/ESFileColumnArray.cpp \
+../../src/ESFileIO.cpp \
+../../src/ESInterThreadMailbox.cpp \
 ../../src/ESInterThreadObserver.cpp \
+../../src/ESLZ4.cpp \
 ../../src/ESLock_pthreads.cpp \
 ../../src/ESNameResolver.cpp \
 ../../src/ESNetwork.cpp \
 ../../src/ESNetwork_android.cpp \
+../../src/ESParallel.cpp \
 ../../src/ESThread.cpp \
 ../../src/ESThread_android.cpp \
 ../../src/ESThread_pthreads.cpp \
+../../src/ESThreadPool.cpp \
 ../../src/ESTrace.cpp \
 ../../src/ESUserPrefs_android.cpp \
 ../../src/ESUserString.cpp \
@@ -0,0 +1,296 @@
+//
+//  ESBinaryLog.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESBinaryLog.hpp"
+#include "ESBinaryLogFormat.hpp"
+#include "ESErrorReporter.hpp"
+#include "ESLock.hpp"
+#include "ESThreadLocalStorage.hpp"
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <atomic>
+
+// The formats we've seen, in an open-addressed hash table keyed by the addresses of the where and
+// format strings.  Lookups don't lock; an entry is filled in under the lock and then published by
+// storing its format pointer, and entries are never removed.  Since an address can be reused for
+// different text (a format which isn't a literal), each entry keeps copies of the strings, and an
+// entry only matches if the text does too.
+#define ES_BINARY_LOG_TABLE_SIZE 4096  // Must be a power of two
+
+struct ESBinaryLogFormatEntry {
+    std::atomic<const char *> format;      // NULL if the slot is empty
+    const char              *where;
+    const char              *formatCopy;
+    const char              *whereCopy;
+    uint32_t                id;            // 1 .. ES_BINARY_LOG_TABLE_SIZE * 3 / 4
+    bool                    encodable;
+};
+
+static ESBinaryLogFormatEntry formatTable[ES_BINARY_LOG_TABLE_SIZE];
+static ESLock registrationLock;
+static uint32_t numFormats = 0;
+static std::atomic<int> numThreads(0);
+
+// Each thread writes a format's record itself, just before its own first message with that format,
+// so the record travels the same path as the message (the writer keeps each thread's records in
+// order) and can't be overtaken by it.  With a single flag for all threads, another thread's
+// message could reach the stream first, or land in an earlier file than the record across a
+// rotation.  Allocated when the thread first logs and kept for the life of the process, since
+// we can't tell when a thread which isn't an ESThread goes away.
+struct ESBinaryLogThreadState {
+    uint32_t                threadNumber;
+    ESBinaryLogWriter       *writer;  // The writer formatsWritten refers to
+    uint8_t                 formatsWritten[ES_BINARY_LOG_TABLE_SIZE / 8];  // Bit per format id
+};
+
+static ESThreadLocalStoragePtr<ESBinaryLogThreadState> threadState;
+
+static inline unsigned int
+hashFormat(const char *where,
+           const char *format) {
+    uintptr_t h = ((uintptr_t)format >> 2) ^ ((uintptr_t)where * 0x9e3779b1);
+    return (unsigned int)(h ^ (h >> 13)) & (ES_BINARY_LOG_TABLE_SIZE - 1);
+}
+
+// Check that we can encode every conversion in the format, and that the format record will fit
+static bool
+formatIsEncodable(const char *format) {
+    if (strlen(format) > ES_BINARY_LOG_MAX_BODY / 2) {
+        return false;
+    }
+    ESBinaryLogSpec spec;
+    int numArgs = 0;
+    for (const char *p = format; ESBinaryLogNextSpec(p, &spec); p = spec.end) {
+        if (spec.type == ESBinaryLogArgInvalid) {
+            return false;
+        }
+        numArgs += spec.numStarArgs + (spec.type != ESBinaryLogArgNone);
+    }
+    return numArgs <= ES_BINARY_LOG_MAX_ARGS;
+}
+
+static inline bool
+entryMatches(const ESBinaryLogFormatEntry *entry,
+             const char                   *entryFormat,
+             const char                   *where,
+             const char                   *format) {
+    return entryFormat == format && entry->where == where
+        && strcmp(entry->formatCopy, format) == 0
+        && strcmp(entry->whereCopy, where ? where : "") == 0;
+}
+
+static const char *
+copyString(const char *str) {
+    size_t length = strlen(str);
+    char *copy = new char[length + 1];
+    memcpy(copy, str, length + 1);
+    return copy;
+}
+
+// Returns NULL if the table is (nearly) full
+static ESBinaryLogFormatEntry *
+findOrAddFormat(const char *where,
+                const char *format) {
+    unsigned int start = hashFormat(where, format);
+    for (unsigned int i = 0; i < ES_BINARY_LOG_TABLE_SIZE; i++) {
+        ESBinaryLogFormatEntry *entry = &formatTable[(start + i) & (ES_BINARY_LOG_TABLE_SIZE - 1)];
+        const char *entryFormat = entry->format.load(std::memory_order_acquire);
+        if (!entryFormat) {
+            break;
+        }
+        if (entryMatches(entry, entryFormat, where, format)) {
+            return entry;
+        }
+    }
+    // Not there; add it, unless someone else just did
+    registrationLock.lock();
+    ESBinaryLogFormatEntry *found = NULL;
+    for (unsigned int i = 0; i < ES_BINARY_LOG_TABLE_SIZE; i++) {
+        ESBinaryLogFormatEntry *entry = &formatTable[(start + i) & (ES_BINARY_LOG_TABLE_SIZE - 1)];
+        const char *entryFormat = entry->format.load(std::memory_order_relaxed);
+        if (!entryFormat) {
+            if (numFormats < ES_BINARY_LOG_TABLE_SIZE * 3 / 4) {  // Keep probe sequences short
+                entry->where = where;
+                entry->formatCopy = copyString(format);
+                entry->whereCopy = copyString(where ? where : "");
+                entry->id = ++numFormats;
+                entry->encodable = formatIsEncodable(format);
+                entry->format.store(format, std::memory_order_release);
+                found = entry;
+            }
+            break;
+        }
+        if (entryMatches(entry, entryFormat, where, format)) {
+            found = entry;
+            break;
+        }
+    }
+    registrationLock.unlock();
+    return found;
+}
+
+static inline char *
+put16(char     *dst,
+      uint16_t value) {
+    memcpy(dst, &value, sizeof(value));
+    return dst + sizeof(value);
+}
+
+static inline char *
+put32(char     *dst,
+      uint32_t value) {
+    memcpy(dst, &value, sizeof(value));
+    return dst + sizeof(value);
+}
+
+static inline char *
+put64(char     *dst,
+      uint64_t value) {
+    memcpy(dst, &value, sizeof(value));
+    return dst + sizeof(value);
+}
+
+// Only the first maxLength characters are looked at, so str needn't be terminated if it's at least that long
+static inline char *
+putString(char       *dst,
+          const char *str,
+          size_t     maxLength) {
+    size_t length = strnlen(str, maxLength);
+    dst = put16(dst, (uint16_t)length);
+    memcpy(dst, str, length);
+    return dst + length;
+}
+
+// Returns the length of the record
+static size_t
+formatRecord(const ESBinaryLogFormatEntry *entry,
+             char                         *record) {  // Room for ES_BINARY_LOG_RECORD_HEADER_SIZE + ES_BINARY_LOG_MAX_BODY
+    char *body = record + ES_BINARY_LOG_RECORD_HEADER_SIZE;
+    char *ptr = put32(body, entry->id);
+    ptr = putString(ptr, entry->whereCopy, 256);
+    ptr = putString(ptr, entry->formatCopy, ES_BINARY_LOG_MAX_BODY - (ptr - body) - sizeof(uint16_t));
+    record[0] = ES_BINARY_LOG_RECORD_FORMAT;
+    put16(record + 1, (uint16_t)(ptr - body));
+    return ptr - record;
+}
+
+/*static*/ bool
+ESBinaryLog::writeMessage(ESBinaryLogWriter *writer,
+                          bool              isError,
+                          const char        *where,
+                          const char        *format,
+                          va_list           args) {
+    ESBinaryLogFormatEntry *entry = findOrAddFormat(where, format);
+    if (!entry || !entry->encodable) {
+        return false;
+    }
+    ESBinaryLogThreadState *state = threadState;
+    if (!state) {
+        state = new ESBinaryLogThreadState;
+        state->threadNumber = ++numThreads;
+        state->writer = NULL;
+        threadState = state;
+    }
+    if (state->writer != writer) {
+        state->writer = writer;  // A new stream, so write each format again
+        memset(state->formatsWritten, 0, sizeof(state->formatsWritten));
+    }
+    uint8_t formatBit = (uint8_t)(1 << (entry->id % 8));
+    if (!(state->formatsWritten[entry->id / 8] & formatBit)) {
+        char record[ES_BINARY_LOG_RECORD_HEADER_SIZE + ES_BINARY_LOG_MAX_BODY];
+        writer->writeBinaryLogRecord(record, formatRecord(entry, record));
+        state->formatsWritten[entry->id / 8] |= formatBit;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    // With at most ES_BINARY_LOG_MAX_ARGS fixed-size arguments there's always room for them; only
+    // strings need to be truncated to fit.
+    char record[ES_BINARY_LOG_RECORD_HEADER_SIZE + ES_BINARY_LOG_MAX_BODY + ES_BINARY_LOG_MAX_ARGS * 8];
+    char *body = record + ES_BINARY_LOG_RECORD_HEADER_SIZE;
+    char *ptr = put32(body, entry->id);
+    ptr = put64(ptr, (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+    ptr = put32(ptr, state->threadNumber);
+    ESBinaryLogSpec spec;
+    for (const char *p = format; ESBinaryLogNextSpec(p, &spec); p = spec.end) {
+        int precision = spec.precision;
+        for (int i = 0; i < spec.numStarArgs; i++) {
+            int starArg = va_arg(args, int);
+            ptr = put32(ptr, (uint32_t)starArg);
+            if (spec.precisionIsStar && i == spec.numStarArgs - 1) {
+                precision = starArg;  // Negative means none, as for printf
+            }
+        }
+        switch(spec.type) {
+          case ESBinaryLogArgInt32:
+            ptr = put32(ptr, (uint32_t)va_arg(args, int));  // char and short are promoted to int
+            break;
+          case ESBinaryLogArgInt64:
+            switch(spec.length) {
+              case ESBinaryLogLengthLong:
+                ptr = put64(ptr, (uint64_t)va_arg(args, long));
+                break;
+              case ESBinaryLogLengthSize:
+                ptr = put64(ptr, (uint64_t)va_arg(args, size_t));
+                break;
+              case ESBinaryLogLengthIntMax:
+                ptr = put64(ptr, (uint64_t)va_arg(args, intmax_t));
+                break;
+              case ESBinaryLogLengthPtrDiff:
+                ptr = put64(ptr, (uint64_t)va_arg(args, ptrdiff_t));
+                break;
+              default:
+                ptr = put64(ptr, (uint64_t)va_arg(args, long long));
+                break;
+            }
+            break;
+          case ESBinaryLogArgDouble:
+            {
+                double d = (spec.length == ESBinaryLogLengthLongDouble) ? (double)va_arg(args, long double) : va_arg(args, double);
+                memcpy(ptr, &d, sizeof(d));
+                ptr += sizeof(d);
+            }
+            break;
+          case ESBinaryLogArgString:
+            {
+                // With a precision, str needn't be terminated, so mustn't be read past it
+                const char *str = va_arg(args, const char *);
+                ptrdiff_t room = ES_BINARY_LOG_MAX_BODY - (ptr - body) - (ptrdiff_t)sizeof(uint16_t);
+                size_t maxLength = room > 0 ? room : 0;
+                if (precision >= 0 && (size_t)precision < maxLength) {
+                    maxLength = precision;
+                }
+                ptr = putString(ptr, str ? str : "(null)", maxLength);
+            }
+            break;
+          case ESBinaryLogArgPointer:
+            ptr = put64(ptr, (uint64_t)(uintptr_t)va_arg(args, void *));
+            break;
+          case ESBinaryLogArgNone:
+          case ESBinaryLogArgInvalid:  // Can't happen; we checked when registering
+            break;
+        }
+    }
+    ESAssert(ptr - body <= 0xffff);
+    record[0] = isError ? ES_BINARY_LOG_RECORD_ERROR : ES_BINARY_LOG_RECORD_INFO;
+    put16(record + 1, (uint16_t)(ptr - body));
+    writer->writeBinaryLogRecord(record, ptr - record);
+    return true;
+}
+
+/*static*/ void
+ESBinaryLog::appendAllFormatRecords(std::string *records) {
+    char record[ES_BINARY_LOG_RECORD_HEADER_SIZE + ES_BINARY_LOG_MAX_BODY];
+    for (int i = 0; i < ES_BINARY_LOG_TABLE_SIZE; i++) {
+        const ESBinaryLogFormatEntry *entry = &formatTable[i];
+        if (entry->format.load(std::memory_order_acquire) && entry->encodable) {
+            records->append(record, formatRecord(entry, record));
+        }
+    }
+}
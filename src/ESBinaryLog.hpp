@@ -0,0 +1,48 @@
+//
+//  ESBinaryLog.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESBINARYLOG_HPP_
+#define _ESBINARYLOG_HPP_
+
+#include "ESPlatform.h"  // Must be first
+
+#include <stdarg.h>
+
+#include <string>
+
+class ESBinaryLogWriter;
+
+/*! Encoding of ESErrorReporter messages as binary records (see ESBinaryLogFormat.hpp), used
+ *  when a binary log writer has been registered with ESErrorReporter.
+ *
+ *  Instead of formatting the message, we record an id for the (where, format) pair, the time,
+ *  a small per-thread number and the raw arguments; each thread writes the format itself
+ *  only before its first message with it in each stream.  Strings are copied, since their storage is gone by
+ *  the time anyone reads the log.  tools/ESBinaryLogDecoder.cpp turns the stream back into
+ *  text.
+ *
+ *  Formats are looked up by the address of the format string, so this is only a win for format
+ *  strings which are literals, as they are throughout the library; one which isn't still logs
+ *  correctly, since the text is checked too, but each new address costs a table entry. */
+class ESBinaryLog {
+  public:
+    /** Write a message record (preceded by a format record if necessary) to the writer.
+     *  Returns false without touching args if the format can't be encoded (too many arguments,
+     *  an unsupported conversion, or too many distinct formats), in which case the caller
+     *  should log it as text instead. */
+    static bool             writeMessage(ESBinaryLogWriter *writer,
+                                         bool              isError,
+                                         const char        *where,
+                                         const char        *format,
+                                         va_list           args);
+
+    /** Append a format record for every format seen so far.  A writer starting a new file writes
+     *  these into it, so that the file can be decoded on its own, even for messages which were
+     *  encoded before the switch (and whose format records went into the old file). */
+    static void             appendAllFormatRecords(std::string *records);
+};
+
+#endif  // _ESBINARYLOG_HPP_
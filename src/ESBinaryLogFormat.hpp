@@ -0,0 +1,175 @@
+//
+//  ESBinaryLogFormat.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESBINARYLOGFORMAT_HPP_
+#define _ESBINARYLOGFORMAT_HPP_
+
+// The layout of the binary log stream written by ESBinaryLog, shared with the host-side decoder
+// (tools/ESBinaryLogDecoder.cpp).  This header deliberately depends on nothing else in the
+// library, so that the decoder can be built on any host.
+//
+// The stream is a sequence of records, each of which is
+//     uint8   type
+//     uint16  body length
+//     body
+// Multi-byte fields are unaligned and in native byte order, which is little-endian on every
+// platform we run on.  Record bodies are:
+//     ES_BINARY_LOG_RECORD_FORMAT:   uint32 format id, uint16 where length, where, uint16 format length, format
+//     ES_BINARY_LOG_RECORD_ERROR,
+//     ES_BINARY_LOG_RECORD_INFO:     uint32 format id, uint64 timestamp (microseconds since the epoch),
+//                                    uint32 thread number, then the arguments, in the order in which the
+//                                    format consumes them, encoded as in ESBinaryLogArgType
+// Each file starts with a format record for every format in use when it was started, and any
+// other format record comes before the first message which uses it (though not necessarily
+// immediately before), so a reader can decode a file in a single pass.  A format record may
+// appear more than once, always with the same contents.
+
+#include <stdint.h>
+#include <string.h>
+
+#define ES_BINARY_LOG_RECORD_FORMAT       'F'
+#define ES_BINARY_LOG_RECORD_ERROR        'E'
+#define ES_BINARY_LOG_RECORD_INFO         'I'
+#define ES_BINARY_LOG_RECORD_HEADER_SIZE  3
+#define ES_BINARY_LOG_MAX_BODY            4096
+#define ES_BINARY_LOG_MESSAGE_HEADER_SIZE 16  // id, timestamp, thread
+#define ES_BINARY_LOG_MAX_ARGS            64  // Formats with more than this are logged as text
+
+enum ESBinaryLogArgType {
+    ESBinaryLogArgNone,     // "%%"; consumes nothing
+    ESBinaryLogArgInt32,    // int, char, short (and '*' widths and precisions)
+    ESBinaryLogArgInt64,    // long, long long, size_t, intmax_t, ptrdiff_t, widened to 64 bits
+    ESBinaryLogArgDouble,   // float, double, long double, as a double
+    ESBinaryLogArgString,   // uint16 length, then the (unterminated, possibly truncated) characters
+    ESBinaryLogArgPointer,  // 64 bits
+    ESBinaryLogArgInvalid   // A conversion we don't handle (e.g., %n); such formats are logged as text
+};
+
+enum ESBinaryLogLength {
+    ESBinaryLogLengthNone,
+    ESBinaryLogLengthChar,        // hh
+    ESBinaryLogLengthShort,       // h
+    ESBinaryLogLengthLong,        // l
+    ESBinaryLogLengthLongLong,    // ll, q
+    ESBinaryLogLengthSize,        // z
+    ESBinaryLogLengthIntMax,      // j
+    ESBinaryLogLengthPtrDiff,     // t
+    ESBinaryLogLengthLongDouble   // L
+};
+
+/** One printf conversion specification within a format */
+struct ESBinaryLogSpec {
+    const char              *start;            // The '%'
+    const char              *modifiersStart;   // Just past the flags, width and precision
+    const char              *conversion;       // The conversion character
+    const char              *end;              // Just past the conversion character
+    int                     numStarArgs;       // Int32s consumed for '*' width and precision, before the value
+    int                     precision;         // -1 if none given
+    bool                    precisionIsStar;   // If so, it's the last of the star args (and negative means none)
+    ESBinaryLogLength       length;
+    ESBinaryLogArgType      type;
+};
+
+/** Find the next conversion specification at or after p.  Returns false if there are no more. */
+inline bool
+ESBinaryLogNextSpec(const char      *p,
+                    ESBinaryLogSpec *spec) {
+    const char *q = strchr(p, '%');
+    if (!q) {
+        return false;
+    }
+    spec->start = q++;
+    spec->numStarArgs = 0;
+    spec->precision = -1;
+    spec->precisionIsStar = false;
+    while (*q && strchr("-+ #0'", *q)) {
+        q++;
+    }
+    if (*q == '*') {
+        spec->numStarArgs++;
+        q++;
+    } else {
+        while (*q >= '0' && *q <= '9') {
+            q++;
+        }
+    }
+    if (*q == '.') {
+        q++;
+        if (*q == '*') {
+            spec->numStarArgs++;
+            spec->precisionIsStar = true;
+            q++;
+        } else {
+            spec->precision = 0;  // "." alone means 0
+            while (*q >= '0' && *q <= '9') {
+                if (spec->precision < 0xffff) {  // More than any record could hold
+                    spec->precision = spec->precision * 10 + (*q - '0');
+                }
+                q++;
+            }
+        }
+    }
+    spec->modifiersStart = q;
+    spec->length = ESBinaryLogLengthNone;
+    switch(*q) {
+      case 'h':
+        spec->length = (*++q == 'h') ? (q++, ESBinaryLogLengthChar) : ESBinaryLogLengthShort;
+        break;
+      case 'l':
+        spec->length = (*++q == 'l') ? (q++, ESBinaryLogLengthLongLong) : ESBinaryLogLengthLong;
+        break;
+      case 'q':
+        q++;
+        spec->length = ESBinaryLogLengthLongLong;
+        break;
+      case 'z':
+        q++;
+        spec->length = ESBinaryLogLengthSize;
+        break;
+      case 'j':
+        q++;
+        spec->length = ESBinaryLogLengthIntMax;
+        break;
+      case 't':
+        q++;
+        spec->length = ESBinaryLogLengthPtrDiff;
+        break;
+      case 'L':
+        q++;
+        spec->length = ESBinaryLogLengthLongDouble;
+        break;
+      default:
+        break;
+    }
+    spec->conversion = q;
+    switch(*q) {
+      case '%':
+        spec->type = ESBinaryLogArgNone;
+        break;
+      case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+        spec->type = (spec->length <= ESBinaryLogLengthShort) ? ESBinaryLogArgInt32 : ESBinaryLogArgInt64;
+        break;
+      case 'c':  // But not %lc, whose wint_t we'd have to convert
+        spec->type = (spec->length == ESBinaryLogLengthNone) ? ESBinaryLogArgInt32 : ESBinaryLogArgInvalid;
+        break;
+      case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+        spec->type = ESBinaryLogArgDouble;
+        break;
+      case 's':  // But not %ls, which is a wide string
+        spec->type = (spec->length == ESBinaryLogLengthNone) ? ESBinaryLogArgString : ESBinaryLogArgInvalid;
+        break;
+      case 'p':
+        spec->type = ESBinaryLogArgPointer;
+        break;
+      default:
+        spec->type = ESBinaryLogArgInvalid;
+        break;
+    }
+    spec->end = *q ? q + 1 : q;
+    return true;
+}
+
+#endif  // _ESBINARYLOGFORMAT_HPP_
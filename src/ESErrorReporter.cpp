@@ -6,13 +6,21 @@
 //
 
 #include "ESErrorReporter.hpp"
+#include "ESBinaryLog.hpp"
 #include "ESFileArray.hpp"
 #include "ESUserString.hpp"
+#include "ESLock.hpp"
+#include "ESThread.hpp"
+#include "ESFile.hpp"
 
 #include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <map>
 #include <string>
+#include <vector>
 
 /*static*/ void 
 ESErrorReporter::logErrorWithCode(const char *where,
@@ -44,35 +52,174 @@ ESErrorReporter::logErrorWithCode(const char *where,
     }
 }
 
+// Read without a lock by every thread which logs
+static std::atomic<ESBinaryLogWriter *> binaryLogWriter(NULL);
+
+/*static*/ void
+ESErrorReporter::registerBinaryLogWriter(ESBinaryLogWriter *writer) {
+    binaryLogWriter.store(writer, std::memory_order_release);
+}
+
+/*static*/ std::atomic<int> ESErrorReporter::_lowestEnabledLevel(ESLogLevelInfo);
+/*static*/ std::atomic<int> ESErrorReporter::_defaultLevel(ESLogLevelInfo);
+/*static*/ std::atomic<bool> ESErrorReporter::_haveModuleLevels(false);
+
+struct ESModuleLogLevel {
+    std::string             where;
+    ESLogLevel              level;
+};
+typedef std::vector<ESModuleLogLevel> ESModuleLogLevels;
+
+// The per-module levels are replaced, never modified, so that readers need no lock.  Superseded
+// tables are deliberately leaked, since a reader on another thread may still be looking at one and
+// we have no way of knowing when it's done.  The leak is bounded: each set or clear leaks one table
+// of one entry per module with a level, and levels are set only at startup or from a debug menu.
+static std::atomic<ESModuleLogLevels *> moduleLogLevels(NULL);
+static ESLock moduleLogLevelsLock;
+
+/*static*/ bool
+ESErrorReporter::moduleLevelEnabled(ESLogLevel level,
+                                    const char *where) {
+    const ESModuleLogLevels *levels = moduleLogLevels.load(std::memory_order_acquire);
+    if (levels) {
+        for (ESModuleLogLevels::const_iterator it = levels->begin(); it != levels->end(); it++) {
+            if (it->where == where) {
+                return level >= it->level;
+            }
+        }
+    }
+    return level >= _defaultLevel.load(std::memory_order_relaxed);
+}
+
+// Called with moduleLogLevelsLock held
+/*static*/ void
+ESErrorReporter::recomputeLowestEnabledLevel() {
+    int lowest = _defaultLevel.load();
+    const ESModuleLogLevels *levels = moduleLogLevels.load();
+    if (levels) {
+        for (ESModuleLogLevels::const_iterator it = levels->begin(); it != levels->end(); it++) {
+            if (it->level < lowest) {
+                lowest = it->level;
+            }
+        }
+    }
+    _haveModuleLevels.store(levels && !levels->empty());
+    _lowestEnabledLevel.store(lowest);
+}
+
+/*static*/ void
+ESErrorReporter::setLogLevel(ESLogLevel level) {
+    moduleLogLevelsLock.lock();
+    _defaultLevel.store(level);
+    recomputeLowestEnabledLevel();
+    moduleLogLevelsLock.unlock();
+}
+
+/*static*/ void
+ESErrorReporter::setLogLevelForModule(const char *where,
+                                      ESLogLevel level) {
+    moduleLogLevelsLock.lock();
+    const ESModuleLogLevels *oldLevels = moduleLogLevels.load();
+    ESModuleLogLevels *newLevels = oldLevels ? new ESModuleLogLevels(*oldLevels) : new ESModuleLogLevels;
+    ESModuleLogLevels::iterator it = newLevels->begin();
+    while (it != newLevels->end() && it->where != where) {
+        it++;
+    }
+    if (it == newLevels->end()) {
+        ESModuleLogLevel moduleLevel;
+        moduleLevel.where = where;
+        moduleLevel.level = level;
+        newLevels->push_back(moduleLevel);
+    } else {
+        it->level = level;
+    }
+    moduleLogLevels.store(newLevels, std::memory_order_release);
+    recomputeLowestEnabledLevel();
+    moduleLogLevelsLock.unlock();
+}
+
+/*static*/ void
+ESErrorReporter::clearLogLevelForModule(const char *where) {
+    moduleLogLevelsLock.lock();
+    const ESModuleLogLevels *oldLevels = moduleLogLevels.load();
+    if (oldLevels) {
+        ESModuleLogLevels *newLevels = new ESModuleLogLevels;
+        for (ESModuleLogLevels::const_iterator it = oldLevels->begin(); it != oldLevels->end(); it++) {
+            if (it->where != where) {
+                newLevels->push_back(*it);
+            }
+        }
+        moduleLogLevels.store(newLevels, std::memory_order_release);
+        recomputeLowestEnabledLevel();
+    }
+    moduleLogLevelsLock.unlock();
+}
+
+/*static*/ void
+ESErrorReporter::logv(ESLogLevel level,
+                      const char *where,
+                      const char *format,
+                      va_list    args) {
+    bool isError = (level >= ESLogLevelError);
+    ESBinaryLogWriter *writer = binaryLogWriter.load(std::memory_order_acquire);
+    if (writer) {
+        va_list binaryArgs;
+        va_copy(binaryArgs, args);
+        bool written = ESBinaryLog::writeMessage(writer, isError, where, format, binaryArgs);
+        va_end(binaryArgs);
+        // Errors are rare enough that it's worth seeing them as they happen too
+        if (written && !isError) {
+            return;
+        }
+    }
+    char buf[4096];
+    int charsToBePrinted = vsnprintf(buf, sizeof(buf), format, args);
+    if (isError) {
+        logErrorImpl(where, buf);
+    } else {
+        logInfoImpl(where, buf);
+    }
+    if (charsToBePrinted >= sizeof(buf)) {
+        if (isError) {
+            logErrorImpl("ESErrorReporter", "Previous error message was truncated");
+        } else {
+            logInfoImpl("ESErrorReporter", "Previous message was truncated");
+        }
+    }
+}
+
 /*static*/ void 
 ESErrorReporter::logError(const char *where,
                           const char *format,
                           ...) {
     va_list args;
     va_start(args, format);
-    char buf[4096];
-    int charsToBePrinted = vsnprintf(buf, sizeof(buf), format, args);
+    logv(ESLogLevelError, where, format, args);
     va_end(args);
-    logErrorImpl(where, buf);
-    if (charsToBePrinted >= sizeof(buf)) {
-        logErrorImpl("ESErrorReporter", "Previous error message was truncated");
-    }
 }
 
-
 /*static*/ void 
 ESErrorReporter::logInfo(const char *where,
                          const char *format,
                          ...) {
     va_list args;
     va_start(args, format);
-    char buf[4096];
-    int charsToBePrinted = vsnprintf(buf, sizeof(buf), format, args);
+    logv(ESLogLevelInfo, where, format, args);
     va_end(args);
-    logInfoImpl(where, buf);
-    if (charsToBePrinted >= sizeof(buf)) {
-        logInfoImpl("ESErrorReporter", "Previous error message was truncated");
+}
+
+/*static*/ void
+ESErrorReporter::logAtLevel(ESLogLevel level,
+                            const char *where,
+                            const char *format,
+                            ...) {
+    if (level >= ESLogLevelNone || !logLevelEnabled(level, where)) {
+        return;
     }
+    va_list args;
+    va_start(args, format);
+    logv(level, where, format, args);
+    va_end(args);
 }
 
 typedef std::map<std::string, std::string> ViewMessageQueue;
@@ -83,20 +230,21 @@ static ESUserErrorReporter *userErrorReporter = NULL;
 
 static const char messageQueueFilePath[] = "message_queue.txt";
 
-// Copy string into *bufptr, advancing bufptr past terminating NULL.
-// 'string' must be nonempty and NULL terminated, and must contain no internal NULLs.
-static void copyStringIntoBuffer(char **bufptr, const std::string &str) {
-    size_t stringLength = str.length();
-    ESAssert(stringLength > 0);
-    ESAssert(strlen(str.c_str()) == stringLength);
-    strcpy(*bufptr, str.c_str());
-    *bufptr += stringLength + 1;
+// Append str to *buf, including its terminating NULL.
+// 'str' must be nonempty, and must contain no internal NULLs.
+static void appendStringToBuffer(std::string       *buf,
+                                 const std::string &str) {
+    ESAssert(str.length() > 0);
+    ESAssert(strlen(str.c_str()) == str.length());
+    buf->append(str.c_str(), str.length() + 1);
 }
 
-static const char *readStringAndAdvance(const char **bufptr, size_t *bufRemaining) {
-    ESErrorReporter::logInfo("readStringAndAdvance", "start, bufRemaining %d", (int) *bufRemaining);
+static const char *readStringAndAdvance(const char **bufptr,
+                                        size_t     *bufRemaining,
+                                        bool       truncationExpected = false) {
+    ESLogDebug("readStringAndAdvance", "start, bufRemaining %d", (int) *bufRemaining);
     if (*bufRemaining == 0) {
-        ESErrorReporter::logInfo("readStringAndAdvance", "end, EOF");
+        ESLogDebug("readStringAndAdvance", "end, EOF");
         return NULL;  // EOF, OK at string boundary.
     }
     const char *returnString = *bufptr;
@@ -106,12 +254,12 @@ static const char *readStringAndAdvance(const char **bufptr, size_t *bufRemainin
     }
     if (!*bufRemaining) {
         // We ran out of buffer before the terminating NULL.
-        ESAssert(false);  // In real life we might have a truncated file for some reason.
+        ESAssert(truncationExpected);  // In real life we might have a truncated file for some reason.
         return NULL;
     }
     (*bufptr)++;  // the terminating NULL.
     (*bufRemaining)--;
-    ESErrorReporter::logInfo("readStringAndAdvance", "end, returning '%s', bufRemaining %d", returnString, (int) *bufRemaining);
+    ESLogDebug("readStringAndAdvance", "end, returning '%s', bufRemaining %d", returnString, (int) *bufRemaining);
     return returnString;
 }
 
@@ -138,65 +286,272 @@ static const char *readStringAndAdvance(const char **bufptr, size_t *bufRemainin
 // This imposes two requirements:
 // 1) No message key may be the empty string, since an empty string in that slot signifies the end of that view.
 // 2) All strings must be modified UTF-8 (that is, they may not include NULL characters as part of a Unicode sequence).
-static void writeUserErrorQueue() {
-    if (queuedMessages) {
-        // First walk of the queue, determining size of buffer (and file) necessary
-        size_t sizeNeeded = 0;
-        for (MessageQueueByView::iterator viewIter = queuedMessages->begin();
-             viewIter != queuedMessages->end();
-             viewIter++) {
-            const std::string &viewName = viewIter->first;
-            sizeNeeded += viewName.length() + 1;  // include NULL terminator
-            ViewMessageQueue *viewMessageQueue = viewIter->second;
-            for (ViewMessageQueue::iterator msgIter = viewMessageQueue->begin();
-                 msgIter != viewMessageQueue->end();
-                 msgIter++) {
-                const std::string &msgKey = msgIter->first;
-                const std::string &msg = msgIter->second;
-                sizeNeeded += msgKey.length() + msg.length() + 2; // include NULL terminators
-            }
-            sizeNeeded++;  // Include empty string signifying end of view
+// When written as a snapshot (below), the sequence is preceded by an empty string and the snapshot's
+// generation in decimal; a file without them (written before there were generations) is generation 0.
+static void serializeUserErrorQueue(std::string *buf) {
+    buf->clear();
+    if (!queuedMessages) {
+        return;
+    }
+    for (MessageQueueByView::iterator viewIter = queuedMessages->begin();
+         viewIter != queuedMessages->end();
+         viewIter++) {
+        ViewMessageQueue *viewMessageQueue = viewIter->second;
+        if (viewMessageQueue->empty()) {
+            continue;  // No point in writing out an empty view
         }
+        const std::string &viewName = viewIter->first;
+        ESAssert(viewName.length() > 0);
+        appendStringToBuffer(buf, viewName);
+        for (ViewMessageQueue::iterator msgIter = viewMessageQueue->begin();
+             msgIter != viewMessageQueue->end();
+             msgIter++) {
+            const std::string &msgKey = msgIter->first;
+            const std::string &msg = msgIter->second;
+            ESAssert(msgKey.length() > 0);
+            appendStringToBuffer(buf, msgKey);
+            ESAssert(msg.length() > 0);
+            appendStringToBuffer(buf, msg);
+        }
+        buf->push_back('\0');  // signify end of view
+    }
+}
 
-        ESFileArray<char> messageFile(NULL /*pathToRead*/, ESFilePathTypeRelativeToAppSupportDir, false /*readInAtStartup*/);
-        messageFile.setupForWriteWithNumElements((int)sizeNeeded);
-        char *bufptr = messageFile.writableArray();
-
-        // Now walk the queue again, filling the buffer
-        for (MessageQueueByView::iterator viewIter = queuedMessages->begin();
-             viewIter != queuedMessages->end();
-             viewIter++) {
-            const std::string &viewName = viewIter->first;
-            ESAssert(viewName.length() > 0);
-            copyStringIntoBuffer(&bufptr, viewName);
-
-            ViewMessageQueue *viewMessageQueue = viewIter->second;
-            for (ViewMessageQueue::iterator msgIter = viewMessageQueue->begin();
-                 msgIter != viewMessageQueue->end();
-                 msgIter++) {
-                const std::string &msgKey = msgIter->first;
-                const std::string &msg = msgIter->second;
-                ESAssert(msgKey.length() > 0);
-                copyStringIntoBuffer(&bufptr, msgKey);
-                ESAssert(msg.length() > 0);
-                copyStringIntoBuffer(&bufptr, msg);
+// Changes to the queue are not written by rewriting the file above, which would cost I/O
+// proportional to the size of the whole queue for every change.  Instead each change is appended
+// to a journal, and the file above becomes a snapshot which is only rewritten ("compacted") when
+// the journal grows to be larger than the snapshot; the queue is the snapshot with the journal
+// replayed on top of it.  Each journal record is a type character followed by NULL-terminated
+// strings, with the same requirements as above:
+//   ES_MESSAGE_JOURNAL_ADD      viewName, msgKey, msg   (adds or replaces)
+//   ES_MESSAGE_JOURNAL_REMOVE   viewName, msgKey
+//   ES_MESSAGE_JOURNAL_CLEAR    viewName
+// Replaying a record is not idempotent with respect to a newer snapshot (an old ADD would bring back
+// a message removed since), so each snapshot has a generation, and its changes go to that
+// generation's own journal.  A compaction writes the next generation's snapshot atomically, and only
+// then removes the old journal, so a crash in between leaves a journal which the snapshot says to
+// ignore.  A record left incomplete by a crash is simply ignored.
+//
+// The writes themselves, and the fsyncs which make them durable, are done on a background thread.
+// Changes made while that thread is busy are written together, with one write and one fsync.
+#define ES_MESSAGE_JOURNAL_ADD    'A'
+#define ES_MESSAGE_JOURNAL_REMOVE 'R'
+#define ES_MESSAGE_JOURNAL_CLEAR  'C'
+#define ES_MESSAGE_JOURNAL_MIN_COMPACTION_SIZE 16384
+
+static const char messageQueueJournalPath[] = "message_queue.journal";  // Generation 0; others have ".<generation>" appended
+
+// These are used only in the thread(s) manipulating the queue itself
+static size_t journalSize = 0;    // Including records not yet written
+static size_t snapshotSize = 0;
+
+// Changes waiting to be written, handed from the queue's thread to the writer
+static ESLock pendingWritesLock;
+static std::string pendingJournalRecords;  // Guarded by pendingWritesLock
+static std::string *pendingSnapshot = NULL;  // Guarded by pendingWritesLock; replaces the snapshot and starts a new journal
+static std::string pendingSnapshotRecords;   // Guarded by pendingWritesLock; changes before pendingSnapshot, needed if it can't be written
+
+// The files themselves
+static ESLock messageQueueFileLock;
+static int journalFD = -1;  // Guarded by messageQueueFileLock
+static unsigned long messageQueueGeneration = 0;  // Of the snapshot on disk; guarded by messageQueueFileLock
+
+// Relative to the app support directory
+static std::string messageQueueJournalPathForGeneration(unsigned long generation) {
+    std::string path = messageQueueJournalPath;
+    if (generation > 0) {
+        path += ESUtil::stringWithFormat(".%lu", generation);
+    }
+    return path;
+}
+
+static std::string messageQueueJournalFullPathForGeneration(unsigned long generation) {
+    return ESFile::appSupportDirectory() + "/" + messageQueueJournalPathForGeneration(generation);
+}
+
+static ESSimpleWorkerThread *messageQueueWriterThread = NULL;
+static std::atomic<bool> messageQueueWriteScheduled(false);
+
+// Write whatever is pending, and wait for it to reach the disk.  Called in the writer thread, or
+// from flushUserErrorQueue().
+static void writePendingMessageQueueChanges() {
+    messageQueueFileLock.lock();
+    pendingWritesLock.lock();
+    std::string *snapshot = pendingSnapshot;
+    pendingSnapshot = NULL;
+    std::string snapshotRecords;
+    snapshotRecords.swap(pendingSnapshotRecords);
+    std::string records;
+    records.swap(pendingJournalRecords);
+    pendingWritesLock.unlock();
+
+    if (snapshot) {
+        std::string contents(1, '\0');
+        appendStringToBuffer(&contents, ESUtil::stringWithFormat("%lu", messageQueueGeneration + 1));
+        contents += *snapshot;
+        delete snapshot;
+        if (ESFile::writeArrayToFile(contents.data(), contents.length(), messageQueueFilePath,
+                                     ESFilePathTypeRelativeToAppSupportDir, ESFileWriteAtomicDurable)) {
+            // The old journal is superseded only now that the new snapshot is safely on disk
+            if (journalFD >= 0) {
+                close(journalFD);
+                journalFD = -1;
+            }
+            ESFile::removeFileAtPathIfPresent(messageQueueJournalFullPathForGeneration(messageQueueGeneration).c_str());
+            messageQueueGeneration++;
+        } else {
+            records.insert(0, snapshotRecords);  // The old snapshot and journal are still current
+        }
+    }
+    if (!records.empty()) {
+        if (journalFD < 0) {
+            journalFD = open(messageQueueJournalFullPathForGeneration(messageQueueGeneration).c_str(), O_CREAT|O_WRONLY|O_APPEND, 0666);
+            if (journalFD < 0) {
+                ESErrorReporter::checkAndLogSystemError("ESErrorReporter", errno, "message queue journal open");
+            }
+        }
+        if (journalFD >= 0) {
+            if (!ESFile::writeFully(journalFD, records.data(), records.length())) {
+                ESErrorReporter::checkAndLogSystemError("ESErrorReporter", errno, "message queue write");
+            } else if (!ESFile::syncToDisk(journalFD)) {
+                ESErrorReporter::checkAndLogSystemError("ESErrorReporter", errno, "message queue sync");
             }
-            *bufptr++ = '\0';  // signify end of view
         }
-        ESAssert((bufptr - messageFile.writableArray()) == sizeNeeded);
+    }
+    messageQueueFileLock.unlock();
+}
+
+static void writeGlue(void *obj,
+                      void *param) {
+    messageQueueWriteScheduled.store(false);
+    writePendingMessageQueueChanges();
+}
 
-        // Note: No error checking.  We already log errors in the underlying ESFile code, and there's not much to do
-        // here if there's an error except try again, and then when do we do that.  So we ignore the error.
-        messageFile.writeToPath(messageQueueFilePath, ESFilePathTypeRelativeToAppSupportDir);
+static void scheduleMessageQueueWrite() {
+    if (!messageQueueWriterThread) {
+        messageQueueWriterThread = new ESSimpleWorkerThread("ESErrorReporter", ESChildThreadExitsOnlyByParentRequest, ESInterThreadTransportMailbox);
+        messageQueueWriterThread->start();
+    }
+    if (!messageQueueWriteScheduled.exchange(true)) {
+        messageQueueWriterThread->callInThread(writeGlue, NULL, NULL);
     }
 }
 
-static void readUserErrorQueue() {
+// Replace the snapshot with the current contents of the queue, starting a new journal.
+static void compactUserErrorQueue() {
+    std::string *snapshot = new std::string;
+    serializeUserErrorQueue(snapshot);
+    snapshotSize = snapshot->length();
+    journalSize = 0;
+    pendingWritesLock.lock();
+    delete pendingSnapshot;
+    pendingSnapshot = snapshot;
+    // Reflected in the snapshot, but kept until it's known to be on disk
+    pendingSnapshotRecords += pendingJournalRecords;
+    pendingJournalRecords.clear();
+    pendingWritesLock.unlock();
+    scheduleMessageQueueWrite();
+}
+
+static void journalUserErrorQueueChange(char              recordType,
+                                        const std::string &viewName,
+                                        const std::string *msgKey,
+                                        const std::string *msg) {
+    size_t recordSize = 1 + viewName.length() + 1
+        + (msgKey ? msgKey->length() + 1 : 0)
+        + (msg ? msg->length() + 1 : 0);
+    journalSize += recordSize;
+    pendingWritesLock.lock();
+    pendingJournalRecords.push_back(recordType);
+    appendStringToBuffer(&pendingJournalRecords, viewName);
+    if (msgKey) {
+        appendStringToBuffer(&pendingJournalRecords, *msgKey);
+    }
+    if (msg) {
+        appendStringToBuffer(&pendingJournalRecords, *msg);
+    }
+    pendingWritesLock.unlock();
+    if (journalSize > ES_MESSAGE_JOURNAL_MIN_COMPACTION_SIZE && journalSize > snapshotSize) {
+        compactUserErrorQueue();  // Includes this change
+    } else {
+        scheduleMessageQueueWrite();
+    }
+}
+
+static ViewMessageQueue *messagesForView(const std::string &viewName) {
+    if (!queuedMessages) {
+        queuedMessages = new MessageQueueByView;
+    }
+    MessageQueueByView::iterator it = queuedMessages->find(viewName);
+    if (it != queuedMessages->end()) {
+        return it->second;
+    }
+    ViewMessageQueue *messages = new ViewMessageQueue;
+    (*queuedMessages)[viewName] = messages;
+    return messages;
+}
+
+// Apply the complete records in the journal to the queue.  Returns false if the journal ended
+// with an incomplete record.
+static bool replayUserErrorQueueJournal(const char *buf,
+                                        size_t     bufRemaining) {
+    while (bufRemaining > 0) {
+        char recordType = *buf++;
+        bufRemaining--;
+        const char *viewName = readStringAndAdvance(&buf, &bufRemaining, true/*truncationExpected*/);
+        if (!viewName || !*viewName) {
+            return false;
+        }
+        switch(recordType) {
+          case ES_MESSAGE_JOURNAL_ADD:
+            {
+                const char *msgKey = readStringAndAdvance(&buf, &bufRemaining, true/*truncationExpected*/);
+                const char *msg = msgKey ? readStringAndAdvance(&buf, &bufRemaining, true/*truncationExpected*/) : NULL;
+                if (!msg) {
+                    return false;
+                }
+                (*messagesForView(viewName))[msgKey] = msg;
+            }
+            break;
+          case ES_MESSAGE_JOURNAL_REMOVE:
+            {
+                const char *msgKey = readStringAndAdvance(&buf, &bufRemaining, true/*truncationExpected*/);
+                if (!msgKey) {
+                    return false;
+                }
+                messagesForView(viewName)->erase(msgKey);
+            }
+            break;
+          case ES_MESSAGE_JOURNAL_CLEAR:
+            messagesForView(viewName)->clear();
+            break;
+          default:
+            ESErrorReporter::logError("readUserErrorQueue", "Unknown journal record type %d", recordType);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns the snapshot's generation
+static unsigned long readUserErrorQueueSnapshot() {
     // ESErrorReporter::logInfo("readUserErrorQueue", "start");
     ESFileArray<char> messageFile(messageQueueFilePath, ESFilePathTypeRelativeToAppSupportDir, true /*readInAtStartup*/);
     const char *bufptr = messageFile.array();
     const size_t buflen = messageFile.bytesRead();
+    snapshotSize = buflen;
     size_t bufRemaining = buflen;
+    unsigned long generation = 0;
+    if (bufptr && bufRemaining > 0 && *bufptr == '\0') {
+        bufptr++;
+        bufRemaining--;
+        const char *generationString = readStringAndAdvance(&bufptr, &bufRemaining, true/*truncationExpected*/);
+        if (!generationString) {
+            ESErrorReporter::logError("readUserErrorQueue", "Truncated snapshot header");
+            return 0;
+        }
+        generation = strtoul(generationString, NULL, 10);
+    }
     if (bufptr) {
         queuedMessages = new MessageQueueByView;
         while (true) {
@@ -210,10 +565,10 @@ static void readUserErrorQueue() {
                     const char *msgKey = readStringAndAdvance(&bufptr, &bufRemaining);
                     if (!msgKey) {
                         ESErrorReporter::logError("readUserErrorQueue", "no msgKey in queue for %s", viewName);
-                        return;  // Error condition
+                        return generation;  // Error condition
                     }
                     if (!*msgKey) {
-                        ESErrorReporter::logInfo("readUserErrorQueue", "Found empty msgKey, must be end of view");
+                        ESLogDebug("readUserErrorQueue", "Found empty msgKey, must be end of view");
                         break;  // Must be end of view
                     }
                     const char *msg = readStringAndAdvance(&bufptr, &bufRemaining);
@@ -221,17 +576,45 @@ static void readUserErrorQueue() {
                         (*viewMessageQueue)[msgKey] = msg;
                     } else {
                         ESErrorReporter::logError("readUserErrorQueue", "Found empty msg for msgKey '%s'", msgKey);
-                        return;  // Error condition
+                        return generation;  // Error condition
                     }
                 }
             } else {
-                ESErrorReporter::logInfo("readUserErrorQueue", "Found EOF (aka NULL view name) at end of all views");
+                ESLogDebug("readUserErrorQueue", "Found EOF (aka NULL view name) at end of all views");
                 break;  // EOF here is expected at the end of all views.
             }
         }
     } else {
         // ESErrorReporter::logInfo("readUserErrorQueue", "no bufptr");
     }
+    return generation;
+}
+
+static void readUserErrorQueue() {
+    unsigned long generation = readUserErrorQueueSnapshot();
+    if (!queuedMessages) {
+        queuedMessages = new MessageQueueByView;
+    }
+    messageQueueFileLock.lock();
+    messageQueueGeneration = generation;
+    messageQueueFileLock.unlock();
+    if (generation > 0) {
+        // Left behind if we crashed just after writing this snapshot, and already reflected in it
+        ESFile::removeFileAtPathIfPresent(messageQueueJournalFullPathForGeneration(generation - 1).c_str());
+    }
+    size_t journalLength;
+    char *journal = ESFile::getFileContentsInMallocdArray(messageQueueJournalPathForGeneration(generation).c_str(), ESFilePathTypeRelativeToAppSupportDir,
+                                                          true/*missingOK*/, &journalLength);
+    if (journal) {
+        if (!replayUserErrorQueueJournal(journal, journalLength)) {
+            ESErrorReporter::logInfo("readUserErrorQueue", "Ignoring incomplete record at end of journal");
+        }
+        free(journal);
+        // Start the journal afresh, which also drops any incomplete record at its end
+        if (journalLength > 0) {
+            compactUserErrorQueue();
+        }
+    }
 }
 
 /*static*/ void 
@@ -252,19 +635,8 @@ ESErrorReporter::reportErrorToUserWhenVisible(const std::string  &viewName,
         removeMessageForView(viewName, msgKey);
     } else {
         // Here we can't deliver it, so need to queue it.
-        if (!queuedMessages) {
-            queuedMessages = new MessageQueueByView;
-        }
-        MessageQueueByView::iterator it = queuedMessages->find(viewName);
-        ViewMessageQueue *messages;
-        if (it == queuedMessages->end()) {
-            messages = new ViewMessageQueue;
-            (*queuedMessages)[viewName] = messages;
-        } else {
-            messages = it->second;
-        }
-        (*messages)[msgKey] = msg;  // Overwrites if already present.
-        writeUserErrorQueue();
+        (*messagesForView(viewName))[msgKey] = msg;  // Overwrites if already present.
+        journalUserErrorQueueChange(ES_MESSAGE_JOURNAL_ADD, viewName, &msgKey, &msg);
     }
 }
 
@@ -292,7 +664,7 @@ ESErrorReporter::displayAndClearMessagesForView(const std::string &viewName) {
                     // ESErrorReporter::logInfo("displayAndClearMessagesForView", 
                     //                          "clearing messages for view '%s'", viewName.c_str());
                     messages->clear();
-                    writeUserErrorQueue();
+                    journalUserErrorQueueChange(ES_MESSAGE_JOURNAL_CLEAR, viewName, NULL, NULL);
                 }
             }
         }
@@ -306,12 +678,18 @@ ESErrorReporter::removeMessageForView(const std::string &viewName,
         MessageQueueByView::iterator iter = queuedMessages->find(viewName);
         if (iter != queuedMessages->end()) {
             ESAssert(iter->second);
-            iter->second->erase(msgKey);
-            writeUserErrorQueue();
+            if (iter->second->erase(msgKey)) {
+                journalUserErrorQueueChange(ES_MESSAGE_JOURNAL_REMOVE, viewName, &msgKey, NULL);
+            }
         }
     }
 }
 
+/*static*/ void
+ESErrorReporter::flushUserErrorQueue() {
+    writePendingMessageQueueChanges();
+}
+
 /*static*/ void 
 ESErrorReporter::registerUserErrorReporter(ESUserErrorReporter *reporter) {
     ESAssert(userErrorReporter == NULL);
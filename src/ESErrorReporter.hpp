@@ -15,13 +15,40 @@
 #include <sys/socket.h>
 #include <string.h>
 #include <netdb.h>
+#include <stdarg.h>
 
 #include <string>
+#include <atomic>
 
 class ESUserString;
 
 #define ESErr ESErrorReporter
 
+// Log levels, in increasing order of severity.  Messages logged through the ESLog macros below at
+// a level less than ES_MIN_LOG_LEVEL are compiled out entirely, arguments and all; the remaining
+// ones are also subject to the runtime thresholds set with ESErrorReporter::setLogLevel() and
+// ESErrorReporter::setLogLevelForModule().  The levels apply only to the ESLog macros and to
+// ESErrorReporter::logAtLevel(); logError() and logInfo() always log, as they always have.
+#define ES_LOG_LEVEL_DEBUG  0
+#define ES_LOG_LEVEL_INFO   1
+#define ES_LOG_LEVEL_ERROR  2
+#define ES_LOG_LEVEL_NONE   3
+
+#ifndef ES_MIN_LOG_LEVEL
+#ifdef NDEBUG
+#define ES_MIN_LOG_LEVEL ES_LOG_LEVEL_INFO
+#else
+#define ES_MIN_LOG_LEVEL ES_LOG_LEVEL_DEBUG
+#endif
+#endif
+
+enum ESLogLevel {
+    ESLogLevelDebug = ES_LOG_LEVEL_DEBUG,
+    ESLogLevelInfo  = ES_LOG_LEVEL_INFO,
+    ESLogLevelError = ES_LOG_LEVEL_ERROR,
+    ESLogLevelNone  = ES_LOG_LEVEL_NONE
+};
+
 // Interface (abstract class) which can display errors to the user, and which knows
 // which view is currently visible.
 class ESUserErrorReporter {
@@ -33,6 +60,16 @@ class ESUserErrorReporter {
                                                   const std::string &msg) = 0;
 };
 
+// Interface (abstract class) which receives encoded binary log records (see ESBinaryLog.hpp).
+// Records may be written from any thread; those from any one thread must reach the stream in
+// the order in which they're written, since a format record precedes the messages using it.
+class ESBinaryLogWriter {
+  public:
+    virtual                 ~ESBinaryLogWriter() {}
+    virtual void            writeBinaryLogRecord(const void *record,
+                                                 size_t     length) = 0;
+};
+
 class ESErrorReporter {
   public:
     static void             logError(const char *where,  // simple module or class name (e.g., "ESUtil" or "ESNTPDriver")
@@ -41,6 +78,12 @@ class ESErrorReporter {
     static void             logInfo(const char *where,  // simple module or class name (e.g., "ESUtil" or "ESNTPDriver")
                                     const char *format,
                                     ...);
+    // Log 'format' at 'level', if that level is enabled for 'where'.  Normally called via the ESLog macros,
+    // which check the level before evaluating the arguments.
+    static void             logAtLevel(ESLogLevel level,
+                                       const char *where,  // simple module or class name (e.g., "ESUtil" or "ESNTPDriver")
+                                       const char *format,
+                                       ...);
     static void             logErrorWithCode(const char *where,  // simple module or class name (e.g., "ESUtil" or "ESNTPDriver")
                                              int        st,
                                              const char * (*stringForCodeFn)(int st),
@@ -86,6 +129,35 @@ class ESErrorReporter {
     static void             removeMessageForView(const std::string &viewName,
                                                  const std::string &msgKey);
 
+    // Changes to the message queue are written to disk in the background.  This writes any which
+    // are still pending, and returns when they are safely on disk; call it before the app may be
+    // suspended or killed.
+    static void             flushUserErrorQueue();
+
+    // Register a writer for binary log records.  While one is registered, logInfo() and logError()
+    // send it an encoded record instead of formatting the message, except that errors are also
+    // formatted and logged as usual.  Pass NULL to go back to formatting everything.
+    static void             registerBinaryLogWriter(ESBinaryLogWriter *writer);
+
+    // Set the lowest level which is logged, for every module without a level of its own.  The
+    // initial level is ESLogLevelInfo, so debug messages are off until asked for.
+    static void             setLogLevel(ESLogLevel level);
+    // Set the lowest level which is logged for messages whose 'where' is exactly 'where'.
+    // Pass ESLogLevelNone to silence a module, or call clearLogLevelForModule() to go back to the default.
+    // Each call leaks a copy of the module table (see ESErrorReporter.cpp), so these are for
+    // configuration at startup or from a debug menu, not for toggling on every event.
+    static void             setLogLevelForModule(const char *where,
+                                                 ESLogLevel level);
+    static void             clearLogLevelForModule(const char *where);
+
+    // Whether a message at 'level' from 'where' would be logged.  When the level is below both the
+    // default and every module's threshold, as debug messages normally are, this is one load and one branch.
+    static bool             logLevelEnabled(ESLogLevel level,
+                                            const char *where) {
+        return level >= _lowestEnabledLevel.load(std::memory_order_relaxed)
+            && (!_haveModuleLevels.load(std::memory_order_relaxed) || moduleLevelEnabled(level, where));
+    }
+
     // Creates an entry in an offline log file that can be retrieved later.  Only implemented on Android so far (is no-op on other platforms).
     static void             logOffline(const std::string &text);
 
@@ -98,7 +170,17 @@ class ESErrorReporter {
                                          const char *msg);
     static void             logInfoImpl(const char *where,  // simple module or class name (e.g., "ESUtil" or "ESNTPDriver")
                                         const char *msg);
-
+    static void             logv(ESLogLevel level,
+                                 const char *where,
+                                 const char *format,
+                                 va_list    args);
+    static bool             moduleLevelEnabled(ESLogLevel level,
+                                               const char *where);
+    static void             recomputeLowestEnabledLevel();
+
+    static std::atomic<int> _lowestEnabledLevel;  // min(_defaultLevel, every module level)
+    static std::atomic<int> _defaultLevel;
+    static std::atomic<bool> _haveModuleLevels;
 };
 
 inline /*static*/ void 
@@ -119,6 +201,18 @@ ESErrorReporter::checkAndLogGAIError(const char *where,
     }
 }
 
+// Log at the given level.  If the level is compiled out, the whole statement disappears; otherwise, if the
+// level is not enabled at runtime for 'where', the arguments are not evaluated and nothing is formatted.
+#define ESLog(level, where, ...) \
+    do { \
+        if ((level) >= ES_MIN_LOG_LEVEL && ESErrorReporter::logLevelEnabled((ESLogLevel)(level), (where))) { \
+            ESErrorReporter::logAtLevel((ESLogLevel)(level), (where), __VA_ARGS__); \
+        } \
+    } while (0)
+#define ESLogDebug(where, ...) ESLog(ES_LOG_LEVEL_DEBUG, where, __VA_ARGS__)
+#define ESLogInfo(where, ...)  ESLog(ES_LOG_LEVEL_INFO, where, __VA_ARGS__)
+#define ESLogError(where, ...) ESLog(ES_LOG_LEVEL_ERROR, where, __VA_ARGS__)
+
 #ifdef NDEBUG
 #define ESAssert(cond) {}
 #else
@@ -8,13 +8,21 @@
 #include "ESFile.hpp"
 #include "ESFilePvt.hpp"
 #include "ESErrorReporter.hpp"
+#include "ESUtil.hpp"
+#include "ESThread.hpp"
+#include "ESLock.hpp"
 
 #include <strings.h>  // For bzero
 #include <fcntl.h>
 #include <sys/errno.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <set>
 
 /*static*/ const char * 
 ESFile::pathTypeString(ESFilePathType pathType) {
@@ -64,6 +72,119 @@ ESFile::readSingleUnsignedFromFile(const char     *path,
     return storage;
 }
 
+// Directory descriptors, indexed by ESFilePathType, opened on first use and never closed.  A
+// directory we couldn't open is remembered (until invalidateLookupCache(NULL)), so that we log
+// once rather than retrying on every call; callers fall back to opening by path.
+#define ES_DIRECTORY_FD_UNTRIED (-1)
+#define ES_DIRECTORY_FD_FAILED  (-2)
+static std::atomic<int> directoryFDs[ESFilePathTypeRelativeToAppSupportThenResourceDir] =
+    { {ES_DIRECTORY_FD_UNTRIED}, {ES_DIRECTORY_FD_UNTRIED}, {ES_DIRECTORY_FD_UNTRIED} };
+
+/*static*/ int
+ESFile::directoryFD(ESFilePathType pathType) {
+    if (pathType >= ESFilePathTypeRelativeToAppSupportThenResourceDir) {
+        ESAssert(false);  // Not a single directory
+        return -1;
+    }
+#if !ES_SIMPLE_RESOURCE
+    if (pathType == ESFilePathTypeRelativeToResourceDir) {
+        return -1;
+    }
+#endif
+    int fd = directoryFDs[pathType].load(std::memory_order_acquire);
+    if (fd >= 0) {
+        return fd;
+    }
+    if (fd == ES_DIRECTORY_FD_FAILED) {
+        return -1;
+    }
+    std::string dir;
+    switch(pathType) {
+#if ES_SIMPLE_RESOURCE
+      case ESFilePathTypeRelativeToResourceDir:
+        dir = resourceDirectory();
+        break;
+#endif
+      case ESFilePathTypeRelativeToDocumentDir:
+        dir = documentDirectory();
+        break;
+      default:
+        dir = appSupportDirectory();
+        break;
+    }
+    fd = open(dir.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0) {
+        int openErrno = errno;
+        int expected = ES_DIRECTORY_FD_UNTRIED;
+        if (directoryFDs[pathType].compare_exchange_strong(expected, ES_DIRECTORY_FD_FAILED)) {
+            ESErrorReporter::logError("ESFile", "Error opening %s directory %s: %s", pathTypeString(pathType), dir.c_str(), strerror(openErrno));
+        }
+        return expected >= 0 ? expected : -1;
+    }
+    int expected = ES_DIRECTORY_FD_UNTRIED;
+    if (!directoryFDs[pathType].compare_exchange_strong(expected, fd)) {
+        close(fd);  // Another thread got there first
+        fd = expected;
+    }
+    return fd;
+}
+
+// Relative paths known not to exist in the app support directory, so that
+// ESFilePathTypeRelativeToAppSupportThenResourceDir lookups can go straight to the resource.
+// Every invalidation bumps the generation; a miss is only recorded if there has been none since
+// the lookup started, since the file may have been created (and invalidated) in between.
+static std::set<std::string> absentFromAppSupport;
+static unsigned long absentFromAppSupportGeneration = 0;
+static ESLock absentFromAppSupportLock;
+
+static bool knownAbsentFromAppSupport(const char    *path,
+                                      unsigned long *generation) {
+    absentFromAppSupportLock.lock();
+    bool absent = absentFromAppSupport.find(path) != absentFromAppSupport.end();
+    *generation = absentFromAppSupportGeneration;
+    absentFromAppSupportLock.unlock();
+    return absent;
+}
+
+static void noteAbsentFromAppSupport(const char    *path,
+                                     unsigned long generation) {  // As returned by knownAbsentFromAppSupport before the lookup
+    absentFromAppSupportLock.lock();
+    if (generation == absentFromAppSupportGeneration) {
+        absentFromAppSupport.insert(path);
+    }
+    absentFromAppSupportLock.unlock();
+}
+
+/*static*/ void
+ESFile::invalidateLookupCache(const char *path) {
+    absentFromAppSupportLock.lock();
+    if (path) {
+        absentFromAppSupport.erase(path);
+    } else {
+        absentFromAppSupport.clear();
+        for (int i = 0; i < ESFilePathTypeRelativeToAppSupportThenResourceDir; i++) {
+            int expected = ES_DIRECTORY_FD_FAILED;
+            directoryFDs[i].compare_exchange_strong(expected, ES_DIRECTORY_FD_UNTRIED);
+        }
+    }
+    absentFromAppSupportGeneration++;
+    absentFromAppSupportLock.unlock();
+}
+
+// Open path within the directory of the given (non-resource) type, by way of the cached directory descriptor
+static int getFDPointingAtFileOfType(const char     *path,
+                                     ESFilePathType pathType,
+                                     bool           missingOK,
+                                     size_t         *fileSizeReturn) {
+    int dirFD = ESFile::directoryFD(pathType);
+    if (dirFD < 0) {
+        return ESFile::getFDPointingAtFileInDirectory(path,
+                                                      pathType == ESFilePathTypeRelativeToDocumentDir ? ESFile::documentDirectory() : ESFile::appSupportDirectory(),
+                                                      missingOK, fileSizeReturn);
+    }
+    return ESFile::getFDPointingAtFileInDirectoryFD(path, dirFD, missingOK, fileSizeReturn);
+}
+
 /*static*/ int 
 ESFile::getFDPointingAtFile(const char     *path,
                             ESFilePathType pathType,
@@ -75,18 +196,21 @@ ESFile::getFDPointingAtFile(const char     *path,
       case ESFilePathTypeRelativeToResourceDir:
         return getFDPointingAtResource(path, missingOK, fileSizeReturn, fileCloser);
       case ESFilePathTypeRelativeToDocumentDir:
-        fd = getFDPointingAtFileInDirectory(path, documentDirectory(), missingOK, fileSizeReturn);
-        *fileCloser = new ESStaticFileCloser(fd);
-        return fd;
       case ESFilePathTypeRelativeToAppSupportDir:
-        fd = getFDPointingAtFileInDirectory(path, appSupportDirectory(), missingOK, fileSizeReturn);
+        fd = getFDPointingAtFileOfType(path, pathType, missingOK, fileSizeReturn);
         *fileCloser = new ESStaticFileCloser(fd);
         return fd;
       case ESFilePathTypeRelativeToAppSupportThenResourceDir:
-        fd = getFDPointingAtFileInDirectory(path, appSupportDirectory(), true/*missingOK*/, fileSizeReturn);
-        if (fd >= 0) {
-            *fileCloser = new ESStaticFileCloser(fd);
-            return fd;
+        unsigned long generation;
+        if (!knownAbsentFromAppSupport(path, &generation)) {
+            fd = getFDPointingAtFileOfType(path, ESFilePathTypeRelativeToAppSupportDir, true/*missingOK*/, fileSizeReturn);
+            if (fd >= 0) {
+                *fileCloser = new ESStaticFileCloser(fd);
+                return fd;
+            }
+            if (errno == ENOENT) {
+                noteAbsentFromAppSupport(path, generation);
+            }
         }
         return getFDPointingAtResource(path, missingOK, fileSizeReturn, fileCloser);
       default:
@@ -97,6 +221,60 @@ ESFile::getFDPointingAtFile(const char     *path,
     }
 }
 
+/*static*/ ssize_t
+ESFile::readFully(int    fd,
+                  void   *buffer,
+                  size_t buflen) {
+    char *buf = (char *)buffer;
+    size_t totalRead = 0;
+    while (totalRead < buflen) {
+        ssize_t bytesRead = read(fd, buf + totalRead, buflen - totalRead);
+        if (bytesRead < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (bytesRead == 0) {
+            break;  // EOF
+        }
+        totalRead += bytesRead;
+    }
+    return (ssize_t)totalRead;
+}
+
+/*static*/ bool
+ESFile::writeFully(int        fd,
+                   const void *buffer,
+                   size_t     buflen) {
+    const char *buf = (const char *)buffer;
+    while (buflen > 0) {
+        ssize_t bytesWritten = write(fd, buf, buflen);
+        if (bytesWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (bytesWritten == 0) {
+            errno = EIO;  // Retrying would likely spin forever
+            return false;
+        }
+        buf += bytesWritten;
+        buflen -= bytesWritten;
+    }
+    return true;
+}
+
+/*static*/ bool
+ESFile::syncToDisk(int fd) {
+#if ES_ANDROID
+    return fdatasync(fd) == 0;
+#else
+    return fsync(fd) == 0;
+#endif
+}
+
 /*static*/ char *
 ESFile::getFileContentsInMallocdArray(const char     *path,
                                       ESFilePathType pathType,
@@ -115,13 +293,13 @@ ESFile::getFileContentsInMallocdArray(const char     *path,
     // ESErrorReporter::logInfo("ESFile", "Successful open of file at %s: length %d, fd %d\n", path, fileSize, fd);
     char *bytes = (char *)malloc(fileSize + 1);
     //ESTime::noteTimeAtPhase(ESUtil::stringWithFormat("File read start: reading %s %s", ESFile::pathTypeString(pathType), path));
-    size_t bytesRead = read(fd, bytes, fileSize);
+    ssize_t bytesRead = readFully(fd, bytes, fileSize);
     if (fileCloser) {
         // ESErrorReporter::logInfo("ESFile::getFileContentsInMallocdArray", "Closing fd %d", fd);
         fileCloser->closeAndDie();
     }
-    if (bytesRead != fileSize) {
-        ESErrorReporter::logError("ESFile", "Failed to read entire file [%s]", ESFile::pathTypeString(pathType), path);
+    if (bytesRead != (ssize_t)fileSize) {
+        ESErrorReporter::logError("ESFile", "Failed to read entire %s file [%s]", ESFile::pathTypeString(pathType), path);
         free(bytes);
         *fileSizeReturn = 0;
         return NULL;
@@ -131,32 +309,360 @@ ESFile::getFileContentsInMallocdArray(const char     *path,
     return bytes;
 }
 
+ESFileBufferPool::ESFileBufferPool(size_t bufferSize,
+                                   int    maxIdleBuffers)
+:   _bufferSize(bufferSize),
+    _maxIdleBuffers(maxIdleBuffers)
+{
+    ESAssert(bufferSize > 0);
+}
+
+ESFileBufferPool::~ESFileBufferPool() {
+    for (std::vector<char *>::iterator it = _idleBuffers.begin(); it != _idleBuffers.end(); it++) {
+        free(*it);
+    }
+}
+
+char *
+ESFileBufferPool::acquireBuffer() {
+    _lock.lock();
+    char *buffer = NULL;
+    if (!_idleBuffers.empty()) {
+        buffer = _idleBuffers.back();
+        _idleBuffers.pop_back();
+    }
+    _lock.unlock();
+    if (!buffer) {
+        buffer = (char *)malloc(_bufferSize);
+    }
+    return buffer;
+}
+
+void
+ESFileBufferPool::releaseBuffer(char *buffer) {
+    _lock.lock();
+    if ((int)_idleBuffers.size() < _maxIdleBuffers) {
+        _idleBuffers.push_back(buffer);
+        buffer = NULL;
+    }
+    _lock.unlock();
+    free(buffer);
+}
+
+/*static*/ ESFileBufferPool *
+ESFile::defaultBufferPool() {
+    static ESFileBufferPool *pool = new ESFileBufferPool(256 * 1024);
+    return pool;
+}
+
+// Tell the kernel we'll read this range from front to back, so it reads ahead aggressively
+// and can drop pages behind us.
+static void adviseSequentialRead(int    fd,
+                                 off_t  start,
+                                 size_t length) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, start, length, POSIX_FADV_SEQUENTIAL);  // Only a hint; errors don't matter
+#elif defined(F_RDAHEAD)
+    fcntl(fd, F_RDAHEAD, 1);
+#endif
+}
+
+/*static*/ bool
+ESFile::readFileInChunks(const char       *path,
+                         ESFilePathType   pathType,
+                         bool             missingOK,
+                         ESFileBufferPool *pool,
+                         ESFileChunkFn    chunkFn,
+                         void             *context) {
+    size_t fileSize;
+    ESFileCloser *fileCloser;
+    int fd = ESFile::getFDPointingAtFile(path, pathType, missingOK, &fileSize, &fileCloser);
+    if (fd < 0) {
+        return false;
+    }
+    if (!pool) {
+        pool = defaultBufferPool();
+    }
+    // The fd is positioned at the start of the data, which for resources might be partway through a larger file
+    adviseSequentialRead(fd, lseek(fd, 0, SEEK_CUR), fileSize);
+    size_t chunkSize = pool->bufferSize();
+    char *buffer = pool->acquireBuffer();
+    bool success = true;
+    size_t offset = 0;
+    while (offset < fileSize) {
+        size_t bytesWanted = fileSize - offset < chunkSize ? fileSize - offset : chunkSize;
+        ssize_t bytesRead = readFully(fd, buffer, bytesWanted);
+        if (bytesRead != (ssize_t)bytesWanted) {
+            ESErrorReporter::logError("ESFile", "Failed to read %s file [%s] at offset %lu: %s",
+                                      ESFile::pathTypeString(pathType), path, (unsigned long)offset,
+                                      bytesRead < 0 ? strerror(errno) : "file is shorter than expected");
+            success = false;
+            break;
+        }
+        if (!(*chunkFn)(context, buffer, bytesWanted, offset)) {
+            success = false;
+            break;
+        }
+        offset += bytesWanted;
+    }
+    pool->releaseBuffer(buffer);
+    if (fileCloser) {
+        fileCloser->closeAndDie();
+    }
+    return success;
+}
+
+/*static*/ const char *
+ESFile::mapFileContents(const char         *path,
+                        ESFilePathType     pathType,
+                        bool               missingOK,
+                        ESFileAccessAdvice advice,
+                        size_t             *fileSizeReturn,
+                        void               **mapBaseReturn,
+                        size_t             *mapLengthReturn) {
+    *fileSizeReturn = 0;
+    *mapBaseReturn = NULL;
+    *mapLengthReturn = 0;
+    size_t fileSize;
+    ESFileCloser *fileCloser;
+    int fd = ESFile::getFDPointingAtFile(path, pathType, missingOK, &fileSize, &fileCloser);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fileSize <= 0) {
+        ESErrorReporter::logError("ESFile", "Apparently empty %s file [%s]", ESFile::pathTypeString(pathType), path);
+        if (fileCloser) {
+            fileCloser->closeAndDie();
+        }
+        return NULL;
+    }
+    // The fd is positioned at the start of the data, which for resources might be partway through a larger file.
+    // mmap offsets must be page aligned, so map from the page containing the start.
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    off_t pageSize = sysconf(_SC_PAGESIZE);
+    off_t alignedStart = start - (start % pageSize);
+    size_t mapLength = fileSize + (size_t)(start - alignedStart);
+    void *mapBase = mmap(NULL, mapLength, PROT_READ, MAP_PRIVATE, fd, alignedStart);
+    int mapErrno = errno;
+    if (fileCloser) {
+        fileCloser->closeAndDie();  // The mapping keeps its own reference to the file
+    }
+    if (mapBase == MAP_FAILED) {
+        ESErrorReporter::checkAndLogSystemError("ESFile", mapErrno,
+                                                ESUtil::stringWithFormat("Couldn't map %s file [%s]",
+                                                                         ESFile::pathTypeString(pathType), path).c_str());
+        return NULL;
+    }
+    if (advice != ESFileAccessNormal) {
+        adviseMappedContents(mapBase, mapLength, advice);
+    }
+    *fileSizeReturn = fileSize;
+    *mapBaseReturn = mapBase;
+    *mapLengthReturn = mapLength;
+    return (const char *)mapBase + (start - alignedStart);
+}
+
+/*static*/ void
+ESFile::unmapFileContents(void   *mapBase,
+                          size_t mapLength) {
+    if (mapBase && munmap(mapBase, mapLength) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESFile", errno, "munmap");
+    }
+}
+
+/*static*/ void
+ESFile::adviseMappedContents(void               *mapBase,
+                             size_t             mapLength,
+                             ESFileAccessAdvice advice) {
+    int madviseAdvice;
+    switch(advice) {
+      case ESFileAccessSequential:
+        madviseAdvice = MADV_SEQUENTIAL;
+        break;
+      case ESFileAccessRandom:
+        madviseAdvice = MADV_RANDOM;
+        break;
+      case ESFileAccessWillNeed:
+        madviseAdvice = MADV_WILLNEED;
+        break;
+      case ESFileAccessNormal:
+      default:
+        madviseAdvice = MADV_NORMAL;
+        break;
+    }
+    if (madvise(mapBase, mapLength, madviseAdvice) != 0) {
+        // Only a hint, so not worth more than a log message
+        ESErrorReporter::checkAndLogSystemError("ESFile", errno, "madvise");
+    }
+}
+
+/*static*/ bool
+ESFile::getFileSizeAndModificationTime(const char     *path,
+                                       ESFilePathType pathType,
+                                       bool           missingOK,
+                                       size_t         *fileSizeReturn,
+                                       int64_t        *modificationTimeNsReturn) {
+    *fileSizeReturn = 0;
+    *modificationTimeNsReturn = 0;
+    size_t fileSize;
+    ESFileCloser *fileCloser;
+    int fd = ESFile::getFDPointingAtFile(path, pathType, missingOK, &fileSize, &fileCloser);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat statBuf;
+    int st = fstat(fd, &statBuf);
+    int statErrno = errno;
+    if (fileCloser) {
+        fileCloser->closeAndDie();
+    }
+    if (st != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESFile", statErrno,
+                                                ESUtil::stringWithFormat("Couldn't stat %s file [%s]",
+                                                                         ESFile::pathTypeString(pathType), path).c_str());
+        return false;
+    }
+    *fileSizeReturn = fileSize;
+#if ES_COCOA
+    const struct timespec &mtime = statBuf.st_mtimespec;
+#else
+    const struct timespec &mtime = statBuf.st_mtim;
+#endif
+    *modificationTimeNsReturn = (int64_t)mtime.tv_sec * 1000000000 + mtime.tv_nsec;
+    return true;
+}
+
+// Distinguishes the temporary files of concurrent atomic writes to the same path
+static std::atomic<unsigned int> tempFileCounter(0);
+
+/*static*/ bool 
+ESFile::writeArrayToFile(const void      *buf,
+                         size_t          buflen,
+                         const char      *path,
+                         ESFilePathType  pathType,
+                         ESFileWriteMode mode) {
+    return writeArrayToFileWithHeader(NULL, 0, buf, buflen, path, pathType, mode);
+}
+
 /*static*/ bool 
-ESFile::writeArrayToFile(const void *buf,
-                         size_t     buflen,
-                         const char *path,
-                         ESFilePathType pathType) {  // Must be ESFilePathTypeRelativeToDocumentDir or ESFilePathRelativeToAppSupportDir
+ESFile::writeArrayToFileWithHeader(const void      *header,
+                                   size_t          headerLength,
+                                   const void      *buf,
+                                   size_t          buflen,
+                                   const char      *path,
+                                   ESFilePathType  pathType,
+                                   ESFileWriteMode mode) {
     ESAssert(pathType == ESFilePathTypeRelativeToDocumentDir ||
              pathType == ESFilePathTypeRelativeToAppSupportDir);  // Can't write to resource directory
-    int fd = open(((pathType == ESFilePathTypeRelativeToDocumentDir ? ESFile::documentDirectory() : ESFile::appSupportDirectory()) + "/" + path).c_str(),
-                  O_CREAT|O_TRUNC|O_RDWR, 0777);
+    std::string directory = (pathType == ESFilePathTypeRelativeToDocumentDir ? ESFile::documentDirectory() : ESFile::appSupportDirectory());
+    std::string fullPath = directory + "/" + path;
+    std::string writePath = fullPath;
+    if (mode != ESFileWriteInPlace) {
+        writePath = ESUtil::stringWithFormat("%s.tmp%d.%u", fullPath.c_str(), (int)getpid(), tempFileCounter++);
+    }
+    int fd = open(writePath.c_str(),
+                  mode == ESFileWriteInPlace ? O_CREAT|O_TRUNC|O_RDWR : O_CREAT|O_EXCL|O_WRONLY, 0777);
     if (fd < 0) {
-	ESErrorReporter::logError("ESFile", "Error opening binary %s file %s [%s] for write: %s", ESFile::pathTypeString(pathType), path, (ESFile::documentDirectory() + path).c_str(), strerror(errno));
+	ESErrorReporter::logError("ESFile", "Error opening binary %s file %s [%s] for write: %s", ESFile::pathTypeString(pathType), path, writePath.c_str(), strerror(errno));
         ESAssert(false);
         return false;
     }
-    bool success = true;
-    ssize_t bytesWritten = write(fd, buf, buflen);
-    // ESErrorReporter::logInfo("ESFile::writeArrayToFile", "Closing fd %d", fd);
-    close(fd);
-    if (bytesWritten != buflen) {
+    bool success = writeFully(fd, header, headerLength) && writeFully(fd, buf, buflen);
+    if (!success) {
 	ESErrorReporter::logError("ESFile", "Failed to write entire %s file %s: %s", ESFile::pathTypeString(pathType), path, strerror(errno));
+    } else if (mode == ESFileWriteAtomicDurable && !syncToDisk(fd)) {
+	ESErrorReporter::logError("ESFile", "Failed to sync %s file %s: %s", ESFile::pathTypeString(pathType), path, strerror(errno));
         success = false;
-        unlink((ESFile::documentDirectory() + path).c_str());  // Unlink it so we don't have a partially written file confusing future reads
     }
+    // ESErrorReporter::logInfo("ESFile::writeArrayToFile", "Closing fd %d", fd);
+    close(fd);
+    if (success && mode != ESFileWriteInPlace) {
+        if (rename(writePath.c_str(), fullPath.c_str()) != 0) {
+            ESErrorReporter::logError("ESFile", "Failed to rename new %s file %s into place: %s", ESFile::pathTypeString(pathType), path, strerror(errno));
+            success = false;
+        } else if (mode == ESFileWriteAtomicDurable) {
+            // The rename itself isn't durable until the directory is synced
+            int dirFD = open(directory.c_str(), O_RDONLY);
+            if (dirFD >= 0) {
+                fsync(dirFD);
+                close(dirFD);
+            }
+        }
+    }
+    if (!success) {
+        unlink(writePath.c_str());  // Unlink it so we don't have a partially written file confusing future reads
+    }
+    // On some platforms the document and app support directories are the same, so forget the path either way
+    invalidateLookupCache(path);
     return success;
 }
 
+// An async write, owning its copy of the data
+struct ESFileAsyncWrite {
+    char                    *buf;
+    size_t                  buflen;
+    std::string             path;
+    ESFilePathType          pathType;
+    ESFileWriteMode         mode;
+    ESFileWriteCompletionFn completionFn;
+    void                    *completionObject;
+    ESThread                *callingThread;
+    bool                    success;
+};
+
+static ESSimpleWorkerThread *writerThread = NULL;
+static ESLock writerThreadLock;
+
+static void asyncWriteCompletionGlue(void *obj,
+                                     void *param) {
+    ESFileAsyncWrite *asyncWrite = (ESFileAsyncWrite *)obj;
+    (*asyncWrite->completionFn)(asyncWrite->completionObject, asyncWrite->success);
+    delete asyncWrite;
+}
+
+static void asyncWriteGlue(void *obj,
+                           void *param) {
+    ESFileAsyncWrite *asyncWrite = (ESFileAsyncWrite *)obj;
+    asyncWrite->success = ESFile::writeArrayToFile(asyncWrite->buf, asyncWrite->buflen, asyncWrite->path.c_str(),
+                                                   asyncWrite->pathType, asyncWrite->mode);
+    free(asyncWrite->buf);
+    asyncWrite->buf = NULL;
+    if (asyncWrite->completionFn) {
+        asyncWrite->callingThread->callInThread(asyncWriteCompletionGlue, asyncWrite, NULL);
+    } else {
+        delete asyncWrite;
+    }
+}
+
+/*static*/ void
+ESFile::writeArrayToFileAsync(const void              *buf,
+                              size_t                  buflen,
+                              const char              *path,
+                              ESFilePathType          pathType,
+                              ESFileWriteMode         mode,
+                              ESFileWriteCompletionFn completionFn,
+                              void                    *completionObject) {
+    ESFileAsyncWrite *asyncWrite = new ESFileAsyncWrite;
+    asyncWrite->buf = (char *)malloc(buflen ? buflen : 1);
+    memcpy(asyncWrite->buf, buf, buflen);
+    asyncWrite->buflen = buflen;
+    asyncWrite->path = path;
+    asyncWrite->pathType = pathType;
+    asyncWrite->mode = mode;
+    asyncWrite->completionFn = completionFn;
+    asyncWrite->completionObject = completionObject;
+    asyncWrite->callingThread = completionFn ? ESThread::currentThread() : NULL;
+    asyncWrite->success = false;
+    ESAssert(!completionFn || asyncWrite->callingThread);
+    writerThreadLock.lock();
+    if (!writerThread) {
+        writerThread = new ESSimpleWorkerThread("ESFileWriter", ESChildThreadExitsOnlyByParentRequest, ESInterThreadTransportMailbox);
+        writerThread->start();
+    }
+    writerThreadLock.unlock();
+    writerThread->callInThread(asyncWriteGlue, asyncWrite, NULL);
+}
+
 /*static*/ int 
 ESFile::getFDPointingAtFileInDirectory(const char        *path,
                                        const std::string &dir,
@@ -182,6 +688,30 @@ ESFile::getFDPointingAtFileInDirectory(const char        *path,
     return fd;
 }
 
+/*static*/ int
+ESFile::getFDPointingAtFileInDirectoryFD(const char *path,
+                                         int        dirFD,
+                                         bool       missingOK,
+                                         size_t     *fileSizeReturn) {
+    int fd = openat(dirFD, path, O_RDONLY);
+    if (fd < 0) {
+        if (!missingOK) {
+            ESErrorReporter::logError("ESFile", "Error opening binary file %s: %s", path, strerror(errno));
+        }
+        *fileSizeReturn = 0;
+	return -1;
+    }
+    struct stat buf;
+    if (fstat(fd, &buf) != 0) {
+	ESErrorReporter::logError("ESFile", "Error running fstat on file %s: %s", path, strerror(errno));
+        close(fd);
+        *fileSizeReturn = 0;
+        return -1;
+    }
+    *fileSizeReturn = (size_t)buf.st_size;
+    return fd;
+}
+
 /*static*/ std::string
 ESFile::ensureDirectoryExists(const std::string &fullPath) {
     struct stat buf;
@@ -230,8 +760,8 @@ ESFile::removeFileAtPath(const char *path) {
 /*static*/ void 
 ESFile::removeFileAtPathIfPresent(const char *path) {
     int st = unlink(path);
-    if (st != 0 && st != ENOENT) {
-        ESErrorReporter::checkAndLogSystemError("ESFile::removeFileAtPath", st, path);
+    if (st != 0 && errno != ENOENT) {
+        ESErrorReporter::checkAndLogSystemError("ESFile::removeFileAtPath", errno, path);
     }
 }
 
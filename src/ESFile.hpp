@@ -9,8 +9,12 @@
 #define _ESFILE_HPP_
 
 #include <string>
+#include <vector>
+
+#include <time.h>  // For time_t
 
 #include "ESPlatform.h"
+#include "ESLock.hpp"
 #if ES_ANDROID
 #include "ESJNIDefs.hpp"
 #define ES_SIMPLE_RESOURCE 0
@@ -25,6 +29,51 @@ enum ESFilePathType {
     ESFilePathTypeRelativeToAppSupportThenResourceDir,
 };
 
+// Hints for how a memory-mapped file will be accessed (see madvise(2)).
+enum ESFileAccessAdvice {
+    ESFileAccessNormal,
+    ESFileAccessSequential,
+    ESFileAccessRandom,
+    ESFileAccessWillNeed      // Start reading it all in now, in the background
+};
+
+// How writeArrayToFile replaces an existing file
+enum ESFileWriteMode {
+    ESFileWriteInPlace,        // Truncate and overwrite; a crash or failure part way through leaves a torn file
+    ESFileWriteAtomic,         // Write a temporary file and rename it over the target, so readers see either the old file or the new one
+    ESFileWriteAtomicDurable   // As ESFileWriteAtomic, and also sync the data and the directory, so the new file survives a power loss
+};
+
+typedef void (*ESFileWriteCompletionFn)(void *completionObject,
+                                        bool success);
+
+// Called by ESFile::readFileInChunks with each successive chunk of the file.  The chunk is only
+// valid during the call.  Return false to stop reading.
+typedef bool (*ESFileChunkFn)(void       *context,
+                              const char *chunk,
+                              size_t     chunkLength,
+                              size_t     offsetInFile);
+
+/** A thread-safe pool of equal-sized buffers, so that streaming reads don't allocate
+ *  a new buffer per file.  Buffers beyond maxIdleBuffers are freed when released. */
+class ESFileBufferPool {
+  public:
+                            ESFileBufferPool(size_t bufferSize,
+                                             int    maxIdleBuffers = 4);
+                            ~ESFileBufferPool();
+
+    size_t                  bufferSize() const { return _bufferSize; }
+
+    char                    *acquireBuffer();
+    void                    releaseBuffer(char *buffer);
+
+  private:
+    size_t                  _bufferSize;
+    int                     _maxIdleBuffers;
+    std::vector<char *>     _idleBuffers;
+    ESLock                  _lock;
+};
+
 // Interface class which handles the closing of a file if necessary.
 class ESFileCloser {
   public:
@@ -51,6 +100,23 @@ class ESFile {
                                                            bool              missingOK,
                                                            size_t            *fileSizeReturn);
 
+    /** Like getFDPointingAtFileInDirectory, but relative to an open directory (see directoryFD()) */
+    static int              getFDPointingAtFileInDirectoryFD(const char *path,
+                                                             int        dirFD,
+                                                             bool       missingOK,
+                                                             size_t     *fileSizeReturn);
+
+    /** A descriptor for the directory underlying the given path type, opened on first use and
+     *  kept open, or -1 if there isn't one (e.g., for Android resources, which live in the APK)
+     *  or it couldn't be opened.  A failure isn't retried until invalidateLookupCache(NULL). */
+    static int              directoryFD(ESFilePathType pathType);
+
+    /** Lookups with ESFilePathTypeRelativeToAppSupportThenResourceDir remember which files
+     *  aren't in the app support directory.  Our own writes keep that up to date; call this
+     *  after creating a file there by some other means.  Pass NULL to forget everything,
+     *  including any directory directoryFD() couldn't open. */
+    static void             invalidateLookupCache(const char *path);
+
     static int              getFDPointingAtResource(const char   *resourcePath,
                                                     bool         missingOK,
                                                     size_t       *resourceSizeReturn,
@@ -61,6 +127,63 @@ class ESFile {
                                                            bool           missingOK,
                                                            size_t         *fileSizeReturn);
 
+    /** Read from fd until buflen bytes have been read or we reach EOF or an error, retrying
+     *  interrupted and short reads.
+     *  @return the number of bytes read, or -1 on error. */
+    static ssize_t          readFully(int    fd,
+                                      void   *buf,
+                                      size_t buflen);
+
+    /** Write all buflen bytes to fd, retrying interrupted and short writes.  A write which
+     *  makes no progress is an error (with errno EIO), rather than being retried forever.
+     *  @return true iff everything was written; otherwise errno describes the failure. */
+    static bool             writeFully(int        fd,
+                                       const void *buf,
+                                       size_t     buflen);
+
+    /** Wait for what's been written to fd to reach the disk: fdatasync where we have it, else fsync.
+     *  @return true on success; otherwise errno describes the failure. */
+    static bool             syncToDisk(int fd);
+
+    /** Read the file a chunk at a time, calling chunkFn with each chunk in order.  Every chunk
+     *  but the last is exactly pool->bufferSize() bytes, so memory use doesn't depend on the
+     *  size of the file.  If pool is NULL, defaultBufferPool() is used.
+     *  @return true iff the entire file was read and chunkFn never returned false. */
+    static bool             readFileInChunks(const char       *path,
+                                             ESFilePathType   pathType,
+                                             bool             missingOK,
+                                             ESFileBufferPool *pool,
+                                             ESFileChunkFn    chunkFn,
+                                             void             *context);
+    static ESFileBufferPool *defaultBufferPool();  // 256KB buffers
+
+    /** Map the file read-only (MAP_PRIVATE) instead of reading it; pages are read in from the file on first access.
+     *  The mapping must be released by passing *mapBaseReturn and *mapLengthReturn to unmapFileContents().
+     *  The returned pointer is not necessarily *mapBaseReturn (resource files might not start on a page boundary).
+     *  @return NULL if the file couldn't be opened or mapped. */
+    static const char       *mapFileContents(const char         *path,
+                                             ESFilePathType     pathType,
+                                             bool               missingOK,
+                                             ESFileAccessAdvice advice,
+                                             size_t             *fileSizeReturn,
+                                             void               **mapBaseReturn,
+                                             size_t             *mapLengthReturn);
+    static void             unmapFileContents(void   *mapBase,
+                                              size_t mapLength);
+    static void             adviseMappedContents(void               *mapBase,
+                                                 size_t             mapLength,
+                                                 ESFileAccessAdvice advice);
+
+    /** The size and modification time (in nanoseconds since the epoch, so that two writes within
+     *  a second can be told apart) of the file, as found by getFDPointingAtFile.  For resources
+     *  embedded in a larger file (e.g., Android assets) the time is that of the containing file.
+     *  @return false (with zeroes returned) if the file couldn't be opened. */
+    static bool             getFileSizeAndModificationTime(const char     *path,
+                                                           ESFilePathType pathType,
+                                                           bool           missingOK,
+                                                           size_t         *fileSizeReturn,
+                                                           int64_t        *modificationTimeNsReturn);
+
     static bool             fileExistsAtPath(const char *path);
 
     static void             removeFileAtPath(const char *path);
@@ -68,10 +191,32 @@ class ESFile {
 
     /** Write the given buffer to the given file.
      *  @return true iff the write was successful. */
-    static bool             writeArrayToFile(const void *buf,
-                                             size_t     buflen,
-                                             const char *path,
-                                             ESFilePathType pathType);  // Must be ESFilePathTypeRelativeToAppSupportDir
+    static bool             writeArrayToFile(const void      *buf,
+                                             size_t          buflen,
+                                             const char      *path,
+                                             ESFilePathType  pathType,  // Must be ESFilePathTypeRelativeToDocumentDir or ESFilePathTypeRelativeToAppSupportDir
+                                             ESFileWriteMode mode = ESFileWriteInPlace);
+
+    /** As writeArrayToFile, but first write headerLength bytes from header */
+    static bool             writeArrayToFileWithHeader(const void      *header,
+                                                       size_t          headerLength,
+                                                       const void      *buf,
+                                                       size_t          buflen,
+                                                       const char      *path,
+                                                       ESFilePathType  pathType,
+                                                       ESFileWriteMode mode = ESFileWriteInPlace);
+
+    /** Write the given buffer to the given file in a background writer thread, and then call
+     *  completionFn (if not NULL) in the calling thread, which must therefore be an ESThread.
+     *  The buffer is copied, so the caller may reuse it as soon as this returns.  Writes
+     *  are done in the order in which they were requested. */
+    static void             writeArrayToFileAsync(const void              *buf,
+                                                  size_t                  buflen,
+                                                  const char              *path,
+                                                  ESFilePathType          pathType,
+                                                  ESFileWriteMode         mode,
+                                                  ESFileWriteCompletionFn completionFn,
+                                                  void                    *completionObject);
 
     static std::string      ensureDirectoryExistsInAppSupportDirectoryWithRelativePath(const char *relativePath);
     static std::string      ensureDirectoryExists(const std::string &absolutePath);
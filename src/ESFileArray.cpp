@@ -7,46 +7,922 @@
 
 #include "ESFileArray.hpp"
 #include "ESErrorReporter.hpp"
+#include "ESLZ4.hpp"
+#include "ESFileIO.hpp"
+#include "ESParallel.hpp"
+#include "ESThreadPool.hpp"
+#include "ESUtil.hpp"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+// Elements in a batch this close together (in bytes of the gap between them) are read with a
+// single pread of the whole span rather than one each; a syscall costs far more than copying a
+// few pages.  The span itself is capped so a sparse batch doesn't read the whole file.
+#define ES_FILE_ARRAY_READER_MAX_GAP  (16 * 1024)
+#define ES_FILE_ARRAY_READER_MAX_SPAN (256 * 1024)
 
 class ESFileStringArray;
 
+// NUL scanning for string tables.  Each vector step compares a block of bytes against zero and
+// turns the result into a mask with one bit per NUL byte, so that counting is a popcount and
+// finding each terminator is a count-trailing-zeros, rather than a compare and branch per byte.
+#if defined(__AVX2__)
+#define ES_NUL_SCAN_BLOCK 32
+#define ES_NUL_SCAN_BITS_PER_BYTE 1
+static inline uint64_t
+nulMaskForBlock(const char *ptr) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)ptr);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_setzero_si256()));
+}
+#elif defined(__SSE2__)
+#define ES_NUL_SCAN_BLOCK 16
+#define ES_NUL_SCAN_BITS_PER_BYTE 1
+static inline uint64_t
+nulMaskForBlock(const char *ptr) {
+    __m128i block = _mm_loadu_si128((const __m128i *)ptr);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128()));
+}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+// NEON has no movemask; narrowing the 0x00/0xff compare result by 4 bits gives a nibble per
+// byte, and keeping only the top bit of each nibble leaves one bit per byte at bit 4*i+3.
+#define ES_NUL_SCAN_BLOCK 16
+#define ES_NUL_SCAN_BITS_PER_BYTE 4
+static inline uint64_t
+nulMaskForBlock(const char *ptr) {
+    uint8x16_t isNul = vceqq_u8(vld1q_u8((const uint8_t *)ptr), vdupq_n_u8(0));
+    uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(isNul), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(nibbles), 0) & 0x8888888888888888ULL;
+}
+#endif
+
+// The number of NUL bytes in [ptr, end)
+static size_t
+countNULs(const char *ptr,
+          const char *end) {
+    size_t count = 0;
+#ifdef ES_NUL_SCAN_BLOCK
+    for (; ptr + ES_NUL_SCAN_BLOCK <= end; ptr += ES_NUL_SCAN_BLOCK) {
+        count += __builtin_popcountll(nulMaskForBlock(ptr));
+    }
+#endif
+    for (; ptr < end; ptr++) {
+        count += (*ptr == '\0');
+    }
+    return count;
+}
+
+// Store a pointer to the start of each string in [ptr, end) (the first byte, and each byte after
+// a NUL, except at the end) into dest, and return the end of what was stored.
+static const char **
+storeStringStarts(const char  *ptr,
+                  const char  *end,
+                  const char  **dest) {
+    if (ptr >= end) {
+        return dest;
+    }
+    *dest++ = ptr;
+#ifdef ES_NUL_SCAN_BLOCK
+    for (; ptr + ES_NUL_SCAN_BLOCK <= end; ptr += ES_NUL_SCAN_BLOCK) {
+        uint64_t mask = nulMaskForBlock(ptr);
+        while (mask) {
+            const char *nul = ptr + __builtin_ctzll(mask) / ES_NUL_SCAN_BITS_PER_BYTE;
+            if (nul + 1 < end) {
+                *dest++ = nul + 1;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; ptr < end; ptr++) {
+        if (*ptr == '\0' && ptr + 1 < end) {
+            *dest++ = ptr + 1;
+        }
+    }
+    return dest;
+}
+
+// A string index file is this header followed by numStrings 32-bit offsets into the strings file.
+// It's written in native byte order, which is little-endian on every platform we run on.
+#define ES_STRING_INDEX_MAGIC   0x58535345  // "ESSX"
+#define ES_STRING_INDEX_VERSION 2           // 1 had the modification time in seconds
+struct ESFileStringIndexHeader {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                numStrings;
+    uint32_t                reserved;
+    uint64_t                sourceSize;
+    int64_t                 sourceModificationTimeNs;
+};
+
 ESFileStringArray::ESFileStringArray(const char     *path,
                                      ESFilePathType pathType,
-                                     int            arraySizeGuess)
-:   ESFileArray<char>(path, pathType)
+                                     int            /*arraySizeGuess*/)  // Ignored (see header)
+:   ESFileArray<char>(path, pathType),
+    _strings(NULL),
+    _numStrings(0),
+    _stringsCapacity(0),
+    _offsets(NULL),
+    _indexMapBase(NULL),
+    _indexMapLength(0)
 {
     if (!_array) {
-        _strings = NULL;
-        _numStrings = 0;
-        _stringsCapacity = 0;
         return;
     }
-    _stringsCapacity = arraySizeGuess;
-    ESAssert(arraySizeGuess > 0);
-    _strings = (const char **)malloc(_stringsCapacity * sizeof(char *));
-    char *ptr = _array;
-    char *end = _array + _bytesRead;
-    const char **dest = _strings;
-    const char **destCapacityEnd = _strings + _stringsCapacity;
-    while (ptr < end) {
-	char *adv = ptr;
-	while (*adv++)
-	    ;  // empty
-        if (dest >= destCapacityEnd) {
-            _stringsCapacity *= 1.5;
-            size_t destOffset = dest - _strings;
-            _strings = (const char **)realloc(_strings, _stringsCapacity * sizeof(char *));
-            dest = _strings + destOffset;
-            destCapacityEnd = _strings + _stringsCapacity;
-        }
-        *dest++ = ptr;
-	ESAssert(adv <= end);
-	ptr = adv;
-    }
-    _numStrings = dest - _strings;
+    scanForStrings();
+}
+
+ESFileStringArray::ESFileStringArray(const char     *path,
+                                     ESFilePathType pathType,
+                                     const char     *indexPath,
+                                     ESFilePathType indexPathType,
+                                     int            /*arraySizeGuess*/)  // Ignored (see header)
+:   ESFileArray<char>(path, pathType, ESFileArrayLoadByMapping, ESFileAccessRandom),
+    _strings(NULL),
+    _numStrings(0),
+    _stringsCapacity(0),
+    _offsets(NULL),
+    _indexMapBase(NULL),
+    _indexMapLength(0)
+{
+    if (!_array) {
+        return;
+    }
+    size_t sourceSize;
+    int64_t sourceModificationTimeNs;
+    if (ESFile::getFileSizeAndModificationTime(path, pathType, false/* !missingOK*/, &sourceSize, &sourceModificationTimeNs) &&
+        sourceSize == _bytesRead &&
+        mapIndex(indexPath, indexPathType, sourceSize, sourceModificationTimeNs)) {
+        return;
+    }
+    ESErrorReporter::logInfo("ESFileStringArray", "No valid index %s for %s; scanning\n", indexPath, path);
+    if (scanForStrings() &&
+        sourceSize == _bytesRead &&
+        (indexPathType == ESFilePathTypeRelativeToDocumentDir || indexPathType == ESFilePathTypeRelativeToAppSupportDir)) {
+        writeIndex(indexPath, indexPathType, sourceSize, sourceModificationTimeNs);
+    }
 }
 
 ESFileStringArray::~ESFileStringArray() {
     free((char **)_strings);
+    if (_indexMapBase) {
+        ESFile::unmapFileContents(_indexMapBase, _indexMapLength);
+    }
+}
+
+bool
+ESFileStringArray::scanForStrings() {
+    const char *end = _array + _bytesRead;
+    if (_bytesRead > 0 && end[-1] != '\0') {
+        // We hand out pointers into the file itself, so the last string would run off the end
+        ESErrorReporter::logError("ESFileStringArray", "Ignoring strings file whose last string is unterminated\n");
+        return false;
+    }
+    // Count first, so that the pointer array is allocated once at the right size
+    _numStrings = countNULs(_array, end);
+    _stringsCapacity = _numStrings;
+    _strings = (const char **)malloc(_stringsCapacity * sizeof(char *));
+    const char **dest = storeStringStarts(_array, end, _strings);
+    ESAssert(dest - _strings == _numStrings);
+    return true;
+}
+
+bool
+ESFileStringArray::mapIndex(const char     *indexPath,
+                            ESFilePathType indexPathType,
+                            size_t         sourceSize,
+                            int64_t        sourceModificationTimeNs) {
+    size_t indexSize;
+    void *mapBase;
+    size_t mapLength;
+    const char *indexBytes = ESFile::mapFileContents(indexPath, indexPathType, true/*missingOK*/, ESFileAccessRandom,
+                                                     &indexSize, &mapBase, &mapLength);
+    if (!indexBytes) {
+        return false;
+    }
+    const ESFileStringIndexHeader *header = (const ESFileStringIndexHeader *)indexBytes;
+    const uint32_t *offsets = (const uint32_t *)(indexBytes + sizeof(ESFileStringIndexHeader));
+    // Everything here is O(1): we trust the offsets themselves once the header matches.
+    bool valid = ((uintptr_t)indexBytes % sizeof(uint64_t)) == 0 &&
+        indexSize >= sizeof(ESFileStringIndexHeader) &&
+        header->magic == ES_STRING_INDEX_MAGIC &&
+        header->version == ES_STRING_INDEX_VERSION &&
+        header->sourceSize == sourceSize &&
+        header->sourceModificationTimeNs == sourceModificationTimeNs &&
+        header->numStrings > 0 &&
+        indexSize == sizeof(ESFileStringIndexHeader) + header->numStrings * sizeof(uint32_t) &&
+        offsets[header->numStrings - 1] < sourceSize &&
+        _array[sourceSize - 1] == '\0';  // So the last string can't run off the end
+    if (!valid) {
+        ESErrorReporter::logInfo("ESFileStringArray", "Ignoring stale or malformed index %s\n", indexPath);
+        ESFile::unmapFileContents(mapBase, mapLength);
+        return false;
+    }
+    _offsets = offsets;
+    _numStrings = header->numStrings;
+    _indexMapBase = mapBase;
+    _indexMapLength = mapLength;
+    return true;
+}
+
+bool
+ESFileStringArray::writeIndex(const char     *indexPath,
+                              ESFilePathType indexPathType,
+                              size_t         sourceSize,
+                              int64_t        sourceModificationTimeNs) const {
+    ESAssert(_strings);
+    if (sourceSize > UINT32_MAX || _numStrings > UINT32_MAX) {
+        ESErrorReporter::logError("ESFileStringArray", "Strings file too large for a 32-bit index: %zu bytes\n", sourceSize);
+        return false;
+    }
+    size_t indexSize = sizeof(ESFileStringIndexHeader) + _numStrings * sizeof(uint32_t);
+    char *indexBytes = (char *)malloc(indexSize);
+    ESFileStringIndexHeader *header = (ESFileStringIndexHeader *)indexBytes;
+    header->magic = ES_STRING_INDEX_MAGIC;
+    header->version = ES_STRING_INDEX_VERSION;
+    header->numStrings = (uint32_t)_numStrings;
+    header->reserved = 0;
+    header->sourceSize = sourceSize;
+    header->sourceModificationTimeNs = sourceModificationTimeNs;
+    uint32_t *offsets = (uint32_t *)(indexBytes + sizeof(ESFileStringIndexHeader));
+    for (long i = 0; i < _numStrings; i++) {
+        offsets[i] = (uint32_t)(_strings[i] - _array);
+    }
+    // Atomically, so that a reader never maps a partly written index
+    bool success = ESFile::writeArrayToFile(indexBytes, indexSize, indexPath, indexPathType, ESFileWriteAtomic);
+    free(indexBytes);
+    return success;
+}
+
+/*static*/ bool
+ESFileStringArray::writeIndexFile(const char     *path,
+                                  ESFilePathType pathType,
+                                  const char     *indexPath,
+                                  ESFilePathType indexPathType) {
+    size_t sourceSize;
+    int64_t sourceModificationTimeNs;
+    if (!ESFile::getFileSizeAndModificationTime(path, pathType, false/* !missingOK*/, &sourceSize, &sourceModificationTimeNs)) {
+        return false;
+    }
+    ESFileStringArray strings(path, pathType, 1024);
+    if (!strings._strings || strings._bytesRead != sourceSize) {
+        return false;
+    }
+    return strings.writeIndex(indexPath, indexPathType, sourceSize, sourceModificationTimeNs);
 }
 
+const char **
+ESFileStringArray::strings() const {
+    if (!_strings && _offsets) {
+        _strings = (const char **)malloc(_numStrings * sizeof(char *));
+        for (long i = 0; i < _numStrings; i++) {
+            _strings[i] = _array + _offsets[i];
+        }
+    }
+    return _strings;
+}
+
+struct ESFileArrayReaderBase::AsyncRead {
+    const int                   *indices;
+    int                         numIndices;
+    void                        *records;
+    ESFileArrayReadCompletionFn completionFn;
+    void                        *completionObject;
+    bool                        success;
+};
+
+static uint32_t headerCRC(const ESFileArrayHeader *header) {
+    return ESUtil::crc32c(header, offsetof(ESFileArrayHeader, headerCRC));
+}
+
+/*static*/ bool
+ESFileArrayContainer::write(const void      *data,
+                            size_t          elementSize,
+                            size_t          numElements,
+                            const char      *path,
+                            ESFilePathType  pathType,
+                            ESFileWriteMode mode) {
+    size_t dataSize = elementSize * numElements;
+    size_t dataOffset = (sizeof(ESFileArrayHeader) + ES_FILE_ARRAY_DATA_ALIGNMENT - 1) & ~(size_t)(ES_FILE_ARRAY_DATA_ALIGNMENT - 1);
+    char *prefix = (char *)calloc(1, dataOffset);  // The header, then zeroes up to the data
+    ESFileArrayHeader *header = (ESFileArrayHeader *)prefix;
+    header->magic = ES_FILE_ARRAY_MAGIC;
+    header->version = ES_FILE_ARRAY_VERSION;
+    header->headerSize = sizeof(ESFileArrayHeader);
+    header->elementSize = (uint32_t)elementSize;
+    header->alignment = ES_FILE_ARRAY_DATA_ALIGNMENT;
+    header->numElements = numElements;
+    header->dataOffset = dataOffset;
+    header->dataCRC = ESUtil::crc32c(data, dataSize);
+    header->headerCRC = headerCRC(header);
+    bool success = ESFile::writeArrayToFileWithHeader(prefix, dataOffset, data, dataSize, path, pathType, mode);
+    free(prefix);
+    return success;
+}
+
+/*static*/ bool
+ESFileArrayContainer::validateHeader(const ESFileArrayHeader *header,
+                                     size_t                  fileSize,
+                                     size_t                  elementSize,
+                                     const char              *path) {
+    const char *problem = NULL;
+    if (fileSize < sizeof(ESFileArrayHeader) || header->magic != ES_FILE_ARRAY_MAGIC) {
+        problem = "no header";
+    } else if (header->version != ES_FILE_ARRAY_VERSION || header->headerSize != sizeof(ESFileArrayHeader)) {
+        problem = "unsupported version";
+    } else if (header->headerCRC != headerCRC(header)) {
+        problem = "corrupt header";
+    } else if (header->elementSize != elementSize) {
+        problem = "element size doesn't match";
+    } else if (header->alignment == 0 || (header->alignment & (header->alignment - 1)) != 0
+               || header->dataOffset % header->alignment != 0 || header->dataOffset < sizeof(ESFileArrayHeader)
+               || header->dataOffset > fileSize
+               || header->numElements > (fileSize - header->dataOffset) / elementSize) {
+        problem = "sizes don't match file";
+    }
+    if (problem) {
+        ESErrorReporter::logError("ESFileArray", "Invalid header in %s: %s", path, problem);
+        return false;
+    }
+    return true;
+}
+
+/*static*/ void *
+ESFileArrayContainer::load(const char            *path,
+                           ESFilePathType        pathType,
+                           ESFileArrayLoadMode   loadMode,
+                           ESFileAccessAdvice    advice,
+                           ESFileArrayValidation validation,
+                           size_t                elementSize,
+                           size_t                elementAlignment,
+                           size_t                *dataSizeReturn,
+                           void                  **mapBaseReturn,
+                           size_t                *mapLengthReturn) {
+    *dataSizeReturn = 0;
+    *mapBaseReturn = NULL;
+    *mapLengthReturn = 0;
+    void *data = NULL;
+    size_t dataSize = 0;
+    uint32_t expectedCRC = 0;
+    if (loadMode == ESFileArrayLoadByMapping) {
+        size_t fileSize;
+        const char *contents = ESFile::mapFileContents(path, pathType, false/* !missingOK*/, advice, &fileSize, mapBaseReturn, mapLengthReturn);
+        if (!contents) {
+            return NULL;
+        }
+        const ESFileArrayHeader *header = (const ESFileArrayHeader *)contents;
+        if (!validateHeader(header, fileSize, elementSize, path)) {
+            ESFile::unmapFileContents(*mapBaseReturn, *mapLengthReturn);
+            *mapBaseReturn = NULL;
+            *mapLengthReturn = 0;
+            return NULL;
+        }
+        data = (void *)(contents + header->dataOffset);
+        dataSize = header->numElements * elementSize;
+        expectedCRC = header->dataCRC;
+        if ((uintptr_t)data % elementAlignment != 0) {
+            // The file doesn't start on a page, as with a resource inside an APK, and we can't use
+            // the elements where they are
+            ESErrorReporter::logInfo("ESFileArray", "Mapped elements of %s are misaligned; reading it instead", path);
+            ESFile::unmapFileContents(*mapBaseReturn, *mapLengthReturn);
+            *mapBaseReturn = NULL;
+            *mapLengthReturn = 0;
+            data = NULL;
+            loadMode = ESFileArrayLoadByReading;
+        }
+    }
+    if (loadMode == ESFileArrayLoadByReading) {
+        // Read the header, skip the padding, and read the data straight into its own buffer
+        size_t fileSize;
+        ESFileCloser *fileCloser;
+        int fd = ESFile::getFDPointingAtFile(path, pathType, false/* !missingOK*/, &fileSize, &fileCloser);
+        if (fd < 0) {
+            return NULL;
+        }
+        ESFileArrayHeader header;
+        bool success = (ESFile::readFully(fd, &header, sizeof(header)) == (ssize_t)sizeof(header)
+                        || fileSize < sizeof(header))  // Let validateHeader() report that
+            && validateHeader(&header, fileSize, elementSize, path);
+        if (success) {
+            dataSize = header.numElements * elementSize;
+            expectedCRC = header.dataCRC;
+            data = malloc(dataSize ? dataSize : 1);
+            success = lseek(fd, header.dataOffset - sizeof(header), SEEK_CUR) >= 0
+                && ESFile::readFully(fd, data, dataSize) == (ssize_t)dataSize;
+            if (!success) {
+                ESErrorReporter::logError("ESFileArray", "Failed to read data of %s", path);
+                free(data);
+                data = NULL;
+            }
+        }
+        if (fileCloser) {
+            fileCloser->closeAndDie();
+        }
+        if (!success) {
+            return NULL;
+        }
+    }
+    if (validation == ESFileArrayValidateChecksum && ESUtil::crc32c(data, dataSize) != expectedCRC) {
+        ESErrorReporter::logError("ESFileArray", "Checksum mismatch in %s", path);
+        if (*mapBaseReturn) {
+            ESFile::unmapFileContents(*mapBaseReturn, *mapLengthReturn);
+            *mapBaseReturn = NULL;
+            *mapLengthReturn = 0;
+        } else {
+            free(data);
+        }
+        return NULL;
+    }
+    *dataSizeReturn = dataSize;
+    return data;
+}
+
+// pread until length bytes have been read, retrying interrupted and short reads
+static bool
+preadAll(int    fd,
+         void   *buf,
+         size_t length,
+         off_t  offset) {
+    char *ptr = (char *)buf;
+    while (length > 0) {
+        ssize_t st = pread(fd, ptr, length, offset);
+        if (st < 0 && errno == EINTR) {
+            continue;
+        }
+        if (st <= 0) {
+            return false;
+        }
+        ptr += st;
+        offset += st;
+        length -= st;
+    }
+    return true;
+}
+
+static uint32_t compressedHeaderCRC(const ESFileArrayCompressedHeader *header) {
+    return ESUtil::crc32c(header, offsetof(ESFileArrayCompressedHeader, headerCRC));
+}
+
+/*static*/ size_t
+ESFileArrayContainer::blockDataSize(const ESFileArrayCompressedHeader *header,
+                                    uint32_t                          blockNumber) {
+    uint64_t firstElement = (uint64_t)blockNumber * header->elementsPerBlock;
+    uint64_t numElements = std::min<uint64_t>(header->elementsPerBlock, header->numElements - firstElement);
+    return (size_t)(numElements * header->elementSize);
+}
+
+/*static*/ bool
+ESFileArrayContainer::writeCompressed(const void      *data,
+                                      size_t          elementSize,
+                                      size_t          numElements,
+                                      const char      *path,
+                                      ESFilePathType  pathType,
+                                      ESFileWriteMode mode) {
+    ESFileArrayCompressedHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = ES_FILE_ARRAY_COMPRESSED_MAGIC;
+    header.version = ES_FILE_ARRAY_COMPRESSED_VERSION;
+    header.headerSize = sizeof(ESFileArrayCompressedHeader);
+    header.elementSize = (uint32_t)elementSize;
+    header.elementsPerBlock = elementSize < ES_FILE_ARRAY_BLOCK_SIZE ? ES_FILE_ARRAY_BLOCK_SIZE / elementSize : 1;
+    header.numElements = numElements;
+    uint64_t numBlocks = (numElements + header.elementsPerBlock - 1) / header.elementsPerBlock;
+    if (numBlocks > UINT32_MAX || elementSize > ES_FILE_ARRAY_MAX_BLOCK_SIZE) {
+        ESErrorReporter::logError("ESFileArray", "Can't compress %s: %zu elements of %zu bytes is too many or too large", path, numElements, elementSize);
+        return false;
+    }
+    header.numBlocks = (uint32_t)numBlocks;
+
+    // Compress each block into its own slot of a scratch buffer, in parallel, and then pack them together in order
+    size_t blockCapacity = ESLZ4::compressBound(header.elementsPerBlock * elementSize);
+    char *scratch = (char *)malloc(numBlocks * blockCapacity + 1);
+    size_t prefixSize = sizeof(ESFileArrayCompressedHeader) + numBlocks * sizeof(ESFileArrayBlockEntry);
+    char *prefix = (char *)malloc(prefixSize);
+    ESFileArrayBlockEntry *index = (ESFileArrayBlockEntry *)(prefix + sizeof(ESFileArrayCompressedHeader));
+    ESParallel::forRange(0, (long)numBlocks, 1, [&](long chunkBegin, long chunkEnd) {
+        for (long i = chunkBegin; i < chunkEnd; i++) {
+            const char *blockData = (const char *)data + (size_t)i * header.elementsPerBlock * elementSize;
+            size_t dataSize = blockDataSize(&header, (uint32_t)i);
+            char *slot = scratch + i * blockCapacity;
+            size_t compressedSize = ESLZ4::compress(blockData, dataSize, slot, blockCapacity);
+            if (compressedSize == 0 || compressedSize >= dataSize) {
+                memcpy(slot, blockData, dataSize);  // It doesn't compress, so store it as is
+                compressedSize = dataSize;
+            }
+            index[i].compressedSize = (uint32_t)compressedSize;
+            index[i].dataCRC = ESUtil::crc32c(blockData, dataSize);
+        }
+    });
+    uint64_t offset = prefixSize;
+    char *packedEnd = scratch;
+    for (uint32_t i = 0; i < numBlocks; i++) {
+        index[i].offset = offset;
+        memmove(packedEnd, scratch + i * blockCapacity, index[i].compressedSize);  // Never moves forward, so never overwrites a block not yet packed
+        packedEnd += index[i].compressedSize;
+        offset += index[i].compressedSize;
+    }
+    header.indexCRC = ESUtil::crc32c(index, numBlocks * sizeof(ESFileArrayBlockEntry));
+    header.headerCRC = compressedHeaderCRC(&header);
+    memcpy(prefix, &header, sizeof(header));
+    ESLogDebug("ESFileArray", "Compressed %s from %zu to %lld bytes in %u blocks", path, numElements * elementSize, (long long)offset, header.numBlocks);
+    bool success = ESFile::writeArrayToFileWithHeader(prefix, prefixSize, scratch, packedEnd - scratch, path, pathType, mode);
+    free(prefix);
+    free(scratch);
+    return success;
+}
+
+/*static*/ bool
+ESFileArrayContainer::validateCompressedIndex(const ESFileArrayCompressedHeader *header,
+                                              const ESFileArrayBlockEntry       *index,
+                                              size_t                            fileSize,
+                                              size_t                            elementSize,
+                                              const char                        *path) {
+    const char *problem = NULL;
+    if (fileSize < sizeof(ESFileArrayCompressedHeader) || header->magic != ES_FILE_ARRAY_COMPRESSED_MAGIC) {
+        problem = "no header";
+    } else if (header->version != ES_FILE_ARRAY_COMPRESSED_VERSION || header->headerSize != sizeof(ESFileArrayCompressedHeader)) {
+        problem = "unsupported version";
+    } else if (header->headerCRC != compressedHeaderCRC(header)) {
+        problem = "corrupt header";
+    } else if (header->elementSize != elementSize) {
+        problem = "element size doesn't match";
+    } else if (header->elementsPerBlock == 0 || (uint64_t)header->elementsPerBlock * elementSize > ES_FILE_ARRAY_MAX_BLOCK_SIZE
+               || (uint64_t)header->numBlocks * header->elementsPerBlock < header->numElements
+               || (header->numBlocks > 0 && (uint64_t)(header->numBlocks - 1) * header->elementsPerBlock >= header->numElements)
+               || header->numBlocks > (fileSize - sizeof(ESFileArrayCompressedHeader)) / sizeof(ESFileArrayBlockEntry)) {
+        problem = "sizes don't match file";
+    } else if (index) {
+        if (header->indexCRC != ESUtil::crc32c(index, header->numBlocks * sizeof(ESFileArrayBlockEntry))) {
+            problem = "corrupt block index";
+        } else {
+            for (uint32_t i = 0; i < header->numBlocks; i++) {
+                if (index[i].compressedSize > blockDataSize(header, i)
+                    || index[i].offset > fileSize || index[i].compressedSize > fileSize - index[i].offset) {
+                    problem = "block outside file";
+                    break;
+                }
+            }
+        }
+    }
+    if (problem) {
+        ESErrorReporter::logError("ESFileArray", "Invalid compressed header in %s: %s", path, problem);
+        return false;
+    }
+    return true;
+}
+
+/*static*/ bool
+ESFileArrayContainer::decompressBlock(const ESFileArrayCompressedHeader *header,
+                                      uint32_t                          blockNumber,
+                                      const ESFileArrayBlockEntry       *entry,
+                                      const void                        *compressed,
+                                      void                              *dest,
+                                      bool                              checkCRC,
+                                      const char                        *path) {
+    size_t dataSize = blockDataSize(header, blockNumber);
+    if (entry->compressedSize == dataSize) {
+        memcpy(dest, compressed, dataSize);
+    } else if (ESLZ4::decompress(compressed, entry->compressedSize, dest, dataSize) != (ssize_t)dataSize) {
+        ESErrorReporter::logError("ESFileArray", "Corrupt block %u in %s", blockNumber, path);
+        return false;
+    }
+    if (checkCRC && ESUtil::crc32c(dest, dataSize) != entry->dataCRC) {
+        ESErrorReporter::logError("ESFileArray", "Checksum mismatch in block %u of %s", blockNumber, path);
+        return false;
+    }
+    return true;
+}
+
+/*static*/ void *
+ESFileArrayContainer::loadCompressed(const char            *path,
+                                     ESFilePathType        pathType,
+                                     ESFileArrayValidation validation,
+                                     size_t                elementSize,
+                                     size_t                *dataSizeReturn) {
+    *dataSizeReturn = 0;
+    // Map rather than read, so the blocks are only ever copied by decompressing them
+    size_t fileSize;
+    void *mapBase;
+    size_t mapLength;
+    const char *contents = ESFile::mapFileContents(path, pathType, false/* !missingOK*/, ESFileAccessWillNeed, &fileSize, &mapBase, &mapLength);
+    if (!contents) {
+        return NULL;
+    }
+    const ESFileArrayCompressedHeader *header = (const ESFileArrayCompressedHeader *)contents;
+    const ESFileArrayBlockEntry *index = (const ESFileArrayBlockEntry *)(contents + sizeof(ESFileArrayCompressedHeader));
+    // The index has to be checked before we use it: O(numBlocks), but the blocks are 64KB
+    if (!validateCompressedIndex(header, index, fileSize, elementSize, path)) {
+        ESFile::unmapFileContents(mapBase, mapLength);
+        return NULL;
+    }
+    size_t dataSize = header->numElements * elementSize;
+    char *data = (char *)malloc(dataSize ? dataSize : 1);
+    bool checkCRC = (validation == ESFileArrayValidateChecksum);
+    std::atomic<bool> success(true);
+    ESParallel::forRange(0, header->numBlocks, 1, [&](long chunkBegin, long chunkEnd) {
+        for (long i = chunkBegin; i < chunkEnd && success.load(std::memory_order_relaxed); i++) {
+            char *dest = data + (size_t)i * header->elementsPerBlock * elementSize;
+            if (!decompressBlock(header, (uint32_t)i, &index[i], contents + index[i].offset, dest, checkCRC, path)) {
+                success = false;
+            }
+        }
+    });
+    ESFile::unmapFileContents(mapBase, mapLength);
+    if (!success) {
+        free(data);
+        return NULL;
+    }
+    *dataSizeReturn = dataSize;
+    return data;
+}
+
+/*static*/ bool
+ESFileArrayContainer::readCompressedIndex(int                                fd,
+                                          off_t                              baseOffset,
+                                          size_t                             fileSize,
+                                          size_t                             elementSize,
+                                          const char                         *path,
+                                          ESFileArrayCompressedHeader        *headerReturn,
+                                          std::vector<ESFileArrayBlockEntry> *indexReturn) {
+    ESFileArrayCompressedHeader header;
+    if (fileSize >= sizeof(header) && !preadAll(fd, &header, sizeof(header), baseOffset)) {
+        ESErrorReporter::checkAndLogSystemError("ESFileArray", errno, ESUtil::stringWithFormat("Trouble reading header of %s\n", path).c_str());
+        return false;
+    }
+    if (!validateCompressedIndex(&header, NULL, fileSize, elementSize, path)) {
+        return false;
+    }
+    indexReturn->resize(header.numBlocks);
+    if (header.numBlocks == 0) {
+        *headerReturn = header;
+        return true;
+    }
+    if (!preadAll(fd, &(*indexReturn)[0], header.numBlocks * sizeof(ESFileArrayBlockEntry), baseOffset + sizeof(header))) {
+        ESErrorReporter::checkAndLogSystemError("ESFileArray", errno, ESUtil::stringWithFormat("Trouble reading block index of %s\n", path).c_str());
+        indexReturn->clear();
+        return false;
+    }
+    if (!validateCompressedIndex(&header, &(*indexReturn)[0], fileSize, elementSize, path)) {
+        indexReturn->clear();
+        return false;
+    }
+    *headerReturn = header;
+    return true;
+}
+
+ESFileArrayReaderBase::ESFileArrayReaderBase(const char        *path,
+                                             ESFilePathType    pathType,
+                                             size_t            elementSize,
+                                             ESFileArrayFormat format)
+:   _path(path),
+    _fileCloser(NULL),
+    _baseOffset(0),
+    _fileSize(0),
+    _elementSize(elementSize),
+    _asyncReadsOutstanding(0)
+{
+    memset(&_compressedHeader, 0, sizeof(_compressedHeader));
+    _fd = ESFile::getFDPointingAtFile(path, pathType, false/* !missingOK*/, &_fileSize, &_fileCloser);
+    if (_fd < 0) {
+        _fileSize = 0;
+        return;
+    }
+    // Resources may be embedded in a larger file, in which case the fd is left pointing at the start of ours
+    _baseOffset = lseek(_fd, 0, SEEK_CUR);
+    if (_baseOffset < 0) {
+        ESErrorReporter::checkAndLogSystemError("ESFileArray", errno, ESUtil::stringWithFormat("Trouble finding position of %s file %s\n",
+                                                                                               ESFile::pathTypeString(pathType), path).c_str());
+        if (_fileCloser) {
+            _fileCloser->closeAndDie();
+            _fileCloser = NULL;
+        }
+        _fd = -1;
+        _fileSize = 0;
+        return;
+    }
+    if (format == ESFileArrayFormatWithHeader) {
+        ESFileArrayHeader header;
+        ssize_t st;
+        do {
+            st = pread(_fd, &header, sizeof(header), _baseOffset);
+        } while (st < 0 && errno == EINTR);
+        if ((st != sizeof(header) && _fileSize >= sizeof(header))
+            || !ESFileArrayContainer::validateHeader(&header, _fileSize, elementSize, path)) {
+            if (_fileCloser) {
+                _fileCloser->closeAndDie();
+                _fileCloser = NULL;
+            }
+            _fd = -1;
+            _fileSize = 0;
+            return;
+        }
+        // From here on, the data is the file as far as the reads are concerned
+        _baseOffset += header.dataOffset;
+        _fileSize = header.numElements * elementSize;
+    } else if (format == ESFileArrayFormatCompressed) {
+        if (!ESFileArrayContainer::readCompressedIndex(_fd, _baseOffset, _fileSize, elementSize, path, &_compressedHeader, &_blockIndex)) {
+            if (_fileCloser) {
+                _fileCloser->closeAndDie();
+                _fileCloser = NULL;
+            }
+            _fd = -1;
+            _fileSize = 0;
+            return;
+        }
+        // The block offsets are from the start of the file, so _baseOffset stays there; _fileSize is now the uncompressed size
+        _fileSize = _compressedHeader.numElements * elementSize;
+    }
+}
+
+ESFileArrayReaderBase::~ESFileArrayReaderBase() {
+    ESAssert(_asyncReadsOutstanding.load() == 0);
+    if (_fileCloser) {
+        _fileCloser->closeAndDie();
+    }
+}
+
+bool
+ESFileArrayReaderBase::readSpan(off_t  firstIndex,
+                                size_t numBytes,
+                                void   *dest) {
+    off_t off = firstIndex * (off_t)_elementSize;
+    if (firstIndex < 0 || off + numBytes > _fileSize) {
+        ESErrorReporter::logError("ESFileArray", "Read of %zu bytes at position %lld is outside file %s of size %zu\n",
+                                  numBytes, (long long)off, _path.c_str(), _fileSize);
+        return false;
+    }
+    char *ptr = (char *)dest;
+    while (numBytes > 0) {
+        ssize_t st = pread(_fd, ptr, numBytes, _baseOffset + off);
+        if (st < 0 && errno == EINTR) {
+            continue;
+        }
+        if (st <= 0) {
+            ESErrorReporter::checkAndLogSystemError("ESFileArray", errno, ESUtil::stringWithFormat("Trouble reading position %lld of file %s\n",
+                                                                                                   (long long)off, _path.c_str()).c_str());
+            return false;
+        }
+        ptr += st;
+        off += st;
+        numBytes -= st;
+    }
+    return true;
+}
+
+// Sorts the indices, then walks them in file order, reading each cluster of nearby elements with one pread.
+bool
+ESFileArrayReaderBase::readRecords(const int *indices,
+                                   int       numIndices,
+                                   void      *records) {
+    char *recordBytes = (char *)records;
+    if (_fd < 0) {
+        bzero(records, numIndices * _elementSize);
+        return false;
+    }
+    if (_compressedHeader.elementsPerBlock) {
+        return readCompressedRecords(indices, numIndices, records);
+    }
+    if (numIndices == 1) {
+        if (!readSpan(indices[0], _elementSize, records)) {
+            bzero(records, _elementSize);
+            return false;
+        }
+        return true;
+    }
+    std::vector<int> order(numIndices);
+    for (int i = 0; i < numIndices; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [indices](int a, int b) { return indices[a] < indices[b]; });
+    std::vector<char> spanBuffer;
+    int i = 0;
+    while (i < numIndices) {
+        off_t first = indices[order[i]];
+        off_t last = first;
+        int j = i + 1;
+        while (j < numIndices) {
+            off_t next = indices[order[j]];
+            if ((next - last - 1) * (off_t)_elementSize > ES_FILE_ARRAY_READER_MAX_GAP ||
+                (next - first + 1) * (off_t)_elementSize > ES_FILE_ARRAY_READER_MAX_SPAN) {
+                break;
+            }
+            last = next;
+            j++;
+        }
+        if (last == first) {  // A single element, perhaps requested more than once
+            char *dest = recordBytes + order[i] * _elementSize;
+            if (!readSpan(first, _elementSize, dest)) {
+                bzero(records, numIndices * _elementSize);
+                return false;
+            }
+            for (int k = i + 1; k < j; k++) {
+                memcpy(recordBytes + order[k] * _elementSize, dest, _elementSize);
+            }
+        } else {
+            size_t spanBytes = (last - first + 1) * _elementSize;
+            spanBuffer.resize(spanBytes);
+            if (!readSpan(first, spanBytes, &spanBuffer[0])) {
+                bzero(records, numIndices * _elementSize);
+                return false;
+            }
+            for (int k = i; k < j; k++) {
+                memcpy(recordBytes + order[k] * _elementSize, &spanBuffer[(indices[order[k]] - first) * _elementSize], _elementSize);
+            }
+        }
+        i = j;
+    }
+    return true;
+}
+
+// As readRecords, but each block holding any of the elements is read and decompressed just once
+bool
+ESFileArrayReaderBase::readCompressedRecords(const int *indices,
+                                             int       numIndices,
+                                             void      *records) {
+    char *recordBytes = (char *)records;
+    std::vector<int> order(numIndices);
+    for (int i = 0; i < numIndices; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [indices](int a, int b) { return indices[a] < indices[b]; });
+    if (numIndices > 0 &&
+        (indices[order[0]] < 0 || (uint64_t)indices[order[numIndices - 1]] >= _compressedHeader.numElements)) {
+        ESErrorReporter::logError("ESFileArray", "Read of index %d is outside file %s of %lld elements\n",
+                                  indices[order[0]] < 0 ? indices[order[0]] : indices[order[numIndices - 1]],
+                                  _path.c_str(), (long long)_compressedHeader.numElements);
+        bzero(records, numIndices * _elementSize);
+        return false;
+    }
+    size_t elementsPerBlock = _compressedHeader.elementsPerBlock;
+    std::vector<char> compressed(elementsPerBlock * _elementSize);  // Blocks never compress to more than they hold
+    std::vector<char> block(elementsPerBlock * _elementSize);
+    int i = 0;
+    while (i < numIndices) {
+        uint32_t blockNumber = (uint32_t)(indices[order[i]] / elementsPerBlock);
+        const ESFileArrayBlockEntry *entry = &_blockIndex[blockNumber];
+        if (!preadAll(_fd, &compressed[0], entry->compressedSize, _baseOffset + entry->offset)) {
+            ESErrorReporter::checkAndLogSystemError("ESFileArray", errno, ESUtil::stringWithFormat("Trouble reading block %u of file %s\n",
+                                                                                                   blockNumber, _path.c_str()).c_str());
+            bzero(records, numIndices * _elementSize);
+            return false;
+        }
+        if (!ESFileArrayContainer::decompressBlock(&_compressedHeader, blockNumber, entry, &compressed[0], &block[0], false/* !checkCRC*/, _path.c_str())) {
+            bzero(records, numIndices * _elementSize);
+            return false;
+        }
+        size_t firstInBlock = blockNumber * elementsPerBlock;
+        for (; i < numIndices && indices[order[i]] / elementsPerBlock == blockNumber; i++) {
+            memcpy(recordBytes + order[i] * _elementSize, &block[(indices[order[i]] - firstInBlock) * _elementSize], _elementSize);
+        }
+    }
+    return true;
+}
+
+void
+ESFileArrayReaderBase::readRecordsAsync(const int                   *indices,
+                                        int                         numIndices,
+                                        void                        *records,
+                                        ESFileArrayReadCompletionFn completionFn,
+                                        void                        *completionObject) {
+    AsyncRead *request = new AsyncRead;
+    request->indices = indices;
+    request->numIndices = numIndices;
+    request->records = records;
+    request->completionFn = completionFn;
+    request->completionObject = completionObject;
+    request->success = false;
+    _asyncReadsOutstanding++;
+    // On the I/O pool, since the preads block; ESParallel's pool is sized for computation
+    ESFileIO::threadPool()->submit(asyncReadGlue, this, request, asyncCompletionGlue, this);
+}
+
+/*static*/ void
+ESFileArrayReaderBase::asyncReadGlue(void *obj,
+                                     void *param) {
+    ESFileArrayReaderBase *reader = static_cast<ESFileArrayReaderBase *>(obj);
+    AsyncRead *request = static_cast<AsyncRead *>(param);
+    request->success = reader->readRecords(request->indices, request->numIndices, request->records);
+}
+
+/*static*/ void
+ESFileArrayReaderBase::asyncCompletionGlue(void *obj,
+                                           void *param) {
+    ESFileArrayReaderBase *reader = static_cast<ESFileArrayReaderBase *>(obj);
+    AsyncRead *request = static_cast<AsyncRead *>(param);
+    reader->_asyncReadsOutstanding--;
+    (*request->completionFn)(request->completionObject, request->success);
+    delete request;
+}
@@ -9,11 +9,165 @@
 #define _ESUTILFILES_HPP_
 
 #include "ESFile.hpp"  // For path type enum
+#include "ESErrorReporter.hpp"
 
-/** A file array is a simple C array which is backed by an external file.   There are three use models:
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>  // For off_t
+
+/** How a file array gets its contents from the external file at construction */
+enum ESFileArrayLoadMode {
+    ESFileArrayLoadByReading,  // malloc the whole file and read it in with a single kernel call
+    ESFileArrayLoadByMapping   // mmap the file read-only; pages are read in lazily on first access
+};
+
+/** Whether a file array's external file is a bare dump of the elements, has an ESFileArrayHeader,
+ *  or is split into separately compressed blocks (ESFileArrayCompressedHeader) */
+enum ESFileArrayFormat {
+    ESFileArrayFormatRaw,
+    ESFileArrayFormatWithHeader,
+    ESFileArrayFormatCompressed
+};
+
+/** How much of a file with a header to check when loading it */
+enum ESFileArrayValidation {
+    ESFileArrayValidateHeader,    // The header and its checksum, and that the sizes agree with the file: O(1)
+    ESFileArrayValidateChecksum   // Also the checksum of the data, which reads every page
+};
+
+#define ES_FILE_ARRAY_MAGIC          0x41465345  // "ESFA"
+#define ES_FILE_ARRAY_VERSION        1
+#define ES_FILE_ARRAY_DATA_ALIGNMENT 16384       // The largest page size we run on (see below)
+
+/** The header at the start of a file written with ESFileArrayFormatWithHeader.  The elements
+ *  start at dataOffset, a multiple of alignment, and the space in between is zero, so in a file
+ *  mapped directly the elements start on a page boundary.  A resource inside a package (e.g.,
+ *  an APK) can start anywhere in it, though, so when it's mapped the elements are only as aligned
+ *  as the resource is; if that isn't enough for ElementType, the file is read instead.  Fields are
+ *  in native byte order, which is little-endian on every platform we run on; a file from a
+ *  big-endian machine would fail the magic number check. */
+struct ESFileArrayHeader {
+    uint32_t                magic;         // ES_FILE_ARRAY_MAGIC
+    uint16_t                version;       // ES_FILE_ARRAY_VERSION
+    uint16_t                headerSize;    // sizeof(ESFileArrayHeader) when written
+    uint32_t                elementSize;   // sizeof(ElementType) when written
+    uint32_t                alignment;
+    uint64_t                numElements;
+    uint64_t                dataOffset;
+    uint32_t                dataCRC;       // CRC-32C of the numElements * elementSize bytes of data
+    uint32_t                headerCRC;     // CRC-32C of the header up to this field
+};
+
+#define ES_FILE_ARRAY_COMPRESSED_MAGIC   0x5A465345  // "ESFZ"
+#define ES_FILE_ARRAY_COMPRESSED_VERSION 1
+#define ES_FILE_ARRAY_BLOCK_SIZE         (64 * 1024)        // Uncompressed bytes per block, rounded down to whole elements
+#define ES_FILE_ARRAY_MAX_BLOCK_SIZE     (16 * 1024 * 1024)  // So a corrupt header can't make us allocate much
+
+/** The header at the start of a file written with ESFileArrayFormatCompressed.  The elements are
+ *  split into blocks of elementsPerBlock (the last may be shorter), each compressed on its own
+ *  with ESLZ4, so that one element can be found by decompressing only its block.  The header is
+ *  immediately followed by the block index, numBlocks ESFileArrayBlockEntry, and then the blocks. */
+struct ESFileArrayCompressedHeader {
+    uint32_t                magic;             // ES_FILE_ARRAY_COMPRESSED_MAGIC
+    uint16_t                version;           // ES_FILE_ARRAY_COMPRESSED_VERSION
+    uint16_t                headerSize;        // sizeof(ESFileArrayCompressedHeader) when written
+    uint32_t                elementSize;       // sizeof(ElementType) when written
+    uint32_t                elementsPerBlock;
+    uint64_t                numElements;
+    uint32_t                numBlocks;
+    uint32_t                indexCRC;          // CRC-32C of the block index
+    uint32_t                reserved;
+    uint32_t                headerCRC;         // CRC-32C of the header up to this field
+};
+
+struct ESFileArrayBlockEntry {
+    uint64_t                offset;            // From the start of the file
+    uint32_t                compressedSize;    // Equal to the uncompressed size iff the block is stored uncompressed
+    uint32_t                dataCRC;           // CRC-32C of the uncompressed block
+};
+
+/** The element-size-independent support for files with an ESFileArrayHeader or an
+ *  ESFileArrayCompressedHeader; use ESFileArray instead. */
+class ESFileArrayContainer {
+  public:
+    static bool             write(const void      *data,
+                                  size_t          elementSize,
+                                  size_t          numElements,
+                                  const char      *path,
+                                  ESFilePathType  pathType,
+                                  ESFileWriteMode mode);
+    // Returns the elements, which are malloc'd if *mapBaseReturn comes back NULL and otherwise mapped
+    // (which happens only if the mapped elements are aligned to elementAlignment)
+    static void             *load(const char            *path,
+                                  ESFilePathType        pathType,
+                                  ESFileArrayLoadMode   loadMode,
+                                  ESFileAccessAdvice    advice,
+                                  ESFileArrayValidation validation,
+                                  size_t                elementSize,
+                                  size_t                elementAlignment,
+                                  size_t                *dataSizeReturn,
+                                  void                  **mapBaseReturn,
+                                  size_t                *mapLengthReturn);
+    // Check the header of a file of the given size
+    static bool             validateHeader(const ESFileArrayHeader *header,
+                                           size_t                  fileSize,
+                                           size_t                  elementSize,
+                                           const char              *path);
+
+    // Compress the blocks in parallel, and write the header, index and blocks
+    static bool             writeCompressed(const void      *data,
+                                            size_t          elementSize,
+                                            size_t          numElements,
+                                            const char      *path,
+                                            ESFilePathType  pathType,
+                                            ESFileWriteMode mode);
+    // Returns the malloc'd elements, decompressed in parallel
+    static void             *loadCompressed(const char            *path,
+                                            ESFilePathType        pathType,
+                                            ESFileArrayValidation validation,
+                                            size_t                elementSize,
+                                            size_t                *dataSizeReturn);
+    // Read and check the header and index of a compressed file open at baseOffset in fd
+    static bool             readCompressedIndex(int                                fd,
+                                                off_t                              baseOffset,
+                                                size_t                             fileSize,
+                                                size_t                             elementSize,
+                                                const char                         *path,
+                                                ESFileArrayCompressedHeader        *headerReturn,
+                                                std::vector<ESFileArrayBlockEntry> *indexReturn);
+    // Check the header of a compressed file of the given size, and the index too unless it's NULL
+    static bool             validateCompressedIndex(const ESFileArrayCompressedHeader *header,
+                                                    const ESFileArrayBlockEntry       *index,
+                                                    size_t                            fileSize,
+                                                    size_t                            elementSize,
+                                                    const char                        *path);
+    // The number of bytes block blockNumber holds when uncompressed
+    static size_t           blockDataSize(const ESFileArrayCompressedHeader *header,
+                                          uint32_t                          blockNumber);
+    // Decompress one block (of compressedSize bytes at 'compressed') into dest, which has room for blockDataSize()
+    static bool             decompressBlock(const ESFileArrayCompressedHeader *header,
+                                            uint32_t                          blockNumber,
+                                            const ESFileArrayBlockEntry       *entry,
+                                            const void                        *compressed,
+                                            void                              *dest,
+                                            bool                              checkCRC,
+                                            const char                        *path);
+};
+
+/** A file array is a simple C array which is backed by an external file.   There are four use models:
  *  * Read the entire array in at once with a single kernel call
- *  * Read in a single element with lseek and read
+ *  * Map the entire array into memory, so that startup time and resident memory don't grow with the file size
+ *  * Read in a single element with lseek and read (or many, keeping the file open, with ESFileArrayReader)
  *  * Write an entire array to disk with a single kernel call
+ *  The external file is either a bare dump of the elements, or (ESFileArrayFormatWithHeader) has
+ *  a header identifying its layout and checksumming its contents, which is validated on load.
+ *  With ESFileArrayFormatCompressed the file is also compressed, in blocks: a load maps the file
+ *  only while it decompresses the blocks in parallel into a malloc'd array (so the load mode
+ *  doesn't matter, and the elements can't stay mapped), and single elements are read (with
+ *  readElementFromFileAtIndex or ESFileArrayReader) by decompressing just their block.
  */
 template <class ElementType>
 class ESFileArray {
@@ -22,6 +176,21 @@ class ESFileArray {
                             ESFileArray(const char     *path,
                                         ESFilePathType pathType,
                                         bool           readInAtStartup = true);
+    /** Construct the object, reading or mapping the external file's contents if the external file exists.
+     *  The advice is only used when mapping. */
+                            ESFileArray(const char          *path,
+                                        ESFilePathType      pathType,
+                                        ESFileArrayLoadMode loadMode,
+                                        ESFileAccessAdvice  advice = ESFileAccessNormal);
+    /** As above, for a file in the given format.  If a header is expected but is missing or doesn't
+     *  validate (e.g., because ElementType has changed size), the error is logged and the array is
+     *  empty, as if the file didn't exist. */
+                            ESFileArray(const char            *path,
+                                        ESFilePathType        pathType,
+                                        ESFileArrayLoadMode   loadMode,
+                                        ESFileArrayFormat     format,
+                                        ESFileArrayValidation validation = ESFileArrayValidateHeader,
+                                        ESFileAccessAdvice    advice = ESFileAccessNormal);
                             ~ESFileArray();
     /** Return a readonly pointer to the internal array */
     operator                const ElementType *() const { return _array; }
@@ -35,43 +204,206 @@ class ESFileArray {
     /** The number of elements read at construction (will be 0 if file didn't exist) */
     int                     numElements() const { return (long)(_bytesRead / sizeof(ElementType)); }
 
+    /** True if the array is mapped from the external file rather than read into memory */
+    bool                    isMapped() const { return _mapBase != NULL; }
+
+    /** Tell the kernel how a mapped array is going to be accessed from here on (no-op if not mapped) */
+    void                    adviseAccess(ESFileAccessAdvice advice);
+
     /** Allocate an array of the given element size which can then be obtained by calling writableArray() */
     void                    setupForWriteWithNumElements(int numElements);
 
-    /** Return a writable array previously obtained from either setupForWriteWithNumElements or by reading the external file during construction. */
-    ElementType             *writableArray() { return _array; }
+    /** Return a writable array previously obtained from either setupForWriteWithNumElements or by reading the external file during construction.
+     *  Mapped arrays are read-only, so don't call this for them. */
+    ElementType             *writableArray() { ESAssert(!isMapped()); return _array; }
 
     /** Write the array previously filled in to the given external path.
      *  @return  true iff the write was successful. */
-    bool                    writeToPath(const char     *path,
-                                        ESFilePathType pathType);
+    bool                    writeToPath(const char        *path,
+                                        ESFilePathType    pathType,
+                                        ESFileWriteMode   mode = ESFileWriteInPlace,
+                                        ESFileArrayFormat format = ESFileArrayFormatRaw);
 
     /** Read a single element from a file which hasn't been opened yet, and then close the file */
-    static void             readElementFromFileAtIndex(const char     *path,
-                                                       ESFilePathType pathType,
-                                                       int            indx,
-                                                       ElementType    *element);
+    static void             readElementFromFileAtIndex(const char        *path,
+                                                       ESFilePathType    pathType,
+                                                       int               indx,
+                                                       ElementType       *element,
+                                                       ESFileArrayFormat format = ESFileArrayFormatRaw);
   protected:
+    void                    load(const char            *path,
+                                 ESFilePathType        pathType,
+                                 ESFileArrayLoadMode   loadMode,
+                                 ESFileArrayFormat     format,
+                                 ESFileArrayValidation validation,
+                                 ESFileAccessAdvice    advice);
+    void                    releaseStorage();
+
     ElementType             *_array;
     size_t                  _bytesRead;
+    void                    *_mapBase;    // NULL unless mapped
+    size_t                  _mapLength;
+};
+
+/** Called in the thread which started an asynchronous read, once the read has finished */
+typedef void (*ESFileArrayReadCompletionFn)(void *completionObject,
+                                            bool success);
+
+/** The element-size-independent part of ESFileArrayReader; use that template instead. */
+class ESFileArrayReaderBase {
+  protected:
+                            ESFileArrayReaderBase(const char        *path,
+                                                  ESFilePathType    pathType,
+                                                  size_t            elementSize,
+                                                  ESFileArrayFormat format);
+                            ~ESFileArrayReaderBase();
+
+    bool                    isOpen() const { return _fd >= 0; }
+    int                     numRecords() const { return (int)(_fileSize / _elementSize); }
+    bool                    readRecords(const int *indices,
+                                        int       numIndices,
+                                        void      *records);
+    void                    readRecordsAsync(const int                   *indices,
+                                             int                         numIndices,
+                                             void                        *records,
+                                             ESFileArrayReadCompletionFn completionFn,
+                                             void                        *completionObject);
+
+  private:
+    struct AsyncRead;
+
+    bool                    readSpan(off_t  firstIndex,
+                                     size_t numBytes,
+                                     void   *dest);
+    bool                    readCompressedRecords(const int *indices,
+                                                  int       numIndices,
+                                                  void      *records);
+    static void             asyncReadGlue(void *obj,
+                                          void *param);
+    static void             asyncCompletionGlue(void *obj,
+                                                void *param);
+
+    std::string             _path;         // For error messages
+    int                     _fd;
+    ESFileCloser            *_fileCloser;
+    off_t                   _baseOffset;   // Where the array starts in the fd (nonzero for some resources)
+    size_t                  _fileSize;
+    size_t                  _elementSize;
+    std::atomic<int>        _asyncReadsOutstanding;
+    ESFileArrayCompressedHeader _compressedHeader;  // For ESFileArrayFormatCompressed; elementsPerBlock is 0 otherwise
+    std::vector<ESFileArrayBlockEntry> _blockIndex;
+};
+
+/** Random access to the elements of an external file without reading in the whole thing, like
+ *  ESFileArray::readElementFromFileAtIndex, but keeping the file open between reads so that each
+ *  lookup costs a single pread rather than open/lseek/read/close.
+ *
+ *  A batch of indices is read by sorting them and coalescing nearby elements into a single
+ *  pread of the span between them, so the cost is one syscall per cluster rather than one
+ *  per element.  The indices can be in any order and may repeat; each element lands in the
+ *  slot corresponding to its index's position in the batch.  For a compressed file, each
+ *  block holding any of the elements is read and decompressed once per batch.
+ *
+ *  The asynchronous variant does the reads on ESFileIO's thread pool and then calls the
+ *  completion in the calling thread (which must therefore be running a message loop).  The
+ *  indices and elements arrays must stay valid until then, and the reader must not be deleted
+ *  while any asynchronous read is outstanding.  Reads never touch the file offset, so
+ *  synchronous and asynchronous reads can proceed concurrently on the same reader.
+ */
+template <class ElementType>
+class ESFileArrayReader : protected ESFileArrayReaderBase {
+  public:
+                            ESFileArrayReader(const char        *path,
+                                              ESFilePathType    pathType,
+                                              ESFileArrayFormat format = ESFileArrayFormatRaw)  // Only the header is validated
+    :   ESFileArrayReaderBase(path, pathType, sizeof(ElementType), format) {}
+
+    /** False if the file couldn't be opened; every read will then fail */
+    bool                    isOpen() const { return ESFileArrayReaderBase::isOpen(); }
+
+    /** The number of complete elements in the file */
+    int                     numElements() const { return numRecords(); }
+
+    /** Read one element.  On failure the element is zeroed and false is returned. */
+    bool                    readElementAtIndex(int         indx,
+                                               ElementType *element) {
+        return readRecords(&indx, 1, element);
+    }
+
+    /** Read elements[i] from indices[i] for each i.  On failure all of the elements are zeroed and false is returned. */
+    bool                    readElementsAtIndices(const int   *indices,
+                                                  int         numIndices,
+                                                  ElementType *elements) {
+        return readRecords(indices, numIndices, elements);
+    }
+
+    /** As readElementsAtIndices, but returns immediately and calls completionFn(completionObject, success) in this thread when done */
+    void                    readElementsAtIndicesAsync(const int                   *indices,
+                                                       int                         numIndices,
+                                                       ElementType                 *elements,
+                                                       ESFileArrayReadCompletionFn completionFn,
+                                                       void                        *completionObject) {
+        readRecordsAsync(indices, numIndices, elements, completionFn, completionObject);
+    }
 };
 
 /** This class is used to read in and store a large number of strings from a single file.
+ *
+ *  Without an index, the whole file is read in and scanned for the NUL terminators at startup
+ *  (with SIMD where available, counting them first so the pointer array is allocated just once;
+ *  arraySizeGuess is no longer needed for that, and is ignored).
+ *  With an index (a companion file of 32-bit string offsets, made by writeIndexFile() and
+ *  tagged with the size and modification time of the strings file it describes), the strings
+ *  file and the index are both just mapped, so construction is O(1) and stringAtIndex does
+ *  no scanning or allocation.  If the index is missing or stale, the strings are scanned as
+ *  usual, and the index is rewritten if it lives somewhere writable, so the next startup is fast.
+ *  Every string, including the last, must be NUL-terminated; a file which isn't is logged as
+ *  an error and treated as having no strings.
  */
 class ESFileStringArray : protected ESFileArray<char> {
   public:
                             ESFileStringArray(const char     *path,
                                               ESFilePathType pathType,
                                               int            arraySizeGuess);
+                            ESFileStringArray(const char     *path,
+                                              ESFilePathType pathType,
+                                              const char     *indexPath,
+                                              ESFilePathType indexPathType,
+                                              int            arraySizeGuess);
                             ~ESFileStringArray();
     const char              *stringAtIndex(int indx);
-    const char              **strings() const { return _strings; }
+    /** With an index, this allocates and fills in the pointer array on first call */
+    const char              **strings() const;
     int                     numStrings() const { return (int)_numStrings; }
 
+    /** True iff the strings are being found through a valid index */
+    bool                    usingIndex() const { return _offsets != NULL; }
+
+    /** Scan the given strings file and write an index for it to indexPath, which must be
+     *  ESFilePathTypeRelativeToDocumentDir or ESFilePathTypeRelativeToAppSupportDir.
+     *  @return true iff the index was written. */
+    static bool             writeIndexFile(const char     *path,
+                                           ESFilePathType pathType,
+                                           const char     *indexPath,
+                                           ESFilePathType indexPathType);
+
   private:
-    const char              **_strings;
+    bool                    scanForStrings();  // Returns false, with no strings, if the file isn't NUL-terminated
+    bool                    mapIndex(const char     *indexPath,
+                                     ESFilePathType indexPathType,
+                                     size_t         sourceSize,
+                                     int64_t        sourceModificationTimeNs);
+    bool                    writeIndex(const char     *indexPath,
+                                       ESFilePathType indexPathType,
+                                       size_t         sourceSize,
+                                       int64_t        sourceModificationTimeNs) const;
+
+    mutable const char      **_strings;     // With an index, NULL until strings() is called
     long                    _numStrings;
     long                    _stringsCapacity;
+    const uint32_t          *_offsets;      // Into the mapped index; NULL if not using one
+    void                    *_indexMapBase;
+    size_t                  _indexMapLength;
 };
 
 #include "ESFileArrayInl.hpp"
@@ -25,7 +25,9 @@ ESFileArray<ElementType>::ESFileArray(const char     *path,
                                       ESFilePathType pathType,
                                       bool           readInAtStartup)
 :   _array(NULL),
-    _bytesRead(0)
+    _bytesRead(0),
+    _mapBase(NULL),
+    _mapLength(0)
 {
     if (!readInAtStartup) {
         return;
@@ -40,18 +42,95 @@ ESFileArray<ElementType>::ESFileArray(const char     *path,
 
 template <class ElementType>
 inline
-ESFileArray<ElementType>::~ESFileArray() {
+ESFileArray<ElementType>::ESFileArray(const char          *path,
+                                      ESFilePathType      pathType,
+                                      ESFileArrayLoadMode loadMode,
+                                      ESFileAccessAdvice  advice)
+:   _array(NULL),
+    _bytesRead(0),
+    _mapBase(NULL),
+    _mapLength(0)
+{
+    load(path, pathType, loadMode, ESFileArrayFormatRaw, ESFileArrayValidateHeader, advice);
+}
+
+template <class ElementType>
+inline
+ESFileArray<ElementType>::ESFileArray(const char            *path,
+                                      ESFilePathType        pathType,
+                                      ESFileArrayLoadMode   loadMode,
+                                      ESFileArrayFormat     format,
+                                      ESFileArrayValidation validation,
+                                      ESFileAccessAdvice    advice)
+:   _array(NULL),
+    _bytesRead(0),
+    _mapBase(NULL),
+    _mapLength(0)
+{
+    load(path, pathType, loadMode, format, validation, advice);
+}
+
+template <class ElementType>
+inline void
+ESFileArray<ElementType>::load(const char            *path,
+                               ESFilePathType        pathType,
+                               ESFileArrayLoadMode   loadMode,
+                               ESFileArrayFormat     format,
+                               ESFileArrayValidation validation,
+                               ESFileAccessAdvice    advice) {
+    if (format == ESFileArrayFormatCompressed) {
+        loadMode = ESFileArrayLoadByReading;  // The decompressed elements have to go somewhere
+        _array = (ElementType *)ESFileArrayContainer::loadCompressed(path, pathType, validation, sizeof(ElementType), &_bytesRead);
+    } else if (format == ESFileArrayFormatWithHeader) {
+        _array = (ElementType *)ESFileArrayContainer::load(path, pathType, loadMode, advice, validation, sizeof(ElementType),
+                                                           alignof(ElementType), &_bytesRead, &_mapBase, &_mapLength);
+        if (_array && !_mapBase) {
+            loadMode = ESFileArrayLoadByReading;  // Perhaps because the mapping wasn't aligned
+        }
+    } else if (loadMode == ESFileArrayLoadByReading) {
+        _array = (ElementType *)ESFile::getFileContentsInMallocdArray(path, pathType, false/* !missingOK*/, &_bytesRead);
+    } else {
+        _array = (ElementType *)ESFile::mapFileContents(path, pathType, false/* !missingOK*/, advice, &_bytesRead, &_mapBase, &_mapLength);
+    }
     if (_array) {
-        free(_array);
+        ESErrorReporter::logInfo("ESFileArray", "Successful %s of %s\n", loadMode == ESFileArrayLoadByReading ? "read" : "map", path);
+    } else {
+        ESErrorReporter::logError("ESFileArray", "Unsuccessful %s of %s\n", loadMode == ESFileArrayLoadByReading ? "read" : "map", path);
     }
 }
 
+template <class ElementType>
+inline
+ESFileArray<ElementType>::~ESFileArray() {
+    releaseStorage();
+}
+
 template <class ElementType>
 inline void
-ESFileArray<ElementType>::setupForWriteWithNumElements(int numElements) {
-    if (_array) {
+ESFileArray<ElementType>::releaseStorage() {
+    if (_mapBase) {
+        ESFile::unmapFileContents(_mapBase, _mapLength);
+        _mapBase = NULL;
+        _mapLength = 0;
+    } else if (_array) {
         free(_array);
     }
+    _array = NULL;
+    _bytesRead = 0;
+}
+
+template <class ElementType>
+inline void
+ESFileArray<ElementType>::adviseAccess(ESFileAccessAdvice advice) {
+    if (_mapBase) {
+        ESFile::adviseMappedContents(_mapBase, _mapLength, advice);
+    }
+}
+
+template <class ElementType>
+inline void
+ESFileArray<ElementType>::setupForWriteWithNumElements(int numElements) {
+    releaseStorage();
     ESAssert(numElements > 0);
     _bytesRead = numElements * sizeof(ElementType);
     _array = (ElementType *)malloc(_bytesRead);
@@ -59,17 +138,33 @@ ESFileArray<ElementType>::setupForWriteWithNumElements(int numElements) {
 
 template <class ElementType>
 inline bool
-ESFileArray<ElementType>::writeToPath(const char     *path,
-                                      ESFilePathType pathType) {
-    return ESFile::writeArrayToFile(_array, _bytesRead, path, pathType);
+ESFileArray<ElementType>::writeToPath(const char        *path,
+                                      ESFilePathType    pathType,
+                                      ESFileWriteMode   mode,
+                                      ESFileArrayFormat format) {
+    if (format == ESFileArrayFormatCompressed) {
+        return ESFileArrayContainer::writeCompressed(_array, sizeof(ElementType), _bytesRead / sizeof(ElementType), path, pathType, mode);
+    }
+    if (format == ESFileArrayFormatWithHeader) {
+        return ESFileArrayContainer::write(_array, sizeof(ElementType), _bytesRead / sizeof(ElementType), path, pathType, mode);
+    }
+    return ESFile::writeArrayToFile(_array, _bytesRead, path, pathType, mode);
 }
 
 template <class ElementType>
 /*static*/ inline void 
-ESFileArray<ElementType>::readElementFromFileAtIndex(const char     *path,
-                                                     ESFilePathType pathType,
-                                                     int            indx,
-                                                     ElementType    *element) {
+ESFileArray<ElementType>::readElementFromFileAtIndex(const char        *path,
+                                                     ESFilePathType    pathType,
+                                                     int               indx,
+                                                     ElementType       *element,
+                                                     ESFileArrayFormat format) {
+    if (format != ESFileArrayFormatRaw) {
+        // The reader knows how to find the element past the header (and which block to decompress)
+        ESFileArrayReader<ElementType> reader(path, pathType, format);
+        ESAssert(!reader.isOpen() || (indx >= 0 && indx < reader.numElements()));
+        reader.readElementAtIndex(indx, element);
+        return;
+    }
     size_t elementSizeInBytes = sizeof(ElementType);
     size_t fileSize;
     ESFileCloser *fileCloser;
@@ -104,7 +199,7 @@ ESFileArray<ElementType>::readElementFromFileAtIndex(const char     *path,
         return;
     }
     if (fileCloser) {
-        ESErrorReporter::logInfo("ESFileArray::readElementFromFileAtIndex", "closing fd %d", fd);
+        ESLogDebug("ESFileArray::readElementFromFileAtIndex", "closing fd %d", fd);
         fileCloser->closeAndDie();
     }
 }
@@ -113,6 +208,9 @@ inline const char *
 ESFileStringArray::stringAtIndex(int indx) {
     ESAssert(indx >= 0);
     ESAssert(indx < _numStrings);
+    if (_offsets) {
+        return _array + _offsets[indx];
+    }
     return _strings[indx];
 }
 
@@ -0,0 +1,314 @@
+//
+//  ESFileColumnArray.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESFileColumnArray.hpp"
+#include "ESErrorReporter.hpp"
+#include "ESParallel.hpp"
+#include "ESUtil.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+
+// Rows per chunk when transposing records into columns in parallel
+#define ES_FILE_COLUMN_WRITE_GRAIN 16384
+
+static inline size_t
+roundUpToColumnAlignment(size_t n) {
+    return (n + ES_FILE_COLUMN_ALIGNMENT - 1) & ~(size_t)(ES_FILE_COLUMN_ALIGNMENT - 1);
+}
+
+static uint32_t headerCRC(const ESFileColumnArrayHeader *header) {
+    return ESUtil::crc32c(header, offsetof(ESFileColumnArrayHeader, headerCRC));
+}
+
+// Copy one field of records [begin, end) into its column.  A constant size lets the compiler
+// turn each copy into a single load and store.
+template <size_t FieldSize>
+static void
+gatherFixed(const char *src,
+            size_t     recordSize,
+            char       *dest,
+            size_t     numRows) {
+    for (size_t i = 0; i < numRows; i++) {
+        memcpy(dest, src, FieldSize);
+        src += recordSize;
+        dest += FieldSize;
+    }
+}
+
+static void
+gatherColumn(const char             *records,
+             size_t                 recordSize,
+             const ESFileColumnSpec &column,
+             size_t                 begin,
+             size_t                 end,
+             char                   *columnStart) {
+    const char *src = records + begin * recordSize + column.offsetInRecord;
+    char *dest = columnStart + begin * column.size;
+    size_t numRows = end - begin;
+    switch(column.size) {
+      case 1:
+        gatherFixed<1>(src, recordSize, dest, numRows);
+        break;
+      case 2:
+        gatherFixed<2>(src, recordSize, dest, numRows);
+        break;
+      case 4:
+        gatherFixed<4>(src, recordSize, dest, numRows);
+        break;
+      case 8:
+        gatherFixed<8>(src, recordSize, dest, numRows);
+        break;
+      case 16:
+        gatherFixed<16>(src, recordSize, dest, numRows);
+        break;
+      default:
+        for (size_t i = 0; i < numRows; i++) {
+            memcpy(dest, src, column.size);
+            src += recordSize;
+            dest += column.size;
+        }
+        break;
+    }
+}
+
+static bool
+columnsAreValid(size_t                 recordSize,
+                const ESFileColumnSpec *columns,
+                int                    numColumns) {
+    if (numColumns <= 0 || numColumns > ES_FILE_COLUMN_MAX_COLUMNS) {
+        return false;
+    }
+    for (int c = 0; c < numColumns; c++) {
+        if (columns[c].size == 0 || columns[c].offsetInRecord > recordSize || columns[c].size > recordSize - columns[c].offsetInRecord) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*static*/ bool
+ESFileColumnArrayBase::write(const void             *records,
+                             size_t                 recordSize,
+                             size_t                 numRecords,
+                             const ESFileColumnSpec *columns,
+                             int                    numColumns,
+                             const char             *path,
+                             ESFilePathType         pathType,
+                             ESFileWriteMode        mode) {
+    if (!columnsAreValid(recordSize, columns, numColumns)) {
+        ESErrorReporter::logError("ESFileColumnArray", "Invalid column description for %s", path);
+        return false;
+    }
+    // Lay out the columns: the header and descriptors, then each column on an aligned boundary
+    size_t prefixSize = roundUpToColumnAlignment(sizeof(ESFileColumnArrayHeader) + numColumns * sizeof(ESFileColumnDescriptor));
+    char *prefix = (char *)calloc(1, prefixSize);
+    ESFileColumnArrayHeader *header = (ESFileColumnArrayHeader *)prefix;
+    ESFileColumnDescriptor *descriptors = (ESFileColumnDescriptor *)(prefix + sizeof(ESFileColumnArrayHeader));
+    size_t offset = prefixSize;
+    for (int c = 0; c < numColumns; c++) {
+        descriptors[c].offsetInRecord = columns[c].offsetInRecord;
+        descriptors[c].size = columns[c].size;
+        descriptors[c].dataOffset = offset;
+        offset = roundUpToColumnAlignment(offset + numRecords * columns[c].size);
+    }
+    size_t bodySize = offset - prefixSize;
+    char *body = (char *)calloc(1, bodySize ? bodySize : 1);  // Zeroed, for the padding between columns
+
+    // Transpose in parallel, a band of rows at a time, so each chunk reads its records once
+    const char *recordBytes = (const char *)records;
+    ESParallel::forRange(0, (long)numRecords, ES_FILE_COLUMN_WRITE_GRAIN, [&](long chunkBegin, long chunkEnd) {
+        for (int c = 0; c < numColumns; c++) {
+            gatherColumn(recordBytes, recordSize, columns[c], chunkBegin, chunkEnd, body + descriptors[c].dataOffset - prefixSize);
+        }
+    });
+    ESParallel::forRange(0, numColumns, 1, [&](long chunkBegin, long chunkEnd) {
+        for (long c = chunkBegin; c < chunkEnd; c++) {
+            descriptors[c].dataCRC = ESUtil::crc32c(body + descriptors[c].dataOffset - prefixSize, numRecords * descriptors[c].size);
+        }
+    });
+
+    header->magic = ES_FILE_COLUMN_ARRAY_MAGIC;
+    header->version = ES_FILE_COLUMN_ARRAY_VERSION;
+    header->headerSize = sizeof(ESFileColumnArrayHeader);
+    header->recordSize = (uint32_t)recordSize;
+    header->numColumns = numColumns;
+    header->numRows = numRecords;
+    header->columnsCRC = ESUtil::crc32c(descriptors, numColumns * sizeof(ESFileColumnDescriptor));
+    header->headerCRC = headerCRC(header);
+    bool success = ESFile::writeArrayToFileWithHeader(prefix, prefixSize, body, bodySize, path, pathType, mode);
+    free(body);
+    free(prefix);
+    return success;
+}
+
+// Read the whole file into a buffer aligned like a mapping would be, so the columns are aligned either way
+static char *
+readAligned(const char     *path,
+            ESFilePathType pathType,
+            size_t         *fileSizeReturn) {
+    ESFileCloser *fileCloser;
+    int fd = ESFile::getFDPointingAtFile(path, pathType, false/* !missingOK*/, fileSizeReturn, &fileCloser);
+    if (fd < 0) {
+        return NULL;
+    }
+    void *buffer = NULL;
+    if (posix_memalign(&buffer, ES_FILE_COLUMN_ALIGNMENT, *fileSizeReturn ? *fileSizeReturn : 1) != 0) {
+        buffer = NULL;
+    } else if (ESFile::readFully(fd, buffer, *fileSizeReturn) != (ssize_t)*fileSizeReturn) {
+        ESErrorReporter::checkAndLogSystemError("ESFileColumnArray", errno, ESUtil::stringWithFormat("Trouble reading %s\n", path).c_str());
+        free(buffer);
+        buffer = NULL;
+    }
+    if (fileCloser) {
+        fileCloser->closeAndDie();
+    }
+    return (char *)buffer;
+}
+
+ESFileColumnArrayBase::ESFileColumnArrayBase(const char             *path,
+                                             ESFilePathType         pathType,
+                                             ESFileArrayLoadMode    loadMode,
+                                             ESFileArrayValidation  validation,
+                                             ESFileAccessAdvice     advice,
+                                             size_t                 recordSize,
+                                             const ESFileColumnSpec *columns,
+                                             int                    numColumns)
+:   _numRows(0),
+    _mapBase(NULL),
+    _contents(NULL),
+    _mapLength(0)
+{
+    ESAssert(columnsAreValid(recordSize, columns, numColumns));
+    size_t fileSize = 0;
+    if (loadMode == ESFileArrayLoadByMapping) {
+        _contents = ESFile::mapFileContents(path, pathType, false/* !missingOK*/, advice, &fileSize, &_mapBase, &_mapLength);
+        if (_contents && (uintptr_t)_contents % ES_FILE_COLUMN_ALIGNMENT != 0) {
+            // The file doesn't start on a page, as with a resource inside an APK
+            ESErrorReporter::logInfo("ESFileColumnArray", "Mapping of %s is misaligned; reading it instead", path);
+            releaseStorage();
+            loadMode = ESFileArrayLoadByReading;
+        }
+    }
+    if (loadMode == ESFileArrayLoadByReading) {
+        _contents = readAligned(path, pathType, &fileSize);
+    }
+    if (!_contents) {
+        ESErrorReporter::logError("ESFileColumnArray", "Unsuccessful %s of %s\n", loadMode == ESFileArrayLoadByReading ? "read" : "map", path);
+        return;
+    }
+    if (!validate(fileSize, validation, recordSize, columns, numColumns, path)) {
+        releaseStorage();
+        return;
+    }
+    ESLogDebug("ESFileColumnArray", "Successful %s of %s\n", loadMode == ESFileArrayLoadByReading ? "read" : "map", path);
+}
+
+ESFileColumnArrayBase::~ESFileColumnArrayBase() {
+    releaseStorage();
+}
+
+void
+ESFileColumnArrayBase::releaseStorage() {
+    if (_mapBase) {
+        ESFile::unmapFileContents(_mapBase, _mapLength);
+        _mapBase = NULL;
+        _mapLength = 0;
+    } else if (_contents) {
+        free((char *)_contents);
+    }
+    _contents = NULL;
+    _numRows = 0;
+    _columns.clear();
+    _columnData.clear();
+}
+
+bool
+ESFileColumnArrayBase::validate(size_t                 fileSize,
+                                ESFileArrayValidation  validation,
+                                size_t                 recordSize,
+                                const ESFileColumnSpec *columns,
+                                int                    numColumns,
+                                const char             *path) {
+    const ESFileColumnArrayHeader *header = (const ESFileColumnArrayHeader *)_contents;
+    const ESFileColumnDescriptor *descriptors = (const ESFileColumnDescriptor *)(_contents + sizeof(ESFileColumnArrayHeader));
+    const char *problem = NULL;
+    if (fileSize < sizeof(ESFileColumnArrayHeader) || header->magic != ES_FILE_COLUMN_ARRAY_MAGIC) {
+        problem = "no header";
+    } else if (header->version != ES_FILE_COLUMN_ARRAY_VERSION || header->headerSize != sizeof(ESFileColumnArrayHeader)) {
+        problem = "unsupported version";
+    } else if (header->headerCRC != headerCRC(header)) {
+        problem = "corrupt header";
+    } else if (header->recordSize != recordSize || header->numColumns != (uint32_t)numColumns) {
+        problem = "record layout doesn't match";
+    } else if ((fileSize - sizeof(ESFileColumnArrayHeader)) / sizeof(ESFileColumnDescriptor) < (size_t)numColumns
+               || header->columnsCRC != ESUtil::crc32c(descriptors, numColumns * sizeof(ESFileColumnDescriptor))) {
+        problem = "corrupt column descriptors";
+    } else {
+        for (int c = 0; c < numColumns; c++) {
+            const ESFileColumnDescriptor *descriptor = &descriptors[c];
+            if (descriptor->offsetInRecord != columns[c].offsetInRecord || descriptor->size != columns[c].size) {
+                problem = "record layout doesn't match";
+                break;
+            }
+            if (descriptor->dataOffset % ES_FILE_COLUMN_ALIGNMENT != 0 || descriptor->dataOffset > fileSize
+                || header->numRows > (fileSize - descriptor->dataOffset) / descriptor->size) {
+                problem = "sizes don't match file";
+                break;
+            }
+        }
+    }
+    if (!problem && validation == ESFileArrayValidateChecksum) {
+        std::atomic<bool> checksumsMatch(true);
+        ESParallel::forRange(0, numColumns, 1, [&](long chunkBegin, long chunkEnd) {
+            for (long c = chunkBegin; c < chunkEnd; c++) {
+                if (ESUtil::crc32c(_contents + descriptors[c].dataOffset, header->numRows * descriptors[c].size) != descriptors[c].dataCRC) {
+                    checksumsMatch = false;
+                }
+            }
+        });
+        if (!checksumsMatch) {
+            problem = "checksum mismatch";
+        }
+    }
+    if (problem) {
+        ESErrorReporter::logError("ESFileColumnArray", "Invalid column file %s: %s", path, problem);
+        return false;
+    }
+    _numRows = header->numRows;
+    _columns.assign(columns, columns + numColumns);
+    _columnData.resize(numColumns);
+    for (int c = 0; c < numColumns; c++) {
+        _columnData[c] = _contents + descriptors[c].dataOffset;
+    }
+    return true;
+}
+
+const void *
+ESFileColumnArrayBase::columnData(int    columnIndex,
+                                  size_t fieldSize) const {
+    if (_columnData.empty()) {
+        return NULL;  // Missing or invalid file
+    }
+    ESAssert(columnIndex >= 0 && columnIndex < (int)_columnData.size());
+    ESAssert(fieldSize == _columns[columnIndex].size);
+    return _columnData[columnIndex];
+}
+
+void
+ESFileColumnArrayBase::readRecord(size_t indx,
+                                  void   *record,
+                                  size_t recordSize) const {
+    char *recordBytes = (char *)record;
+    bzero(record, recordSize);
+    for (size_t c = 0; c < _columns.size(); c++) {
+        size_t size = _columns[c].size;
+        memcpy(recordBytes + _columns[c].offsetInRecord, _columnData[c] + indx * size, size);
+    }
+}
@@ -0,0 +1,171 @@
+//
+//  ESFileColumnArray.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESFILECOLUMNARRAY_HPP_
+#define _ESFILECOLUMNARRAY_HPP_
+
+#include "ESFileArray.hpp"  // For the load mode, validation and format enums
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/** One field of a record which is stored as a column; make these with ES_FILE_COLUMN */
+struct ESFileColumnSpec {
+    uint32_t                offsetInRecord;
+    uint32_t                size;
+};
+
+#define ES_FILE_COLUMN(RecordType, field) { (uint32_t)offsetof(RecordType, field), (uint32_t)sizeof(((RecordType *)0)->field) }
+
+#define ES_FILE_COLUMN_ARRAY_MAGIC   0x43465345  // "ESFC"
+#define ES_FILE_COLUMN_ARRAY_VERSION 1
+#define ES_FILE_COLUMN_ALIGNMENT     64          // A cache line, and the widest vector register we use
+#define ES_FILE_COLUMN_MAX_COLUMNS   1024        // So a corrupt header can't make us allocate much
+
+/** The header at the start of a column file.  It's followed by numColumns ESFileColumnDescriptor,
+ *  and then the columns, each starting at a multiple of ES_FILE_COLUMN_ALIGNMENT from the start
+ *  of the file, with zeroes in between.  Fields are in native byte order, as for ESFileArrayHeader. */
+struct ESFileColumnArrayHeader {
+    uint32_t                magic;           // ES_FILE_COLUMN_ARRAY_MAGIC
+    uint16_t                version;         // ES_FILE_COLUMN_ARRAY_VERSION
+    uint16_t                headerSize;      // sizeof(ESFileColumnArrayHeader) when written
+    uint32_t                recordSize;      // sizeof(RecordType) when written
+    uint32_t                numColumns;
+    uint64_t                numRows;
+    uint32_t                columnsCRC;      // CRC-32C of the column descriptors
+    uint32_t                headerCRC;       // CRC-32C of the header up to this field
+};
+
+struct ESFileColumnDescriptor {
+    uint32_t                offsetInRecord;  // Where the field was in RecordType when written
+    uint32_t                size;
+    uint64_t                dataOffset;      // From the start of the file
+    uint32_t                dataCRC;         // CRC-32C of the numRows * size bytes of the column
+    uint32_t                reserved;
+};
+
+/** The record-type-independent part of ESFileColumnArray; use that template instead. */
+class ESFileColumnArrayBase {
+  protected:
+                            ESFileColumnArrayBase(const char             *path,
+                                                  ESFilePathType         pathType,
+                                                  ESFileArrayLoadMode    loadMode,
+                                                  ESFileArrayValidation  validation,
+                                                  ESFileAccessAdvice     advice,
+                                                  size_t                 recordSize,
+                                                  const ESFileColumnSpec *columns,
+                                                  int                    numColumns);
+                            ~ESFileColumnArrayBase();
+
+    const void              *columnData(int    columnIndex,
+                                        size_t fieldSize) const;
+    void                    readRecord(size_t indx,
+                                       void   *record,
+                                       size_t recordSize) const;
+    static bool             write(const void             *records,
+                                  size_t                 recordSize,
+                                  size_t                 numRecords,
+                                  const ESFileColumnSpec *columns,
+                                  int                    numColumns,
+                                  const char             *path,
+                                  ESFilePathType         pathType,
+                                  ESFileWriteMode        mode);
+
+    size_t                  _numRows;
+    void                    *_mapBase;     // NULL unless mapped
+
+  private:
+    bool                    validate(size_t                 fileSize,
+                                     ESFileArrayValidation  validation,
+                                     size_t                 recordSize,
+                                     const ESFileColumnSpec *columns,
+                                     int                    numColumns,
+                                     const char             *path);
+    void                    releaseStorage();
+
+    const char              *_contents;    // The whole file, mapped or read into an aligned buffer; aligned either way
+    size_t                  _mapLength;
+    std::vector<ESFileColumnSpec> _columns;
+    std::vector<const char *> _columnData;
+};
+
+/** A columnar ("structure of arrays") companion to ESFileArray<RecordType>.  Each of the chosen
+ *  fields of RecordType is stored in one file as its own contiguous column, starting on a
+ *  64-byte boundary in memory, so a scan or filter over one field reads only that field's
+ *  bytes, and the compiler can vectorize a loop over it.  Records are reassembled a field at a
+ *  time with readRecordAtIndex().  (A resource inside a package, e.g. an APK, can start
+ *  anywhere in it, so if its mapping isn't aligned it's read into an aligned buffer instead.)
+ *
+ *  The columns are described by an array of ES_FILE_COLUMN(RecordType, field), and the column
+ *  indices used by column() are positions in that array.  The same description must be given
+ *  when loading as when writing; the file records it (with sizeof(RecordType)), so a file
+ *  written for a different layout is logged and treated as missing, leaving the array empty.
+ *
+ *      static const ESFileColumnSpec columns[] = {
+ *          ES_FILE_COLUMN(Place, latitude),
+ *          ES_FILE_COLUMN(Place, population),
+ *      };
+ *      ESFileColumnArray<Place> places("places.esfc", ESFilePathTypeRelativeToResourceDir, columns, 2);
+ *      const int32_t *population = places.column<int32_t>(1);
+ *      for (int i = 0; i < places.numRows(); i++) {
+ *          ...
+ *      }
+ */
+template <class RecordType>
+class ESFileColumnArray : protected ESFileColumnArrayBase {
+  public:
+    /** Map (or read) the file and check its header and layout; with ESFileArrayValidateChecksum
+     *  each column's checksum is checked too.  The advice is only used when mapping. */
+                            ESFileColumnArray(const char             *path,
+                                              ESFilePathType         pathType,
+                                              const ESFileColumnSpec *columns,
+                                              int                    numColumns,
+                                              ESFileArrayLoadMode    loadMode = ESFileArrayLoadByMapping,
+                                              ESFileArrayValidation  validation = ESFileArrayValidateHeader,
+                                              ESFileAccessAdvice     advice = ESFileAccessNormal);
+
+    /** The number of records (0 if the file was missing or invalid) */
+    int                     numRows() const { return (int)_numRows; }
+
+    /** True if the columns are mapped from the file rather than read into memory */
+    bool                    isMapped() const { return _mapBase != NULL; }
+
+    /** The given column, as an array of numRows() values.  FieldType must be the type of the field. */
+    template <class FieldType>
+    const FieldType         *column(int columnIndex) const {
+        return (const FieldType *)columnData(columnIndex, sizeof(FieldType));
+    }
+
+    /** Gather the stored fields of one record into *record; bytes not in any column are zeroed */
+    void                    readRecordAtIndex(int        indx,
+                                              RecordType *record) const;
+
+    /** Write the given fields of the records as columns.
+     *  @return true iff the write was successful. */
+    static bool             writeFromRecords(const RecordType       *records,
+                                             int                    numRecords,
+                                             const ESFileColumnSpec *columns,
+                                             int                    numColumns,
+                                             const char             *path,
+                                             ESFilePathType         pathType,
+                                             ESFileWriteMode        mode = ESFileWriteInPlace);
+
+    /** Convert an existing ESFileArray<RecordType> file (in the given format) to a column file.
+     *  @return true iff the records were read and the columns were written. */
+    static bool             convertFromFileArray(const char             *recordsPath,
+                                                 ESFilePathType         recordsPathType,
+                                                 ESFileArrayFormat      recordsFormat,
+                                                 const ESFileColumnSpec *columns,
+                                                 int                    numColumns,
+                                                 const char             *path,
+                                                 ESFilePathType         pathType,
+                                                 ESFileWriteMode        mode = ESFileWriteInPlace);
+};
+
+#include "ESFileColumnArrayInl.hpp"
+
+#endif  // _ESFILECOLUMNARRAY_HPP_
@@ -0,0 +1,68 @@
+//
+//  ESFileColumnArrayInl.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESFILECOLUMNARRAYINL_HPP_
+#define _ESFILECOLUMNARRAYINL_HPP_
+
+#include "ESErrorReporter.hpp"
+
+// These definitions are inline to avoid portability issues with templates defined in c++ files.
+
+template <class RecordType>
+inline
+ESFileColumnArray<RecordType>::ESFileColumnArray(const char             *path,
+                                                 ESFilePathType         pathType,
+                                                 const ESFileColumnSpec *columns,
+                                                 int                    numColumns,
+                                                 ESFileArrayLoadMode    loadMode,
+                                                 ESFileArrayValidation  validation,
+                                                 ESFileAccessAdvice     advice)
+:   ESFileColumnArrayBase(path, pathType, loadMode, validation, advice, sizeof(RecordType), columns, numColumns)
+{
+}
+
+template <class RecordType>
+inline void
+ESFileColumnArray<RecordType>::readRecordAtIndex(int        indx,
+                                                 RecordType *record) const {
+    ESAssert(indx >= 0);
+    ESAssert((size_t)indx < _numRows);
+    readRecord(indx, record, sizeof(RecordType));
+}
+
+template <class RecordType>
+/*static*/ inline bool
+ESFileColumnArray<RecordType>::writeFromRecords(const RecordType       *records,
+                                                int                    numRecords,
+                                                const ESFileColumnSpec *columns,
+                                                int                    numColumns,
+                                                const char             *path,
+                                                ESFilePathType         pathType,
+                                                ESFileWriteMode        mode) {
+    ESAssert(numRecords >= 0);
+    return write(records, sizeof(RecordType), numRecords, columns, numColumns, path, pathType, mode);
+}
+
+template <class RecordType>
+/*static*/ inline bool
+ESFileColumnArray<RecordType>::convertFromFileArray(const char             *recordsPath,
+                                                    ESFilePathType         recordsPathType,
+                                                    ESFileArrayFormat      recordsFormat,
+                                                    const ESFileColumnSpec *columns,
+                                                    int                    numColumns,
+                                                    const char             *path,
+                                                    ESFilePathType         pathType,
+                                                    ESFileWriteMode        mode) {
+    // Each record is read exactly once, in order
+    ESFileArray<RecordType> records(recordsPath, recordsPathType, ESFileArrayLoadByMapping, recordsFormat,
+                                    ESFileArrayValidateHeader, ESFileAccessSequential);
+    if (!records.array()) {
+        return false;
+    }
+    return writeFromRecords(records.array(), records.numElements(), columns, numColumns, path, pathType, mode);
+}
+
+#endif  // _ESFILECOLUMNARRAYINL_HPP_
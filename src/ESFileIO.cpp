@@ -0,0 +1,223 @@
+//
+//  ESFileIO.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESFileIO.hpp"
+#include "ESThread.hpp"
+#include "ESThreadPool.hpp"
+#include "ESLock.hpp"
+#include "ESErrorReporter.hpp"
+
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include <string>
+
+// Blocking calls spend their time waiting rather than computing, so there's no point in
+// tying the number of threads to the number of processors, but there is in having enough to
+// keep several requests in flight to the storage at once.
+#define ES_FILE_IO_MIN_THREADS 4
+
+enum ESFileIOOperation {
+    ESFileIORead,
+    ESFileIOPread,
+    ESFileIOWrite,
+    ESFileIOFsync,
+    ESFileIOReadFile
+};
+
+struct ESFileIORequest {
+    ESFileIOOperation       operation;
+    int                     fd;
+    char                    *buf;
+    size_t                  length;
+    off_t                   offset;
+    std::string             path;       // For ESFileIOReadFile
+    ESFilePathType          pathType;   // For ESFileIOReadFile
+    bool                    missingOK;  // For ESFileIOReadFile
+    ESThread                *completionThread;
+    ESFileIOCompletionFn    completionFn;
+    void                    *completionObject;
+    ESFileIOResult          result;
+};
+
+static ESThreadPool *ioPool = NULL;
+static ESLock ioPoolLock;
+
+/*static*/ ESThreadPool *
+ESFileIO::threadPool() {
+    ioPoolLock.lock();
+    if (!ioPool) {
+        int numThreads = ESThreadPool::numberOfProcessors();
+        if (numThreads < ES_FILE_IO_MIN_THREADS) {
+            numThreads = ES_FILE_IO_MIN_THREADS;
+        }
+        ioPool = new ESThreadPool("ESFileIO", numThreads);
+    }
+    ESThreadPool *pool = ioPool;
+    ioPoolLock.unlock();
+    return pool;
+}
+
+// Repeat read(), pread() or write() until the whole length is transferred, we reach EOF, or there's an error
+static void transfer(ESFileIORequest *request) {
+    size_t done = 0;
+    while (done < request->length) {
+        ssize_t st;
+        switch(request->operation) {
+          case ESFileIORead:
+            st = read(request->fd, request->buf + done, request->length - done);
+            break;
+          case ESFileIOPread:
+            st = pread(request->fd, request->buf + done, request->length - done, request->offset + done);
+            break;
+          case ESFileIOWrite:
+          default:
+            st = write(request->fd, request->buf + done, request->length - done);
+            break;
+        }
+        if (st < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            request->result.bytesTransferred = -1;
+            request->result.errorCode = errno;
+            return;
+        }
+        if (st == 0) {
+            break;  // EOF
+        }
+        done += st;
+    }
+    request->result.bytesTransferred = done;
+}
+
+static void completionGlue(void *obj,
+                           void *param) {
+    ESFileIORequest *request = (ESFileIORequest *)obj;
+    (*request->completionFn)(request->completionObject, &request->result);
+    delete request;
+}
+
+static void requestGlue(void *obj,
+                        void *param) {
+    ESFileIORequest *request = (ESFileIORequest *)obj;
+    request->result.bytesTransferred = 0;
+    request->result.errorCode = 0;
+    request->result.buffer = request->buf;
+    switch(request->operation) {
+      case ESFileIORead:
+      case ESFileIOPread:
+      case ESFileIOWrite:
+        transfer(request);
+        break;
+      case ESFileIOFsync:
+        if (fsync(request->fd) != 0) {
+            request->result.bytesTransferred = -1;
+            request->result.errorCode = errno;
+        }
+        break;
+      case ESFileIOReadFile:
+        {
+            size_t fileSize = 0;
+            errno = 0;
+            request->result.buffer = ESFile::getFileContentsInMallocdArray(request->path.c_str(), request->pathType,
+                                                                          request->missingOK, &fileSize);
+            if (request->result.buffer) {
+                request->result.bytesTransferred = fileSize;
+            } else {
+                request->result.bytesTransferred = -1;
+                request->result.errorCode = errno ? errno : EIO;
+            }
+        }
+        break;
+      default:
+        ESAssert(false);
+        break;
+    }
+    request->completionThread->callInThread(completionGlue, request, NULL);
+}
+
+static void submitRequest(ESFileIORequest      *request,
+                          ESThread             *completionThread,
+                          ESFileIOCompletionFn completionFn,
+                          void                 *completionObject) {
+    ESAssert(completionFn);
+    request->completionThread = completionThread ? completionThread : ESThread::currentThread();
+    ESAssert(request->completionThread);
+    request->completionFn = completionFn;
+    request->completionObject = completionObject;
+    ESFileIO::threadPool()->submit(requestGlue, request, NULL);
+}
+
+static ESFileIORequest *newRequest(ESFileIOOperation operation,
+                                   int               fd,
+                                   const void        *buf,
+                                   size_t            length,
+                                   off_t             offset) {
+    ESFileIORequest *request = new ESFileIORequest;
+    request->operation = operation;
+    request->fd = fd;
+    request->buf = (char *)buf;
+    request->length = length;
+    request->offset = offset;
+    request->pathType = ESFilePathTypeRelativeToResourceDir;
+    request->missingOK = false;
+    return request;
+}
+
+/*static*/ void
+ESFileIO::readAsync(int                  fd,
+                    void                 *buf,
+                    size_t               length,
+                    ESThread             *completionThread,
+                    ESFileIOCompletionFn completionFn,
+                    void                 *completionObject) {
+    submitRequest(newRequest(ESFileIORead, fd, buf, length, 0), completionThread, completionFn, completionObject);
+}
+
+/*static*/ void
+ESFileIO::preadAsync(int                  fd,
+                     void                 *buf,
+                     size_t               length,
+                     off_t                offset,
+                     ESThread             *completionThread,
+                     ESFileIOCompletionFn completionFn,
+                     void                 *completionObject) {
+    submitRequest(newRequest(ESFileIOPread, fd, buf, length, offset), completionThread, completionFn, completionObject);
+}
+
+/*static*/ void
+ESFileIO::writeAsync(int                  fd,
+                     const void           *buf,
+                     size_t               length,
+                     ESThread             *completionThread,
+                     ESFileIOCompletionFn completionFn,
+                     void                 *completionObject) {
+    submitRequest(newRequest(ESFileIOWrite, fd, buf, length, 0), completionThread, completionFn, completionObject);
+}
+
+/*static*/ void
+ESFileIO::fsyncAsync(int                  fd,
+                     ESThread             *completionThread,
+                     ESFileIOCompletionFn completionFn,
+                     void                 *completionObject) {
+    submitRequest(newRequest(ESFileIOFsync, fd, NULL, 0, 0), completionThread, completionFn, completionObject);
+}
+
+/*static*/ void
+ESFileIO::readFileAsync(const char           *path,
+                        ESFilePathType       pathType,
+                        bool                 missingOK,
+                        ESThread             *completionThread,
+                        ESFileIOCompletionFn completionFn,
+                        void                 *completionObject) {
+    ESFileIORequest *request = newRequest(ESFileIOReadFile, -1, NULL, 0, 0);
+    request->path = path;
+    request->pathType = pathType;
+    request->missingOK = missingOK;
+    submitRequest(request, completionThread, completionFn, completionObject);
+}
@@ -0,0 +1,80 @@
+//
+//  ESFileIO.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESFILEIO_HPP_
+#define _ESFILEIO_HPP_
+
+#include "ESPlatform.h"  // Must be first
+#include "ESFile.hpp"
+
+#include <sys/types.h>
+
+class ESThread;
+class ESThreadPool;
+
+/*! The outcome of an ESFileIO request, passed to its completion function */
+struct ESFileIOResult {
+    ssize_t                 bytesTransferred;  // -1 on error; less than requested only at end of file
+    int                     errorCode;         // errno from the failing call, or 0
+    void                    *buffer;           // The caller's buffer, or for readFileAsync a malloc'd buffer now owned by the completion
+};
+
+// Called in the completion thread; the result is only valid during the call.
+typedef void (*ESFileIOCompletionFn)(void           *completionObject,
+                                     ESFileIOResult *result);
+
+/*! Asynchronous file I/O, so that the calling thread (often the main thread) doesn't block.
+ *
+ *  Each request runs on one of a small pool of I/O threads, sized for overlapping blocking
+ *  calls rather than for the number of processors, and its completion function is then called
+ *  via callInThread() in the given completion thread (the calling thread if NULL), which must
+ *  therefore be running a message loop.  Transfers are retried until complete, or until EOF
+ *  or an error.
+ *
+ *  Requests run concurrently and may complete in any order, even for the same fd.  So don't
+ *  issue concurrent read() or write() requests on one fd, which would race on the file
+ *  position, and to order (say) an fsync after a write, issue the fsync from the write's
+ *  completion.  The caller's buffer and fd must remain valid until the completion is called. */
+class ESFileIO {
+  public:
+    static void             readAsync(int                  fd,
+                                      void                 *buf,
+                                      size_t               length,
+                                      ESThread             *completionThread,
+                                      ESFileIOCompletionFn completionFn,
+                                      void                 *completionObject);
+    static void             preadAsync(int                  fd,
+                                       void                 *buf,
+                                       size_t               length,
+                                       off_t                offset,
+                                       ESThread             *completionThread,
+                                       ESFileIOCompletionFn completionFn,
+                                       void                 *completionObject);
+    static void             writeAsync(int                  fd,
+                                       const void           *buf,
+                                       size_t               length,
+                                       ESThread             *completionThread,
+                                       ESFileIOCompletionFn completionFn,
+                                       void                 *completionObject);
+    static void             fsyncAsync(int                  fd,
+                                       ESThread             *completionThread,
+                                       ESFileIOCompletionFn completionFn,
+                                       void                 *completionObject);
+
+    /** Read an entire file as ESFile::getFileContentsInMallocdArray() does.  On success the
+     *  result's buffer is malloc'd and belongs to the completion, which must free it. */
+    static void             readFileAsync(const char           *path,
+                                          ESFilePathType       pathType,
+                                          bool                 missingOK,
+                                          ESThread             *completionThread,
+                                          ESFileIOCompletionFn completionFn,
+                                          void                 *completionObject);
+
+    /** The pool which runs the requests, created on first use and never destroyed */
+    static ESThreadPool     *threadPool();
+};
+
+#endif  // _ESFILEIO_HPP_
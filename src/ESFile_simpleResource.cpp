@@ -13,7 +13,10 @@ ESFile::getFDPointingAtResource(const char   *resourcePath,
                                 bool         missingOK,
                                 size_t       *resourceSizeReturn,
                                 ESFileCloser **fileCloser) {
-    int fd = getFDPointingAtFileInDirectory(resourcePath, resourceDirectory(), missingOK, resourceSizeReturn);
+    int dirFD = directoryFD(ESFilePathTypeRelativeToResourceDir);
+    int fd = (dirFD >= 0)
+        ? getFDPointingAtFileInDirectoryFD(resourcePath, dirFD, missingOK, resourceSizeReturn)
+        : getFDPointingAtFileInDirectory(resourcePath, resourceDirectory(), missingOK, resourceSizeReturn);
     *fileCloser = new ESStaticFileCloser(fd);
     return fd;
 }
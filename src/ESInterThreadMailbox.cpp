@@ -0,0 +1,153 @@
+//
+//  ESInterThreadMailbox.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESInterThreadMailbox.hpp"
+#include "ESErrorReporter.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#if ES_ANDROID
+#include <sys/eventfd.h>
+#define ES_HAVE_EVENTFD 1
+#else
+#define ES_HAVE_EVENTFD 0
+#endif
+
+// Must be a power of two
+static const size_t ESInterThreadMailboxCapacity = 4096;
+
+ESInterThreadMailbox::ESInterThreadMailbox()
+:   _cells(new Cell[ESInterThreadMailboxCapacity]),
+    _mask(ESInterThreadMailboxCapacity - 1),
+    _tail(0),
+    _head(0),
+    _count(0),
+    _readFD(-1),
+    _writeFD(-1)
+{
+    for (size_t i = 0; i < ESInterThreadMailboxCapacity; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+#if ES_HAVE_EVENTFD
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        ESErrorReporter::checkAndLogSystemError("ESInterThreadMailbox", errno, "eventfd creation");
+        ESAssert(false);  // This is too bad to try to continue from
+        return;
+    }
+    _readFD = fd;
+    _writeFD = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESInterThreadMailbox", errno, "pipe creation");
+        ESAssert(false);  // This is too bad to try to continue from
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    _readFD = fds[0];
+    _writeFD = fds[1];
+#endif
+}
+
+ESInterThreadMailbox::~ESInterThreadMailbox() {
+    if (_readFD >= 0) {
+        close(_readFD);
+    }
+    if (_writeFD >= 0 && _writeFD != _readFD) {
+        close(_writeFD);
+    }
+    delete [] _cells;
+}
+
+void
+ESInterThreadMailbox::signal() {
+#if ES_HAVE_EVENTFD
+    uint64_t one = 1;
+    ssize_t st = write(_writeFD, &one, sizeof(one));
+#else
+    char one = 1;
+    ssize_t st = write(_writeFD, &one, 1);
+#endif
+    // EAGAIN means the counter (or pipe) is already full, in which case the consumer is sure to wake up anyway.
+    if (st < 0 && errno != EAGAIN) {
+        ESErrorReporter::checkAndLogSystemError("ESInterThreadMailbox", errno, "wakeup write");
+        ESAssert(false);
+    }
+}
+
+void
+ESInterThreadMailbox::post(const ESInterThreadPacket *packets,
+                           int                       numPackets) {
+    for (int i = 0; i < numPackets; i++) {
+        size_t pos = _tail.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &_cells[pos & _mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                // Full.  Let the consumer catch up.
+                sched_yield();
+                pos = _tail.load(std::memory_order_relaxed);
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+        cell->packet = packets[i];
+        cell->sequence.store(pos + 1, std::memory_order_release);
+    }
+    // Only the producer that takes the queue from empty to non-empty wakes the consumer; the
+    // consumer doesn't wait again until it has drained the queue.
+    if (_count.fetch_add(numPackets, std::memory_order_acq_rel) == 0) {
+        signal();
+    }
+}
+
+void
+ESInterThreadMailbox::clearWakeup() {
+#if ES_HAVE_EVENTFD
+    uint64_t value;
+    ssize_t st = read(_readFD, &value, sizeof(value));
+#else
+    char buf[64];
+    ssize_t st;
+    while ((st = read(_readFD, buf, sizeof(buf))) > 0)
+        ;  // empty
+#endif
+    if (st < 0 && errno != EAGAIN) {
+        ESErrorReporter::checkAndLogSystemError("ESInterThreadMailbox", errno, "wakeup read");
+        ESAssert(false);
+    }
+}
+
+bool
+ESInterThreadMailbox::pop(ESInterThreadPacket *packet) {
+    if (_count.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    // At least one packet has been published, but the cell at the head might belong to a producer
+    // which reserved it earlier and is still filling it in; if so it won't be long.
+    Cell *cell = &_cells[_head & _mask];
+    while (cell->sequence.load(std::memory_order_acquire) != _head + 1) {
+        sched_yield();
+    }
+    *packet = cell->packet;
+    cell->sequence.store(_head + _mask + 1, std::memory_order_release);
+    _head++;
+    _count.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
@@ -0,0 +1,63 @@
+//
+//  ESInterThreadMailbox.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESINTERTHREADMAILBOX_HPP_
+#define _ESINTERTHREADMAILBOX_HPP_
+
+#include "ESPlatform.h"  // Must be first
+#include "ESThread.hpp"  // For ESInterThreadPacket
+
+#include <atomic>
+
+/** A bounded, lock-free, multiple-producer/single-consumer queue of inter-thread packets,
+ *  used by ESThread (with ESInterThreadTransportMailbox) in place of a socketpair so that
+ *  packets are never copied through the kernel.
+ *
+ *  The consumer is woken through a selectable descriptor (an eventfd where available, a pipe
+ *  otherwise), which is signaled only when the queue goes from empty to non-empty.  The
+ *  consumer must therefore drain the queue completely (until pop() returns false) after each
+ *  wakeup before it waits again.
+ *
+ *  The queue itself is a Vyukov-style bounded ring with a sequence number per cell.  If the
+ *  ring is full, producers yield until the consumer makes room. */
+class ESInterThreadMailbox {
+  public:
+                            ESInterThreadMailbox();
+                            ~ESInterThreadMailbox();
+
+    bool                    valid() const { return _readFD >= 0; }
+
+    // The consumer selects on this descriptor.
+    int                     readFD() const { return _readFD; }
+    int                     writeFD() const { return _writeFD; }
+
+    // Methods called in producer threads:
+    void                    post(const ESInterThreadPacket *packets,
+                                 int                       numPackets);
+
+    // Methods called in the consumer thread:
+    void                    clearWakeup();
+    bool                    isEmpty() const { return _count.load(std::memory_order_acquire) == 0; }
+    bool                    pop(ESInterThreadPacket *packet);
+
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        ESInterThreadPacket packet;
+    };
+
+    void                    signal();
+
+    Cell                    *_cells;
+    size_t                  _mask;
+    std::atomic<size_t>     _tail;   // Next slot to be reserved by a producer
+    size_t                  _head;   // Next slot to be read by the consumer (consumer thread only)
+    std::atomic<size_t>     _count;  // Packets published but not yet popped
+    int                     _readFD;
+    int                     _writeFD;
+};
+
+#endif  // _ESINTERTHREADMAILBOX_HPP_
@@ -0,0 +1,252 @@
+//
+//  ESLZ4.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESLZ4.hpp"
+
+#include <stdint.h>
+#include <string.h>
+
+// A block is a series of sequences, each a token byte (literal length in the high nibble, match
+// length - 4 in the low one, 15 meaning "more follows" as bytes of 255 and a final smaller one),
+// the literals, and a two-byte little-endian offset back to the match.  The final sequence has
+// literals only.  The format requires the last 5 bytes to be literals, and no match to start
+// in the last 12.
+#define ES_LZ4_MIN_MATCH     4
+#define ES_LZ4_LAST_LITERALS 5
+#define ES_LZ4_MF_LIMIT      12
+#define ES_LZ4_MAX_OFFSET    65535
+#define ES_LZ4_MAX_INPUT     0x7E000000
+#define ES_LZ4_HASH_LOG      12   // 16KB table: fits in L1, and on any thread's stack
+#define ES_LZ4_SKIP_TRIGGER  6    // After 2^6 misses in a row, step faster, so incompressible data goes quickly
+#define ES_LZ4_WILD_COPY     16   // Copy this much at a time when there's room, rather than exactly
+
+static inline uint32_t
+read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t
+hashOf(uint32_t sequence) {
+    return (sequence * 2654435761U) >> (32 - ES_LZ4_HASH_LOG);
+}
+
+// The length of the common prefix of [p, limit) and the bytes at r
+static inline size_t
+commonLength(const uint8_t *p,
+             const uint8_t *r,
+             const uint8_t *limit) {
+    const uint8_t *start = p;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (p + sizeof(uint64_t) <= limit) {
+        uint64_t a, b;
+        memcpy(&a, p, sizeof(a));
+        memcpy(&b, r, sizeof(b));
+        if (a != b) {
+            return (p - start) + __builtin_ctzll(a ^ b) / 8;
+        }
+        p += sizeof(uint64_t);
+        r += sizeof(uint64_t);
+    }
+#endif
+    while (p < limit && *p == *r) {
+        p++;
+        r++;
+    }
+    return p - start;
+}
+
+static inline uint8_t *
+writeLength(uint8_t *op,
+            size_t  length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static inline size_t
+lengthBytes(size_t length) {
+    return length >= 15 ? (length - 15) / 255 + 1 : 0;
+}
+
+// Emit literals followed by a match (matchLength 0 for the final, literals-only sequence).
+// Returns NULL if it doesn't fit.
+static uint8_t *
+emitSequence(uint8_t       *op,
+             uint8_t       *oend,
+             const uint8_t *literals,
+             size_t        literalLength,
+             size_t        offset,
+             size_t        matchLength) {
+    size_t needed = 1 + lengthBytes(literalLength) + literalLength;
+    if (matchLength) {
+        needed += 2 + lengthBytes(matchLength - ES_LZ4_MIN_MATCH);
+    }
+    if (needed > (size_t)(oend - op)) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    uint8_t tokenValue;
+    if (literalLength >= 15) {
+        tokenValue = 15 << 4;
+        op = writeLength(op, literalLength - 15);
+    } else {
+        tokenValue = (uint8_t)(literalLength << 4);
+    }
+    if (literalLength) {  // literals may be NULL when compressing nothing, which memcpy doesn't allow
+        memcpy(op, literals, literalLength);
+        op += literalLength;
+    }
+    if (matchLength) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        size_t extra = matchLength - ES_LZ4_MIN_MATCH;
+        if (extra >= 15) {
+            tokenValue |= 15;
+            op = writeLength(op, extra - 15);
+        } else {
+            tokenValue |= (uint8_t)extra;
+        }
+    }
+    *token = tokenValue;
+    return op;
+}
+
+/*static*/ size_t
+ESLZ4::compress(const void *src,
+                size_t     srcLength,
+                void       *dst,
+                size_t     dstCapacity) {
+    if (srcLength > ES_LZ4_MAX_INPUT) {
+        return 0;
+    }
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;  // Start of the literals not yet emitted
+    const uint8_t *iend = base + srcLength;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + dstCapacity;
+    if (srcLength > ES_LZ4_MF_LIMIT) {
+        const uint8_t *mfLimit = iend - ES_LZ4_MF_LIMIT;
+        const uint8_t *matchLimit = iend - ES_LZ4_LAST_LITERALS;
+        // The most recent position with each hash; unfilled slots say position 0, which is just an unlikely candidate
+        uint32_t table[1 << ES_LZ4_HASH_LOG];
+        memset(table, 0, sizeof(table));
+        unsigned misses = 0;
+        while (ip < mfLimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hashOf(sequence);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (ref >= ip || ip - ref > ES_LZ4_MAX_OFFSET || read32(ref) != sequence) {
+                ip += 1 + (misses++ >> ES_LZ4_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *matchEnd = ip + ES_LZ4_MIN_MATCH;
+            matchEnd += commonLength(matchEnd, ref + ES_LZ4_MIN_MATCH, matchLimit);
+            op = emitSequence(op, oend, anchor, ip - anchor, ip - ref, matchEnd - ip);
+            if (!op) {
+                return 0;
+            }
+            // Remember a position near the end of the match too, which helps with runs
+            table[hashOf(read32(matchEnd - 2))] = (uint32_t)(matchEnd - 2 - base);
+            ip = anchor = matchEnd;
+        }
+    }
+    op = emitSequence(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? op - (uint8_t *)dst : 0;
+}
+
+static inline bool
+readLength(const uint8_t **ipp,
+           const uint8_t *iend,
+           size_t        *length) {
+    const uint8_t *ip = *ipp;
+    unsigned b;
+    do {
+        if (ip >= iend) {
+            return false;
+        }
+        b = *ip++;
+        *length += b;
+    } while (b == 255);
+    *ipp = ip;
+    return true;
+}
+
+/*static*/ ssize_t
+ESLZ4::decompress(const void *src,
+                  size_t     srcLength,
+                  void       *dst,
+                  size_t     dstCapacity) {
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + srcLength;
+    uint8_t *ostart = (uint8_t *)dst;
+    uint8_t *op = ostart;
+    uint8_t *oend = ostart + dstCapacity;
+    while (ip < iend) {
+        unsigned token = *ip++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(&ip, iend, &literalLength)) {
+            return -1;
+        }
+        if (literalLength > (size_t)(iend - ip) || literalLength > (size_t)(oend - op)) {
+            return -1;
+        }
+        if (literalLength <= ES_LZ4_WILD_COPY && iend - ip >= ES_LZ4_WILD_COPY && oend - op >= ES_LZ4_WILD_COPY) {
+            memcpy(op, ip, ES_LZ4_WILD_COPY);  // The excess is overwritten later
+        } else {
+            memcpy(op, ip, literalLength);
+        }
+        ip += literalLength;
+        op += literalLength;
+        if (ip == iend) {
+            return op - ostart;  // The final sequence has no match
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - ostart)) {
+            return -1;
+        }
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(&ip, iend, &matchLength)) {
+            return -1;
+        }
+        matchLength += ES_LZ4_MIN_MATCH;
+        if (matchLength > (size_t)(oend - op)) {
+            return -1;
+        }
+        const uint8_t *match = op - offset;
+        if (offset >= ES_LZ4_WILD_COPY && (size_t)(oend - op) >= matchLength + ES_LZ4_WILD_COPY) {
+            // Each chunk's source lies entirely before its destination, so it's already been written
+            for (size_t done = 0; done < matchLength; done += ES_LZ4_WILD_COPY) {
+                memcpy(op + done, match + done, ES_LZ4_WILD_COPY);
+            }
+        } else if (offset >= matchLength) {
+            memcpy(op, match, matchLength);
+        } else {
+            for (size_t i = 0; i < matchLength; i++) {  // Overlapping: a repeating pattern
+                op[i] = match[i];
+            }
+        }
+        op += matchLength;
+    }
+    return -1;  // Ran out of input before the final literals
+}
@@ -0,0 +1,42 @@
+//
+//  ESLZ4.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESLZ4_HPP_
+#define _ESLZ4_HPP_
+
+#include "ESPlatform.h"  // Must be first
+
+#include <stddef.h>
+#include <sys/types.h>  // For ssize_t
+
+/*! A small, dependency-free codec for the LZ4 block format (not the LZ4 frame format: there's
+ *  no framing, checksum, or size prefix; the caller records sizes itself).
+ *
+ *  The compressor is the simple greedy single-pass one, so the ratio is a little worse than the
+ *  reference library's, but its output is standard and decompresses anywhere.  The decompressor
+ *  checks every length and offset against both buffers, so corrupt input fails rather than
+ *  reading or writing out of bounds. */
+class ESLZ4 {
+  public:
+    /** The largest compressed size of srcLength bytes, i.e., the dst capacity which guarantees compress() succeeds */
+    static size_t           compressBound(size_t srcLength) { return srcLength + srcLength / 255 + 16; }
+
+    /** Compress src into dst.
+     *  @return the compressed size, or 0 if it doesn't fit in dstCapacity. */
+    static size_t           compress(const void *src,
+                                     size_t     srcLength,
+                                     void       *dst,
+                                     size_t     dstCapacity);
+
+    /** Decompress a block produced by compress() (or any LZ4 block compressor) into dst.
+     *  @return the decompressed size, or -1 if the input is malformed or doesn't fit in dstCapacity. */
+    static ssize_t          decompress(const void *src,
+                                       size_t     srcLength,
+                                       void       *dst,
+                                       size_t     dstCapacity);
+};
+
+#endif  // _ESLZ4_HPP_
@@ -10,15 +10,138 @@
 
 #include "ESLinearRegression.hpp"
 
+#include "ESParallel.hpp"
 #include "ESUtil.hpp"
 
 #include <math.h>
 #include <string.h>  // For memcpy
 
+#include <algorithm>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Observations per block when forming the normal equations.  The weighted terms of one block
+// (N * 256 doubles) are reused against every other term, so they should stay in L1 or L2.
+#define ES_REGRESSION_BLOCK 256
+
+// A vector of doubles, and fused multiply-add where the hardware has it
+#if defined(__AVX__)
+#define ES_VEC_LANES 4
+typedef __m256d ESVecD;
+#define esVecZero()        _mm256_setzero_pd()
+#define esVecLoad(p)       _mm256_loadu_pd(p)
+#define esVecStore(p, v)   _mm256_storeu_pd(p, v)
+#if defined(__FMA__)
+#define esVecFMA(a, b, c)  _mm256_fmadd_pd(a, b, c)
+#else
+#define esVecFMA(a, b, c)  _mm256_add_pd(_mm256_mul_pd(a, b), c)
+#endif
+#elif defined(__SSE2__)
+#define ES_VEC_LANES 2
+typedef __m128d ESVecD;
+#define esVecZero()        _mm_setzero_pd()
+#define esVecLoad(p)       _mm_loadu_pd(p)
+#define esVecStore(p, v)   _mm_storeu_pd(p, v)
+#define esVecFMA(a, b, c)  _mm_add_pd(_mm_mul_pd(a, b), c)
+#elif defined(__aarch64__)
+#define ES_VEC_LANES 2
+typedef float64x2_t ESVecD;
+#define esVecZero()        vdupq_n_f64(0)
+#define esVecLoad(p)       vld1q_f64(p)
+#define esVecStore(p, v)   vst1q_f64(p, v)
+#define esVecFMA(a, b, c)  vfmaq_f64(c, a, b)
+#endif
+
+#ifdef ES_VEC_LANES
+static inline double
+esVecSum(ESVecD v) {
+    double lanes[ES_VEC_LANES];
+    esVecStore(lanes, v);
+    double sum = 0;
+    for (int i = 0; i < ES_VEC_LANES; i++) {
+        sum += lanes[i];
+    }
+    return sum;
+}
+#endif
+
+// sums[0..3] += the dot products of a with each of b0..b3, over len values
+static void
+dot4(const double *a,
+     const double *b0,
+     const double *b1,
+     const double *b2,
+     const double *b3,
+     int          len,
+     double       *sums)
+{
+    int k = 0;
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+#ifdef ES_VEC_LANES
+    // Each a vector is loaded once for four independent FMA chains, which also hides the FMA latency
+    ESVecD v0 = esVecZero(), v1 = esVecZero(), v2 = esVecZero(), v3 = esVecZero();
+    for (; k + ES_VEC_LANES <= len; k += ES_VEC_LANES) {
+        ESVecD va = esVecLoad(a + k);
+        v0 = esVecFMA(va, esVecLoad(b0 + k), v0);
+        v1 = esVecFMA(va, esVecLoad(b1 + k), v1);
+        v2 = esVecFMA(va, esVecLoad(b2 + k), v2);
+        v3 = esVecFMA(va, esVecLoad(b3 + k), v3);
+    }
+    s0 = esVecSum(v0);
+    s1 = esVecSum(v1);
+    s2 = esVecSum(v2);
+    s3 = esVecSum(v3);
+#endif
+    for (; k < len; k++) {
+        s0 += a[k] * b0[k];
+        s1 += a[k] * b1[k];
+        s2 += a[k] * b2[k];
+        s3 += a[k] * b3[k];
+    }
+    sums[0] += s0;
+    sums[1] += s1;
+    sums[2] += s2;
+    sums[3] += s3;
+}
+
+// The dot product of a and b over len values
+static double
+dot1(const double *a,
+     const double *b,
+     int          len)
+{
+    int k = 0;
+    double s = 0;
+#ifdef ES_VEC_LANES
+    ESVecD v0 = esVecZero(), v1 = esVecZero();
+    for (; k + 2 * ES_VEC_LANES <= len; k += 2 * ES_VEC_LANES) {
+        v0 = esVecFMA(esVecLoad(a + k), esVecLoad(b + k), v0);
+        v1 = esVecFMA(esVecLoad(a + k + ES_VEC_LANES), esVecLoad(b + k + ES_VEC_LANES), v1);
+    }
+    s = esVecSum(v0) + esVecSum(v1);
+#endif
+    for (; k < len; k++) {
+        s += a[k] * b[k];
+    }
+    return s;
+}
+
 ESLinearRegression::Matrix::Matrix(const ESLinearRegression::Matrix &other)
 : rows_(other.rows_),
   cols_(other.cols_)
 {
+    if (!other.data_)  // Moved from
+    {
+        data_ = NULL;
+        return;
+    }
     data_ = new double[rows_ * cols_];
     memcpy(data_, other.data_, rows_ * cols_ * sizeof(double));
 }
@@ -26,10 +149,32 @@ ESLinearRegression::Matrix::Matrix(const ESLinearRegression::Matrix &other)
 ESLinearRegression::Matrix &
 ESLinearRegression::Matrix::operator=(const ESLinearRegression::Matrix &other)
 {
+    if (this == &other)
+        return *this;
+    if (rows_ * cols_ != other.rows_ * other.cols_)  // Otherwise reuse the storage we have
+    {
+        delete [] data_;
+        data_ = other.data_ ? new double[other.rows_ * other.cols_] : NULL;
+    }
+    rows_ = other.rows_;
+    cols_ = other.cols_;
+    if (data_)
+        memcpy(data_, other.data_, rows_ * cols_ * sizeof(double));
+    return *this;
+}
+
+ESLinearRegression::Matrix &
+ESLinearRegression::Matrix::operator=(ESLinearRegression::Matrix &&other)
+{
+    if (this == &other)
+        return *this;
+    delete [] data_;
     rows_ = other.rows_;
     cols_ = other.cols_;
-    data_ = new double[rows_ * cols_];
-    memcpy(data_, other.data_, rows_ * cols_ * sizeof(double));
+    data_ = other.data_;
+    other.rows_ = 0;
+    other.cols_ = 0;
+    other.data_ = NULL;
     return *this;
 }
 
@@ -46,6 +191,168 @@ ESLinearRegression::Matrix::print() const
     }
 }
 
+/*static*/ void
+ESLinearRegression::formNormalEquations(const double Y[],
+                                        const Matrix &X,
+                                        const double W[],
+                                        Matrix       *V,
+                                        double       B[],
+                                        Workspace    *workspace)
+{
+    int N = X.rows();
+    int M = X.cols();
+    ESAssert(V->rows() == N && V->cols() == N);
+    Workspace localWorkspace;
+    if (!workspace)
+        workspace = &localWorkspace;
+
+    // Y is treated as row N of X, so that B = XWY is just column N of the augmented upper triangle,
+    // formed in the same pass over the observations
+    int NA = N + 1;
+    std::vector<const double *> &rows = workspace->rows;
+    rows.resize(NA);
+    for (int i = 0; i < N; i++)
+        rows[i] = X.rowData(i);
+    rows[N] = Y;
+    std::vector<double> &sums = workspace->sums;          // sums[i * NA + j], j >= i
+    sums.assign(N * NA, 0.0);
+    std::vector<double> &weighted = workspace->weighted;  // W[k] * X(i, k) for the current block
+    weighted.resize(N * ES_REGRESSION_BLOCK);
+
+    for (int k0 = 0; k0 < M; k0 += ES_REGRESSION_BLOCK)
+    {
+        int len = std::min(ES_REGRESSION_BLOCK, M - k0);
+        for (int i = 0; i < N; i++)
+        {
+            const double *x = rows[i] + k0;
+            double *wx = &weighted[i * ES_REGRESSION_BLOCK];
+            for (int k = 0; k < len; k++)
+                wx[k] = W[k0 + k] * x[k];
+        }
+        for (int i = 0; i < N; i++)
+        {
+            const double *wx = &weighted[i * ES_REGRESSION_BLOCK];
+            double *sumRow = &sums[i * NA];
+            int j = i;
+            for (; j + 4 <= NA; j += 4)
+                dot4(wx, rows[j] + k0, rows[j + 1] + k0, rows[j + 2] + k0, rows[j + 3] + k0, len, sumRow + j);
+            for (; j < NA; j++)
+                sumRow[j] += dot1(wx, rows[j] + k0, len);
+        }
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = i; j < N; j++)
+            (*V)(i, j) = (*V)(j, i) = sums[i * NA + j];
+        B[i] = sums[i * NA + N];
+    }
+}
+
+// QR gives up (the terms are linearly dependent) if a term has no more than this fraction of its norm left
+#define ES_REGRESSION_MIN_QR_RATIO 1e-12
+
+// Factor V = Rt R into workspace->R, where R is upper triangular.
+// Returns false if V isn't (comfortably) positive definite.
+/*static*/ bool
+ESLinearRegression::factorCholesky(const Matrix &V,
+                                   Workspace    *workspace)
+{
+    int N = V.rows();
+    std::vector<double> &R = workspace->R;
+    R.assign(N * N, 0.0);
+    return factorCholesky(N, V.rowData(0), &R[0]);
+}
+
+// Factor sqrt(W) Xt = Q R by Householder reflections, leaving R in workspace->R and the
+// solution of R C = Qt sqrt(W) Y in workspace->QtY.
+// Returns false if the terms are linearly dependent.
+/*static*/ bool
+ESLinearRegression::factorQR(const double Y[],
+                             const Matrix &X,
+                             const double W[],
+                             Workspace    *workspace)
+{
+    int N = X.rows();
+    int M = X.cols();
+    std::vector<double> &A = workspace->A;  // Column j is sqrt(W) times row j of X
+    std::vector<double> &b = workspace->QtY;
+    std::vector<double> &R = workspace->R;
+    A.resize(M * N);
+    b.resize(M);
+    R.assign(N * N, 0.0);
+    for (int k = 0; k < M; k++)
+        b[k] = sqrt(W[k]) * Y[k];
+    for (int j = 0; j < N; j++)
+    {
+        const double *x = X.rowData(j);
+        double *a = &A[j * M];
+        for (int k = 0; k < M; k++)
+            a[k] = sqrt(W[k]) * x[k];
+    }
+    for (int j = 0; j < N; j++)
+    {
+        double *v = &A[j * M];
+        double originalNorm = 0;
+        for (int k = 0; k < M; k++)
+            originalNorm += v[k] * v[k];
+        double norm = 0;
+        for (int k = j; k < M; k++)
+            norm += v[k] * v[k];
+        if (!(norm > ES_REGRESSION_MIN_QR_RATIO * ES_REGRESSION_MIN_QR_RATIO * originalNorm))
+            return false;
+        norm = sqrt(norm);
+        // Reflect column j onto alpha * e(j), choosing the sign that avoids cancellation.  The rest of
+        // the column becomes the reflection vector, which is applied to the later columns and to b.
+        double alpha = v[j] > 0 ? -norm : norm;
+        v[j] -= alpha;
+        double vnorm2 = 2 * norm * (norm + fabs(v[j] + alpha));  // = |v|^2
+        for (int c = j + 1; c <= N; c++)
+        {
+            double *target = c < N ? &A[c * M] : &b[0];
+            double d = 0;
+            for (int k = j; k < M; k++)
+                d += v[k] * target[k];
+            double f = 2 * d / vnorm2;
+            for (int k = j; k < M; k++)
+                target[k] -= f * v[k];
+        }
+        R[j * N + j] = alpha;
+        for (int c = j + 1; c < N; c++)
+            R[j * N + c] = A[c * M + j];
+    }
+    // Back substitution: R C = (Qt b)[0..N-1]
+    for (int i = N - 1; i >= 0; i--)
+    {
+        double t = b[i];
+        for (int j = i + 1; j < N; j++)
+            t -= R[i * N + j] * b[j];
+        b[i] = t / R[i * N + i];
+    }
+    return true;
+}
+
+// Invert the N x N upper triangular factor workspace->R into workspace->Rinv
+/*static*/ void
+ESLinearRegression::invertFactor(int       N,
+                                 Workspace *workspace)
+{
+    std::vector<double> &Rinv = workspace->Rinv;  // Upper triangular, like R
+    Rinv.assign(N * N, 0.0);
+    invertFactor(N, &workspace->R[0], &Rinv[0]);
+}
+
+// Replace V by SSQ * (X W Xt)^-1 = SSQ * R^-1 R^-t
+/*static*/ void
+ESLinearRegression::formCovariance(double    SSQ,
+                                   Matrix    *V,
+                                   Workspace *workspace)
+{
+    int N = V->rows();
+    invertFactor(N, workspace);
+    formCovariance(N, SSQ, &workspace->Rinv[0], V->rowData(0));
+}
+
 /*static*/ bool 
 ESLinearRegression::invertInPlaceSymmetricMatrix(Matrix *matrix)
 {
@@ -145,11 +452,13 @@ ESLinearRegression::~ESLinearRegression() {
     delete [] DY;
 }
 
-ESLinearRegression::ESLinearRegression(const double Y[],    // observed results
-                                       const Matrix &X,     // row# is variable#, col# is observation#
-                                       const double W[])    // weights, one per observation
+ESLinearRegression::ESLinearRegression(const double Y[],                 // observed results
+                                       const Matrix &X,                  // row# is variable#, col# is observation#
+                                       const double W[],                 // weights, one per observation
+                                       bool         computeStandardErrors,
+                                       Workspace    *workspace)
 :   C(new double[X.rows()]),
-    SEC(new double[X.rows()]),
+    SEC(computeStandardErrors ? new double[X.rows()] : NULL),
     Ycalc(new double[X.cols()]),
     DY(new double[X.cols()]),
     V(X.rows(), X.rows())
@@ -172,41 +481,29 @@ ESLinearRegression::ESLinearRegression(const double Y[],    // observed results
         valid = false;
         return;
     }
-    double *B = new double[N];   // Vector for LSQ
-
-    // Clear the matrices to start out
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            V(i, j) = 0;
+    Workspace localWorkspace;
+    if (!workspace)
+        workspace = &localWorkspace;
+    workspace->B.resize(N);
+    double *B = &workspace->B[0];   // Vector for LSQ
 
     // Form Least Squares Matrix
-    for (int i = 0; i < N; i++)
-    {
-        for (int j = 0; j < N; j++)
-        {
-            V(i, j) = 0;
-            for (int k = 0; k < M; k++)
-                V(i, j) = V(i, j) + W[k] * X(i, k) * X(j, k);
-        }
-        B[i] = 0;
-        for (int k = 0; k < M; k++)
-            B[i] = B[i] + W[k] * X(i, k) * Y[k];
-    }
-    // V now contains the raw least squares matrix
-    if (!invertInPlaceSymmetricMatrix(&V))
+    formNormalEquations(Y, X, W, &V, B, workspace);
+    // V now contains the raw least squares matrix.  Solve V C = B by factoring V = Rt R, rather than inverting V.
+    if (factorCholesky(V, workspace))
     {
-        delete [] B;
-        valid = false;
-        ESErrorReporter::logError("ESLinearRegression", "Matrix inversion failed");
-        return;
+        solveFactored(N, &workspace->R[0], B, C);
     }
-    // V now contains the inverted least square matrix
-    // Matrix multpily to get coefficients C = VB
-    for (int i = 0; i < N; i++)
+    else
     {
-        C[i] = 0;
-        for (int j = 0; j < N; j++)
-            C[i] = C[i] + V(i, j) * B[j];
+        ESLogDebug("ESLinearRegression", "Ill-conditioned least squares matrix; using QR");
+        if (!factorQR(Y, X, W, workspace))
+        {
+            valid = false;
+            ESErrorReporter::logError("ESLinearRegression", "Singular least squares matrix");
+            return;
+        }
+        memcpy(C, &workspace->QtY[0], N * sizeof(double));
     }
     
     // Calculate statistics
@@ -237,12 +534,287 @@ ESLinearRegression::ESLinearRegression(const double Y[],    // observed results
     SDV = sqrt(SSQ);
     
     // Calculate var-covar matrix and std error of coefficients
-    for (int i = 0; i < N; i++)
+    if (computeStandardErrors)
     {
-        for (int j = 0; j < N; j++)
-            V(i, j) = V(i, j) * SSQ;
-        SEC[i] = sqrt(V(i, i));
+        formCovariance(SSQ, &V, workspace);
+        for (int i = 0; i < N; i++)
+            SEC[i] = sqrt(V(i, i));
     }
-    delete [] B;
     valid = true;
 }
+
+ESLinearRegressionAccumulator::ESLinearRegressionAccumulator(int    numTerms,
+                                                             double forgettingFactor)
+:   _numTerms(numTerms),
+    _forgettingFactor(forgettingFactor),
+    _XtWX(numTerms, numTerms),
+    _XtWY(numTerms)
+{
+    ESAssert(forgettingFactor > 0 && forgettingFactor <= 1);
+    reset();
+}
+
+void
+ESLinearRegressionAccumulator::setForgettingFactor(double forgettingFactor)
+{
+    ESAssert(forgettingFactor > 0 && forgettingFactor <= 1);
+    _forgettingFactor = forgettingFactor;
+}
+
+void
+ESLinearRegressionAccumulator::reset()
+{
+    for (int i = 0; i < _numTerms; i++)
+    {
+        double *row = _XtWX.rowData(i);
+        for (int j = 0; j < _numTerms; j++)
+            row[j] = 0;
+        _XtWY[i] = 0;
+    }
+    _sumW = 0;
+    _sumWY = 0;
+    _sumWY2 = 0;
+    _numObservations = 0;
+}
+
+void
+ESLinearRegressionAccumulator::accumulate(const double x[],
+                                          double       y,
+                                          double       w,
+                                          double       count)
+{
+    int N = _numTerms;
+    for (int i = 0; i < N; i++)
+    {
+        double wx = w * x[i];
+        double *row = _XtWX.rowData(i);
+        for (int j = i; j < N; j++)
+            row[j] += wx * x[j];
+        _XtWY[i] += wx * y;
+    }
+    _sumW += w;
+    _sumWY += w * y;
+    _sumWY2 += w * y * y;
+    _numObservations += count;
+}
+
+void
+ESLinearRegressionAccumulator::addObservation(const double x[],
+                                              double       y,
+                                              double       w)
+{
+    if (_forgettingFactor != 1.0)
+    {
+        double f = _forgettingFactor;
+        for (int i = 0; i < _numTerms; i++)
+        {
+            double *row = _XtWX.rowData(i);
+            for (int j = i; j < _numTerms; j++)
+                row[j] *= f;
+            _XtWY[i] *= f;
+        }
+        _sumW *= f;
+        _sumWY *= f;
+        _sumWY2 *= f;
+        _numObservations *= f;
+    }
+    accumulate(x, y, w, 1);
+}
+
+void
+ESLinearRegressionAccumulator::removeObservation(const double x[],
+                                                 double       y,
+                                                 double       w)
+{
+    accumulate(x, y, -w, -1);
+}
+
+bool
+ESLinearRegressionAccumulator::solve(double C[],
+                                     double SEC[],
+                                     double *RYSQ,
+                                     double *SDV)
+{
+    int N = _numTerms;
+    double NDF = _numObservations - N;
+    if (NDF <= 0 || _sumW <= 0)
+    {
+        ESErrorReporter::logError("ESLinearRegressionAccumulator", "NDF (%g) too small (%g sample(s), %d variable(s))", NDF, _numObservations, N);
+        return false;
+    }
+    // Only the upper triangle of X W Xt is read
+    if (!ESLinearRegression::factorCholesky(_XtWX, &_workspace))
+    {
+        ESErrorReporter::logError("ESLinearRegressionAccumulator", "Singular or ill-conditioned least squares matrix");
+        return false;
+    }
+    ESLinearRegression::solveFactored(N, &_workspace.R[0], &_XtWY[0], C);
+
+    // At the solution, the weighted residual sum of squares is sum(W Y^2) - C . X W Y
+    double RSS = _sumWY2;
+    for (int i = 0; i < N; i++)
+        RSS -= C[i] * _XtWY[i];
+    if (RSS < 0)
+        RSS = 0;  // Rounding, for an exact fit
+    double SSQ = RSS / NDF;
+    if (RYSQ)
+    {
+        double TSS = _sumWY2 - _sumWY * _sumWY / _sumW;
+        *RYSQ = 1 - RSS / TSS;
+    }
+    if (SDV)
+        *SDV = sqrt(SSQ);
+    if (SEC)
+    {
+        // The diagonal of SSQ * R^-1 R^-t
+        ESLinearRegression::invertFactor(N, &_workspace);
+        const double *Rinv = &_workspace.Rinv[0];
+        for (int i = 0; i < N; i++)
+        {
+            double t = 0;
+            for (int k = i; k < N; k++)
+                t += Rinv[i * N + k] * Rinv[i * N + k];
+            SEC[i] = sqrt(t * SSQ);
+        }
+    }
+    return true;
+}
+
+// Problems per chunk of a batch: each is only N^2 M flops, so they're handed out in groups
+#define ES_REGRESSION_BATCH_GRAIN 64
+
+/*static*/ bool
+ESLinearRegression::fitArrays(const double Y[],
+                              const double X[],
+                              const double W[],
+                              int          numTerms,
+                              int          numObservations,
+                              bool         computeStandardErrors,
+                              Workspace    *workspace,
+                              double       V[],
+                              double       C[],
+                              double       SEC[],
+                              double       *RYSQ,
+                              double       *SDV,
+                              double       *FReg)
+{
+    int N = numTerms;
+    int M = numObservations;
+    Matrix XM(N, M);
+    for (int i = 0; i < N; i++)
+        memcpy(XM.rowData(i), X + i * M, M * sizeof(double));
+    std::vector<double> ones;
+    if (!W)
+    {
+        ones.assign(M, 1.0);
+        W = &ones[0];
+    }
+    ESLinearRegression fit(Y, XM, W, computeStandardErrors, workspace);
+    if (!fit.valid)
+        return false;
+    if (V)
+        memcpy(V, fit.V.rowData(0), N * N * sizeof(double));
+    memcpy(C, fit.C, N * sizeof(double));
+    if (SEC && computeStandardErrors)
+        memcpy(SEC, fit.SEC, N * sizeof(double));
+    if (RYSQ)
+        *RYSQ = fit.RYSQ;
+    if (SDV)
+        *SDV = fit.SDV;
+    if (FReg)
+        *FReg = fit.FReg;
+    return true;
+}
+
+// Copy problem p's results from contiguous arrays into the batch's
+static void
+storeBatchResults(int                           p,
+                  int                           numProblems,
+                  int                           N,
+                  const double                  C[],
+                  const double                  SEC[],
+                  double                        RYSQ,
+                  double                        SDV,
+                  ESLinearRegressionBatchOutput *output)
+{
+    for (int i = 0; i < N; i++)
+    {
+        output->C[i * numProblems + p] = C[i];
+        if (output->SEC)
+            output->SEC[i * numProblems + p] = SEC[i];
+    }
+    if (output->RYSQ)
+        output->RYSQ[p] = RYSQ;
+    if (output->SDV)
+        output->SDV[p] = SDV;
+}
+
+template <int N>
+static void
+fitBatchRange(long                          begin,
+              long                          end,
+              int                           numProblems,
+              int                           M,
+              const double                  *Y,
+              const double                  *X,
+              const double                  *W,
+              ESLinearRegressionBatchOutput *output)
+{
+    ESLinearRegression::Workspace workspace;  // Only grows if a problem needs the general code
+    for (long p = begin; p < end; p++)
+    {
+        ESLinearRegressionFixed<N> fit(Y + p * M, X + p * N * M, M, W ? W + p * M : NULL, output->SEC != NULL, &workspace);
+        output->valid[p] = fit.valid;
+        if (fit.valid)
+            storeBatchResults((int)p, numProblems, N, fit.C, fit.SEC, fit.RYSQ, fit.SDV, output);
+    }
+}
+
+/*static*/ void
+ESLinearRegression::fitBatch(int                           numProblems,
+                             int                           numTerms,
+                             int                           numObservations,
+                             const double                  *Y,
+                             const double                  *X,
+                             const double                  *W,
+                             ESLinearRegressionBatchOutput *output)
+{
+    int N = numTerms;
+    int M = numObservations;
+    ESAssert(N > 0 && output && output->C && output->valid);
+    if (M - N < 1)
+    {
+        ESErrorReporter::logError("ESLinearRegression", "NDF (%d) too small (%d sample(s), %d variable(s)) for a batch", M - N, M, N);
+        for (int p = 0; p < numProblems; p++)
+            output->valid[p] = false;
+        return;
+    }
+    ESParallel::forRange(0, numProblems, ES_REGRESSION_BATCH_GRAIN, [&](long begin, long end) {
+        switch(N) {
+          case 1: fitBatchRange<1>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 2: fitBatchRange<2>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 3: fitBatchRange<3>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 4: fitBatchRange<4>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 5: fitBatchRange<5>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 6: fitBatchRange<6>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 7: fitBatchRange<7>(begin, end, numProblems, M, Y, X, W, output); break;
+          case 8: fitBatchRange<8>(begin, end, numProblems, M, Y, X, W, output); break;
+          default:
+            {
+                Workspace workspace;
+                std::vector<double> C(N);
+                std::vector<double> SEC(N);
+                double RYSQ;
+                double SDV;
+                for (long p = begin; p < end; p++)
+                {
+                    output->valid[p] = fitArrays(Y + p * M, X + p * N * M, W ? W + p * M : NULL, N, M, output->SEC != NULL,
+                                                 &workspace, NULL, &C[0], &SEC[0], &RYSQ, &SDV, NULL);
+                    if (output->valid[p])
+                        storeBatchResults((int)p, numProblems, N, &C[0], &SEC[0], RYSQ, SDV, output);
+                }
+            }
+            break;
+        }
+    });
+}
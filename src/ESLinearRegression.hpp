@@ -16,6 +16,27 @@
 
 #include "ESErrorReporter.hpp"
 
+#include <type_traits>
+#include <vector>
+
+// Cholesky is abandoned for QR if any term is this nearly a linear combination of the earlier
+// ones: the fraction of its sum of squares left after projecting them out (R(j,j)^2 / V(j,j), which
+// doesn't depend on how the terms are scaled).  Below this, forming X W Xt has already lost more
+// than half the digits, where QR of the observations themselves loses only a quarter.
+#define ES_REGRESSION_MIN_PIVOT_RATIO 1e-8
+
+template <int N> class ESLinearRegressionFixed;
+
+/** Caller-provided buffers for the results of ESLinearRegression::fitBatch, in structure-of-arrays
+ *  layout, so that each result for every problem is contiguous.  Any but C and valid may be NULL. */
+struct ESLinearRegressionBatchOutput {
+    double                  *C;      // numTerms * numProblems: C[i * numProblems + p] is coefficient i of problem p
+    double                  *SEC;    // Std Error of coefficients, laid out like C
+    double                  *RYSQ;   // numProblems
+    double                  *SDV;    // numProblems
+    bool                    *valid;  // numProblems
+};
+
 /** class description */
 class ESLinearRegression {
   public:
@@ -24,13 +45,17 @@ class ESLinearRegression {
                                 Matrix(int rows, int cols);
                                 ~Matrix();                             // Destructor
                                 Matrix(const Matrix& m);               // Copy constructor
+                                Matrix(Matrix&& m);                    // Move constructor; leaves m empty (0 x 0)
 
         Matrix                  &operator= (const Matrix& m);          // Assignment operator
+        Matrix                  &operator= (Matrix&& m);               // Move assignment operator; leaves m empty
 
         double                  &operator() (int row, int col);        // Subscript operator
         double                  operator() (int row, int col) const;   // Subscript operator
         int                     rows() const { return rows_; }
         int                     cols() const { return cols_; }
+        const double            *rowData(int row) const { ESAssert(row >= 0 && row < rows_); return data_ + cols_ * row; }
+        double                  *rowData(int row) { ESAssert(row >= 0 && row < rows_); return data_ + cols_ * row; }
         void                    print() const;
 
       private:
@@ -39,16 +64,83 @@ class ESLinearRegression {
         double* data_;
     };
 
-                            ESLinearRegression(const double Y[],     // observed results
-                                               const Matrix &X,      // row# is variable#, col# is observation#
-                                               const double W[]);    // weights, one per observation (use 1.0 for unweighted)
+    /** A matrix whose dimensions are known at compile time, held inline (on the stack, or in
+     *  its owner) instead of allocated, so loops over it have constant bounds and unroll. */
+    template <int ROWS, int COLS>
+    class FixedMatrix {
+      public:
+        double                  &operator() (int row, int col) { ESAssert(row >= 0 && row < ROWS); ESAssert(col >= 0 && col < COLS); return data_[COLS * row + col]; }
+        double                  operator() (int row, int col) const { ESAssert(row >= 0 && row < ROWS); ESAssert(col >= 0 && col < COLS); return data_[COLS * row + col]; }
+        static constexpr int    rows() { return ROWS; }
+        static constexpr int    cols() { return COLS; }
+        const double            *rowData(int row) const { ESAssert(row >= 0 && row < ROWS); return data_ + COLS * row; }
+        double                  *rowData(int row) { ESAssert(row >= 0 && row < ROWS); return data_ + COLS * row; }
+        void                    setZero() { for (int i = 0; i < ROWS * COLS; i++) data_[i] = 0; }
+
+      private:
+        double                  data_[ROWS * COLS];
+    };
+
+    /** Scratch space for fitting.  Passing the same one to successive fits (of any size) means
+     *  that, once it has grown to fit, a fit allocates no scratch of its own.  Use one per thread. */
+    class Workspace {
+      private:
+        friend class ESLinearRegression;
+        friend class ESLinearRegressionAccumulator;
+
+        std::vector<const double *> rows;      // The rows of X, then Y
+        std::vector<double>     sums;          // The augmented upper triangle of X W Xt, with X W Y as column N
+        std::vector<double>     weighted;      // W * X for the current block of observations
+        std::vector<double>     B;             // X W Y
+        std::vector<double>     R;             // N x N upper triangular factor, Rt R = X W Xt
+        std::vector<double>     QtY;           // The QR fallback's transformed Y, then the solution
+        std::vector<double>     A;             // The QR fallback's sqrt(W) Xt, column-major
+        std::vector<double>     Rinv;          // R inverse, for the covariance
+    };
+
+    /** Fit Y to the rows of X.  The normal equations are solved by Cholesky factorization, or
+     *  if they're too ill-conditioned for that, by QR factorization of the weighted observations.
+     *  If computeStandardErrors is false, SEC is NULL and V is left holding X W Xt instead of the
+     *  covariance, which then isn't computed. */
+                            ESLinearRegression(const double Y[],                   // observed results
+                                               const Matrix &X,                    // row# is variable#, col# is observation#
+                                               const double W[],                   // weights, one per observation (use 1.0 for unweighted)
+                                               bool         computeStandardErrors = true,
+                                               Workspace    *workspace = NULL);    // NULL to use a temporary one
                             ~ESLinearRegression();
 
     static bool             invertInPlaceSymmetricMatrix(Matrix *matrix);
 
+    /** Fit numProblems independent problems with the same numbers of terms and observations, as
+     *  separate ESLinearRegressions would, spreading them across ESParallel's pool.  The problems
+     *  are contiguous: problem p's Y starts at Y + p * numObservations, its X (laid out like a
+     *  Matrix, a row of observations per term) at X + p * numTerms * numObservations, and its W
+     *  (which may be NULL for unweighted fits) at W + p * numObservations.
+     *
+     *  Up to 8 terms, each fit is an ESLinearRegressionFixed for the number of terms, entirely on
+     *  the stack; the rare problem too ill-conditioned for Cholesky is passed on to the general
+     *  code (which allocates).  More terms than that just use the general code throughout. */
+    static void             fitBatch(int                           numProblems,
+                                     int                           numTerms,
+                                     int                           numObservations,
+                                     const double                  *Y,
+                                     const double                  *X,
+                                     const double                  *W,
+                                     ESLinearRegressionBatchOutput *output);
+
+    /** Form the least squares matrix V = X W Xt and the vector B = X W Y in a single pass over the
+     *  observations.  Only the upper triangle of V is computed, then mirrored.  V must be N x N, and B
+     *  must have room for N values, where N = X.rows(). */
+    static void             formNormalEquations(const double Y[],
+                                                const Matrix &X,
+                                                const double W[],
+                                                Matrix       *V,
+                                                double       B[],
+                                                Workspace    *workspace = NULL);
+
     bool                    valid;   // True if linear regression was successful
 
-    Matrix                  V;       // Least squares and var/covar matrix
+    Matrix                  V;       // Var/covar matrix (or least squares matrix, without standard errors)
     double                  *C;      // Coefficients
     double                  *SEC;    // Std Error of coefficients
     double                  RYSQ;    // Multiple correlation coefficient
@@ -56,6 +148,154 @@ class ESLinearRegression {
     double                  FReg;    // Fisher F statistic for regression
     double                  *Ycalc;  // Calculated values of Y
     double                  *DY;     // Residual values of Y
+
+  private:
+    friend class ESLinearRegressionAccumulator;
+    template <int N> friend class ESLinearRegressionFixed;
+
+    // Fit with the general code from X laid out as for fitBatch, copying out whichever results aren't NULL
+    static bool             fitArrays(const double Y[],
+                                      const double X[],
+                                      const double W[],
+                                      int          numTerms,
+                                      int          numObservations,
+                                      bool         computeStandardErrors,
+                                      Workspace    *workspace,
+                                      double       V[],
+                                      double       C[],
+                                      double       SEC[],
+                                      double       *RYSQ,
+                                      double       *SDV,
+                                      double       *FReg);
+
+    static bool             factorCholesky(const Matrix &V,
+                                           Workspace    *workspace);
+    static bool             factorQR(const double Y[],
+                                     const Matrix &X,
+                                     const double W[],
+                                     Workspace    *workspace);
+    static void             invertFactor(int       N,
+                                         Workspace *workspace);
+    static void             formCovariance(double    SSQ,
+                                           Matrix    *V,
+                                           Workspace *workspace);
+
+    // The steps shared by the general code, ESLinearRegressionFixed and the accumulator, on N x N
+    // row-major arrays.  Size is int for the general code, or std::integral_constant<int, N> for
+    // ESLinearRegressionFixed, so that there the bounds are constants and the loops unroll.
+    // Only the upper triangles of V, R and Rinv are read or written.
+    template <class Size>
+    static bool             factorCholesky(Size         N,
+                                           const double *V,   // V = Rt R
+                                           double       *R);
+    template <class Size>
+    static void             solveFactored(Size         N,
+                                          const double *R,
+                                          const double B[],
+                                          double       C[]);  // Solves Rt R C = B
+    template <class Size>
+    static void             invertFactor(Size         N,
+                                         const double *R,
+                                         double       *Rinv);
+    template <class Size>
+    static void             formCovariance(Size         N,
+                                           double       SSQ,
+                                           const double *Rinv,
+                                           double       *V);  // Full matrix: SSQ * R^-1 R^-t
+};
+
+/** The sufficient statistics of a weighted linear regression (X W Xt, X W Y, and the sums of W,
+ *  W Y and W Y^2), kept up to date one observation at a time, so that samples arriving
+ *  continuously can be fitted at any point without keeping them or refitting from scratch.
+ *  Each update is O(N^2) and each solve O(N^3), for N terms, regardless of how many
+ *  observations there have been, and memory use is constant.
+ *
+ *  For a sliding window, remove each observation (with the same values) as it leaves the window.
+ *  For exponential forgetting, give a factor less than 1: before each observation is added, all of
+ *  the earlier ones are down-weighted by that factor.  (An observation removed under forgetting
+ *  must be given the weight it has by then.)  Subtraction accumulates rounding error, so a
+ *  long-running sliding window should be rebuilt from its observations now and then.
+ *
+ *  The normal equations are solved by Cholesky factorization; unlike ESLinearRegression there
+ *  are no observations to fall back to QR with, so a nearly singular system fails instead. */
+class ESLinearRegressionAccumulator {
+  public:
+                            ESLinearRegressionAccumulator(int    numTerms,
+                                                          double forgettingFactor = 1.0);
+
+    int                     numTerms() const { return _numTerms; }
+
+    /** The number of observations, down-weighted by forgetting like their weights */
+    double                  numObservations() const { return _numObservations; }
+
+    double                  forgettingFactor() const { return _forgettingFactor; }
+    void                    setForgettingFactor(double forgettingFactor);
+
+    /** x holds the numTerms values of the independent variables (a column of ESLinearRegression's X) */
+    void                    addObservation(const double x[],
+                                           double       y,
+                                           double       w = 1.0);
+    void                    removeObservation(const double x[],
+                                              double       y,
+                                              double       w = 1.0);
+
+    /** Forget every observation */
+    void                    reset();
+
+    /** Solve for the coefficients C (numTerms of them), and if the pointers aren't NULL, the standard
+     *  errors of the coefficients SEC, the multiple correlation coefficient RYSQ and the standard
+     *  deviation of the errors SDV, as ESLinearRegression would from the same observations.  (With
+     *  forgetting, the degrees of freedom come from numObservations(), the effective number of observations.)
+     *  @return false if there are no more observations than terms, or the terms are (nearly) linearly dependent. */
+    bool                    solve(double C[],
+                                  double SEC[] = NULL,
+                                  double *RYSQ = NULL,
+                                  double *SDV = NULL);
+
+  private:
+    void                    accumulate(const double x[],
+                                       double       y,
+                                       double       w,
+                                       double       count);
+
+    int                     _numTerms;
+    double                  _forgettingFactor;
+    ESLinearRegression::Matrix _XtWX;  // Upper triangle only
+    std::vector<double>     _XtWY;
+    double                  _sumW;
+    double                  _sumWY;
+    double                  _sumWY2;
+    double                  _numObservations;
+    ESLinearRegression::Workspace _workspace;
+};
+
+/** ESLinearRegression for a number of terms N known at compile time, for small fits in inner loops.
+ *  Everything is inline and sized by N, so the fit allocates nothing and its loops over terms
+ *  unroll; only a problem too ill-conditioned for Cholesky goes to the general code (and QR),
+ *  which does allocate.  The results are as ESLinearRegression's, except that Ycalc and DY
+ *  aren't kept, and SEC is only set if computeStandardErrors.
+ *
+ *  X is laid out like an ESLinearRegression::Matrix: N rows of numObservations values. */
+template <int N>
+class ESLinearRegressionFixed {
+  public:
+                            ESLinearRegressionFixed(const double Y[],                   // observed results
+                                                    const double X[],                   // N rows of numObservations
+                                                    int          numObservations,
+                                                    const double W[] = NULL,            // NULL for unweighted
+                                                    bool         computeStandardErrors = true,
+                                                    ESLinearRegression::Workspace *workspace = NULL);  // Only for the fallback
+
+    static constexpr int    numTerms() { return N; }
+
+    bool                    valid;   // True if linear regression was successful
+
+    ESLinearRegression::FixedMatrix<N, N> V;  // Var/covar matrix (or least squares matrix, without standard errors)
+    double                  C[N];    // Coefficients
+    double                  SEC[N];  // Std Error of coefficients
+    double                  RYSQ;    // Multiple correlation coefficient
+    double                  SDV;     // Standard deviation of errors
+    double                  FReg;    // Fisher F statistic for regression
 };
 
 inline
@@ -67,6 +307,17 @@ ESLinearRegression::Matrix::Matrix(int rows, int cols)
     data_ = new double[rows * cols];
 }
 
+inline
+ESLinearRegression::Matrix::Matrix(Matrix&& m)
+:   rows_ (m.rows_),
+    cols_ (m.cols_),
+    data_ (m.data_)
+{
+    m.rows_ = 0;
+    m.cols_ = 0;
+    m.data_ = NULL;
+}
+
 inline
 ESLinearRegression::Matrix::~Matrix()
 {
@@ -90,4 +341,6 @@ ESLinearRegression::Matrix::operator() (int row, int col) const
     return data_[cols_ * row + col];
 }        
 
+#include "ESLinearRegressionInl.hpp"
+
 #endif  // _ESLINEARREGRESSION_HPP_
@@ -0,0 +1,197 @@
+//
+//  ESLinearRegressionInl.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESLINEARREGRESSIONINL_HPP_
+#define _ESLINEARREGRESSIONINL_HPP_
+
+#include <math.h>
+
+// These definitions are inline to avoid portability issues with templates defined in c++ files.
+
+// Factor V = Rt R, where R is upper triangular.
+// Returns false if V isn't (comfortably) positive definite.
+template <class Size>
+inline /*static*/ bool
+ESLinearRegression::factorCholesky(Size         N,
+                                   const double *V,
+                                   double       *R)
+{
+    for (int j = 0; j < N; j++)
+    {
+        double s = V[j * N + j];
+        for (int k = 0; k < j; k++)
+            s -= R[k * N + j] * R[k * N + j];
+        if (!(s > ES_REGRESSION_MIN_PIVOT_RATIO * V[j * N + j]))  // Also catches NaN
+            return false;
+        double Rjj = sqrt(s);
+        R[j * N + j] = Rjj;
+        for (int i = j + 1; i < N; i++)
+        {
+            double t = V[j * N + i];
+            for (int k = 0; k < j; k++)
+                t -= R[k * N + j] * R[k * N + i];
+            R[j * N + i] = t / Rjj;
+        }
+    }
+    return true;
+}
+
+template <class Size>
+inline /*static*/ void
+ESLinearRegression::solveFactored(Size         N,
+                                  const double *R,
+                                  const double B[],
+                                  double       C[])
+{
+    for (int i = 0; i < N; i++)      // Rt Z = B
+    {
+        double t = B[i];
+        for (int k = 0; k < i; k++)
+            t -= R[k * N + i] * C[k];
+        C[i] = t / R[i * N + i];
+    }
+    for (int i = N - 1; i >= 0; i--) // R C = Z
+    {
+        double t = C[i];
+        for (int k = i + 1; k < N; k++)
+            t -= R[i * N + k] * C[k];
+        C[i] = t / R[i * N + i];
+    }
+}
+
+template <class Size>
+inline /*static*/ void
+ESLinearRegression::invertFactor(Size         N,
+                                 const double *R,
+                                 double       *Rinv)
+{
+    for (int j = N - 1; j >= 0; j--)
+    {
+        Rinv[j * N + j] = 1 / R[j * N + j];
+        for (int i = j - 1; i >= 0; i--)
+        {
+            double t = 0;
+            for (int k = i + 1; k <= j; k++)
+                t += R[i * N + k] * Rinv[k * N + j];
+            Rinv[i * N + j] = -t / R[i * N + i];
+        }
+    }
+}
+
+template <class Size>
+inline /*static*/ void
+ESLinearRegression::formCovariance(Size         N,
+                                   double       SSQ,
+                                   const double *Rinv,
+                                   double       *V)
+{
+    for (int i = 0; i < N; i++)
+    {
+        for (int j = i; j < N; j++)
+        {
+            double t = 0;
+            for (int k = j; k < N; k++)
+                t += Rinv[i * N + k] * Rinv[j * N + k];
+            V[i * N + j] = V[j * N + i] = t * SSQ;
+        }
+    }
+}
+
+// The same steps as the ESLinearRegression constructor, with N a constant
+template <int N>
+inline
+ESLinearRegressionFixed<N>::ESLinearRegressionFixed(const double Y[],
+                                                    const double X[],
+                                                    int          numObservations,
+                                                    const double W[],
+                                                    bool         computeStandardErrors,
+                                                    ESLinearRegression::Workspace *workspace)
+{
+    int M = numObservations;
+    int NDF = M - N;
+    if (NDF < 1)
+    {
+        ESErrorReporter::logError("ESLinearRegression", "NDF (%d) too small (%d sample(s), %d variable(s))", NDF, M, N);
+        valid = false;
+        return;
+    }
+
+    // Form the upper triangle of X W Xt, and X W Y
+    double B[N];
+    V.setZero();
+    for (int i = 0; i < N; i++)
+        B[i] = 0;
+    double WSUM = 0;
+    double YBAR = 0;
+    for (int k = 0; k < M; k++)
+    {
+        double w = W ? W[k] : 1.0;
+        double x[N];
+        for (int i = 0; i < N; i++)
+            x[i] = X[i * M + k];
+        for (int i = 0; i < N; i++)
+        {
+            double wx = w * x[i];
+            for (int j = i; j < N; j++)
+                V(i, j) += wx * x[j];
+            B[i] += wx * Y[k];
+        }
+        WSUM += w;
+        YBAR += w * Y[k];
+    }
+    YBAR = YBAR / WSUM;
+
+    // Solve V C = B by factoring V = Rt R, as the general code does
+    std::integral_constant<int, N> size;
+    ESLinearRegression::FixedMatrix<N, N> R;
+    if (!ESLinearRegression::factorCholesky(size, V.rowData(0), R.rowData(0)))
+    {
+        ESLogDebug("ESLinearRegression", "Ill-conditioned least squares matrix; using QR");
+        valid = ESLinearRegression::fitArrays(Y, X, W, N, M, computeStandardErrors, workspace,
+                                              V.rowData(0), C, SEC, &RYSQ, &SDV, &FReg);
+        return;
+    }
+    ESLinearRegression::solveFactored(size, R.rowData(0), B, C);
+
+    // Calculate statistics
+    double TSS = 0;
+    double RSS = 0;
+    for (int k = 0; k < M; k++)
+    {
+        double w = W ? W[k] : 1.0;
+        double Ycalc = 0;
+        for (int i = 0; i < N; i++)
+            Ycalc += C[i] * X[i * M + k];
+        double DY = Ycalc - Y[k];
+        TSS += w * (Y[k] - YBAR) * (Y[k] - YBAR);
+        RSS += w * DY * DY;
+    }
+    double SSQ = RSS / NDF;
+    RYSQ = 1 - RSS / TSS;
+    FReg = 9999999;
+    if (RYSQ < 0.9999999)
+        FReg = RYSQ / (1 - RYSQ) * NDF / (N - 1);
+    SDV = sqrt(SSQ);
+
+    // Calculate var-covar matrix (SSQ R^-1 R^-t) and std error of coefficients
+    if (computeStandardErrors)
+    {
+        ESLinearRegression::FixedMatrix<N, N> Rinv;
+        ESLinearRegression::invertFactor(size, R.rowData(0), Rinv.rowData(0));
+        ESLinearRegression::formCovariance(size, SSQ, Rinv.rowData(0), V.rowData(0));
+        for (int i = 0; i < N; i++)
+            SEC[i] = sqrt(V(i, i));
+    }
+    else
+    {
+        for (int i = 0; i < N; i++)
+            for (int j = 0; j < i; j++)
+                V(i, j) = V(j, i);
+    }
+    valid = true;
+}
+
+#endif  // _ESLINEARREGRESSIONINL_HPP_
@@ -8,8 +8,6 @@
 #include "ESNameResolver.hpp"
 #include "ESThread.hpp"
 #include "ESErrorReporter.hpp"
-#undef ESTRACE
-#include "ESTrace.hpp"
 
 class ESNameResolverThread : public ESChildThread {
   public:
@@ -55,9 +53,10 @@ ESNameResolver::ESNameResolver(ESNameResolverObserver *observer,
     _hints.ai_canonname = NULL;
     _hints.ai_next = NULL;
     _notificationThread = ESThread::currentThread();
-    tracePrintf1("will start thread resolve(%s)", name.c_str());
+    ESLogDebug("ESNameResolver", "will start thread resolve(%s)", name.c_str());
     _resolverThread = new ESNameResolverThread(this);
-    tracePrintf3("ESNameResolver ctor of 0x%08x created thread 0x%08x whose parent thread is 0x%08x\n", (unsigned long int)this, (unsigned long int)_resolverThread, (unsigned long int)_resolverThread->parentThread());
+    ESLogDebug("ESNameResolver", "ctor of %p created thread %p whose parent thread is %p",
+               this, _resolverThread, _resolverThread->parentThread());
     _resolverThread->start();
 }
 
@@ -70,9 +69,9 @@ ESNameResolver::~ESNameResolver() {
 void *
 ESNameResolver::threadMain() {
     ESAssert(_resolverThread->inThisThread());
-    tracePrintf1("will call getaddrinfo(%s)", _requestedName.c_str());
+    ESLogDebug("ESNameResolver", "will call getaddrinfo(%s)", _requestedName.c_str());
     int st = getaddrinfo(_requestedName.c_str(), _portAsString.c_str(), &_hints, &_result0);
-    tracePrintf2("back from getaddrinfo(%s), st %d", _requestedName.c_str(), st);
+    ESLogDebug("ESNameResolver", "back from getaddrinfo(%s), st %d", _requestedName.c_str(), st);
     if (st == 0) {
         deliverNotifyNameResolutionComplete();
     } else {
@@ -83,7 +82,7 @@ ESNameResolver::threadMain() {
 
 void 
 ESNameResolver::release() {
-    tracePrintf2("release of resolver 0x%08x asserting we're in the thread 0x%08x\n", (unsigned long int)this, (unsigned long int)_notificationThread);
+    ESLogDebug("ESNameResolver", "release of resolver %p asserting we're in the thread %p", this, _notificationThread);
     ESAssert(_notificationThread->inThisThread());
     _released = true;
     if (_readyForDelete) {
@@ -97,11 +96,11 @@ ESNameResolver::resolutionCompleteGlue(void *obj,
     ESNameResolver *resolver = (ESNameResolver *)obj;
     ESAssert(resolver->_notificationThread->inThisThread());
     if (resolver->_released) {
-        tracePrintf1("no delivery for released resolver(%s)", resolver->requestedName().c_str());
+        ESLogDebug("ESNameResolver", "no delivery for released resolver(%s)", resolver->requestedName().c_str());
         resolver->_readyForDelete = true;
         delete resolver;
     } else {
-        tracePrintf1("will notify good resolve(%s)", resolver->requestedName().c_str());
+        ESLogDebug("ESNameResolver", "will notify good resolve(%s)", resolver->requestedName().c_str());
         resolver->_observer->notifyNameResolutionComplete(resolver);
         resolver->_readyForDelete = true;
     }
@@ -110,7 +109,7 @@ ESNameResolver::resolutionCompleteGlue(void *obj,
 void 
 ESNameResolver::deliverNotifyNameResolutionComplete() {
     ESAssert(_resolverThread->inThisThread());
-    tracePrintf1("will notify good resolve(%s)", _requestedName.c_str());
+    ESLogDebug("ESNameResolver", "will notify good resolve(%s)", _requestedName.c_str());
     _notificationThread->callInThread(resolutionCompleteGlue, this, NULL);
 }
 
@@ -121,11 +120,11 @@ ESNameResolver::resolutionFailedGlue(void *obj,
     ESAssert(resolver->_notificationThread->inThisThread());
     int failureStatus = (int)(ESPointerSizedInt)param;
     if (resolver->_released) {
-        tracePrintf1("no FAILED delivery for released resolver(%s)", resolver->requestedName().c_str());
+        ESLogDebug("ESNameResolver", "no FAILED delivery for released resolver(%s)", resolver->requestedName().c_str());
         resolver->_readyForDelete = true;
         delete resolver;
     } else {
-        tracePrintf1("will notify FAILED resolve(%s)", resolver->requestedName().c_str());
+        ESLogDebug("ESNameResolver", "will notify FAILED resolve(%s)", resolver->requestedName().c_str());
         resolver->_observer->notifyNameResolutionFailed(resolver, failureStatus);
         resolver->_readyForDelete = true;
     }
@@ -134,7 +133,7 @@ ESNameResolver::resolutionFailedGlue(void *obj,
 void 
 ESNameResolver::deliverNotifyNameResolutionFailed(int status) {
     ESAssert(_resolverThread->inThisThread());
-    tracePrintf1("will notify FAILED resolve(%s)", _requestedName.c_str());
+    ESLogDebug("ESNameResolver", "will notify FAILED resolve(%s)", _requestedName.c_str());
     _notificationThread->callInThread(resolutionFailedGlue, this, (void*)(long)status);
 }
 
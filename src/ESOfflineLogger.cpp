@@ -8,137 +8,516 @@
 #include "ESOfflineLogger.hpp"
 
 #include "ESErrorReporter.hpp"
+#include "ESBinaryLog.hpp"
 #include "ESThread.hpp"
 #include "ESFile.hpp"
 #include "ESUtil.hpp"
+#include "ESLock.hpp"
+#include "ESThreadLocalStorage.hpp"
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <time.h> 
 #include <unistd.h>
 
+#include <atomic>
+
+// Producers don't talk to the worker thread per line.  Each thread which logs gets its own
+// single-producer/single-consumer ring of raw records (timestamp, length, text), found through
+// thread-local storage; the worker drains every ring, merging them in timestamp order, formats
+// the timestamps, and writes the result with as few write calls as the staging buffer allows.
+//
+// A producer only sends the worker a message when no drain is already scheduled, so under
+// chatty logging that's once per drain rather than once per line, and the worker's mailbox
+// transport makes the send itself a lock-free push (plus a wakeup if the worker was idle).
+
+#define OFFLINE_LOG_MAX_LINE      8192         // Longer lines are truncated
+#define OFFLINE_LOG_STAGING_SIZE  (64 * 1024)  // Formatted lines are written out in chunks of at most this size
+#define OFFLINE_LOG_MIN_RING_SIZE (16 * 1024)
+
+struct ESOfflineLogRecordHeader {
+    uint64_t                timestamp;  // Microseconds since the epoch
+    uint32_t                length;     // Of the text which follows (unterminated)
+    uint32_t                kind;       // ESOfflineLogRecordKind
+};
+
+enum ESOfflineLogRecordKind {
+    ESOfflineLogRecordText,
+    ESOfflineLogRecordBinary   // An ESBinaryLog record, written to the binary log as is
+};
+
+class ESOfflineLogRing {
+  public:
+                            ESOfflineLogRing(size_t capacity);
+                            ~ESOfflineLogRing();
+
+    // Producer side
+    bool                    tryPush(uint64_t               timestamp,
+                                    ESOfflineLogRecordKind kind,
+                                    const char             *text,
+                                    size_t                 length);
+
+    // Consumer side
+    bool                    peekTimestamp(uint64_t *timestamp);
+    size_t                  pop(char                   *text,  // Must have room for OFFLINE_LOG_MAX_LINE; returns the length
+                                ESOfflineLogRecordKind *kind);
+
+    ESOfflineLogRing        *next;         // In the list of all rings
+    std::atomic<unsigned>   droppedLines;  // Since the worker last reported them
+
+  private:
+    static size_t           recordSize(size_t length) { return sizeof(ESOfflineLogRecordHeader) + ((length + 7) & ~(size_t)7); }
+    void                    copyIn(size_t     position,
+                                   const void *src,
+                                   size_t     length);
+    void                    copyOut(size_t position,
+                                    void   *dst,
+                                    size_t length) const;
+
+    char                    *_buffer;
+    size_t                  _capacity;  // A power of two
+    std::atomic<size_t>     _head;      // Total bytes ever pushed; only the producer writes this
+    std::atomic<size_t>     _tail;      // Total bytes ever popped; only the consumer writes this
+};
+
+ESOfflineLogRing::ESOfflineLogRing(size_t capacity)
+:   next(NULL),
+    droppedLines(0),
+    _capacity(capacity),
+    _head(0),
+    _tail(0)
+{
+    ESAssert((capacity & (capacity - 1)) == 0);
+    _buffer = new char[capacity];
+}
+
+ESOfflineLogRing::~ESOfflineLogRing() {
+    delete [] _buffer;
+}
+
+void
+ESOfflineLogRing::copyIn(size_t     position,
+                         const void *src,
+                         size_t     length) {
+    size_t offset = position & (_capacity - 1);
+    size_t firstPart = _capacity - offset;
+    if (firstPart >= length) {
+        memcpy(_buffer + offset, src, length);
+    } else {
+        memcpy(_buffer + offset, src, firstPart);
+        memcpy(_buffer, (const char *)src + firstPart, length - firstPart);
+    }
+}
+
+void
+ESOfflineLogRing::copyOut(size_t position,
+                          void   *dst,
+                          size_t length) const {
+    size_t offset = position & (_capacity - 1);
+    size_t firstPart = _capacity - offset;
+    if (firstPart >= length) {
+        memcpy(dst, _buffer + offset, length);
+    } else {
+        memcpy(dst, _buffer + offset, firstPart);
+        memcpy((char *)dst + firstPart, _buffer, length - firstPart);
+    }
+}
+
+bool
+ESOfflineLogRing::tryPush(uint64_t               timestamp,
+                          ESOfflineLogRecordKind kind,
+                          const char             *text,
+                          size_t                 length) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    size_t needed = recordSize(length);
+    if (_capacity - (head - tail) < needed) {
+        return false;
+    }
+    ESOfflineLogRecordHeader header;
+    header.timestamp = timestamp;
+    header.length = (uint32_t)length;
+    header.kind = kind;
+    copyIn(head, &header, sizeof(header));
+    copyIn(head + sizeof(header), text, length);
+    _head.store(head + needed, std::memory_order_release);
+    return true;
+}
+
+bool
+ESOfflineLogRing::peekTimestamp(uint64_t *timestamp) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    copyOut(tail, timestamp, sizeof(uint64_t));
+    return true;
+}
+
+size_t
+ESOfflineLogRing::pop(char                   *text,
+                      ESOfflineLogRecordKind *kind) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    ESAssert(tail != _head.load(std::memory_order_acquire));
+    ESOfflineLogRecordHeader header;
+    copyOut(tail, &header, sizeof(header));
+    copyOut(tail + sizeof(header), text, header.length);
+    *kind = (ESOfflineLogRecordKind)header.kind;
+    _tail.store(tail + recordSize(header.length), std::memory_order_release);
+    return header.length;
+}
+
 static ESSimpleWorkerThread *workerThread = NULL;
 
-static const char *OFFLINE_LOG_NAME = "OfflineLog.txt";
-static const char *PREV_OFFLINE_LOG_NAME = "OfflineLog-previous.txt";
-static std::string offlineLogPathName;
 static const off_t MAX_LOG_SIZE (25000000);
 
-// Once each session, check the size of the offline log and rename if it's too big.
-static void checkRename(void *object, void *param) {
-    struct stat st;
-    if(stat(offlineLogPathName.c_str(), &st) == 0) {
-        if (st.st_size > MAX_LOG_SIZE) {
-            // File is large, do rename.
-            std::string prevName = ESFile::documentDirectory() + "/" + PREV_OFFLINE_LOG_NAME;
-            if (unlink(prevName.c_str()) != 0) {
-                if (errno != ENOENT) {
-                    ESErrorReporter::checkAndLogSystemError("OfflineLogger init", errno, 
-                                                            ESUtil::stringWithFormat("Trouble removing prev file '%s'", 
-                                                                                     prevName.c_str()).c_str());
-                }   
-            }
-            if (rename(offlineLogPathName.c_str(), prevName.c_str()) != 0) {
-                ESErrorReporter::checkAndLogSystemError("OfflineLogger init", errno, 
-                                                        ESUtil::stringWithFormat("Trouble renaming '%s' to '%s'", 
-                                                                                 offlineLogPathName.c_str(), 
-                                                                                 prevName.c_str()).c_str());
-            }
-            ESErrorReporter::logInfo("OfflineLogger init", ESUtil::stringWithFormat("Renamed log to '%s'", 
-                                                                                    prevName.c_str()).c_str());
-        } else {
-            ESErrorReporter::logInfo("OfflineLogger init", "Offline log exists but small enough, ignoring");
+// One of the files we write: the text log, or the binary log (if ESErrorReporter has been given
+// our binary log writer).  Only touched in the worker thread, once initialize() has set up the
+// path and staging buffer.
+struct ESOfflineLogFile {
+                            ESOfflineLogFile(const char *name,
+                                             const char *prevName,
+                                             bool       isBinary)
+    :   name(name),
+        prevName(prevName),
+        isBinary(isBinary),
+        fd(-1),
+        size(0),
+        stagingLength(0),
+        staging(NULL)
+    {}
+
+    const char              *name;
+    const char              *prevName;
+    bool                    isBinary;
+    std::string             path;
+    int                     fd;
+    off_t                   size;
+    size_t                  stagingLength;
+    char                    *staging;   // OFFLINE_LOG_STAGING_SIZE bytes
+};
+
+static ESOfflineLogFile textLog("OfflineLog.txt", "OfflineLog-previous.txt", false/*isBinary*/);
+static ESOfflineLogFile binaryLog("OfflineLog.bin", "OfflineLog-previous.bin", true/*isBinary*/);
+
+static size_t ringSize = 0;
+static ESOfflineLoggerOverflowPolicy overflowPolicy = ESOfflineLoggerDropWhenFull;
+static std::atomic<ESOfflineLogRing *> allRings(NULL);  // Rings are never removed, so the worker can walk this without a lock
+static ESLock ringRegistrationLock;
+static ESThreadLocalStoragePtr<ESOfflineLogRing> ringForThisThread;
+static std::atomic<bool> drainScheduled(false);
+static bool draining = false;  // Worker thread only
+
+// With ESOfflineLoggerBlockWhenFull, a producer whose ring is full waits on this, and the worker
+// broadcasts it after each pass through the rings.  The producer retries its push with the mutex
+// held, and the worker takes the mutex before broadcasting, so a pass which frees space either
+// finishes before the retry (which then sees the space) or wakes the waiting producer.
+static pthread_mutex_t spaceFreedMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t spaceFreed = PTHREAD_COND_INITIALIZER;
+
+// Move the current log aside (replacing any previous one), so that the next write starts a new one.
+static void rotateLog(ESOfflineLogFile &log) {
+    if (log.fd >= 0) {
+        if (close(log.fd) != 0) {
+            ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::rotateLog", errno, "errno from file close");
         }
-    } else {  // trouble reading file.  Check why
+        log.fd = -1;
+    }
+    std::string prevName = ESFile::documentDirectory() + "/" + log.prevName;
+    if (unlink(prevName.c_str()) != 0) {
         if (errno != ENOENT) {
-            ESErrorReporter::checkAndLogSystemError("OfflineLogger init", errno, 
-                                                    ESUtil::stringWithFormat("Trouble reading log file '%s'", 
-                                                                             offlineLogPathName.c_str()).c_str());
-        } else {
-            ESErrorReporter::logInfo("OfflineLogger init", "Offline log doesn't exist");
-        }
+            ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::rotateLog", errno, 
+                                                    ESUtil::stringWithFormat("Trouble removing prev file '%s'", 
+                                                                             prevName.c_str()).c_str());
+        }   
     }
+    if (rename(log.path.c_str(), prevName.c_str()) != 0) {
+        ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::rotateLog", errno, 
+                                                ESUtil::stringWithFormat("Trouble renaming '%s' to '%s'", 
+                                                                         log.path.c_str(), 
+                                                                         prevName.c_str()).c_str());
+    }
+    ESErrorReporter::logInfo("ESOfflineLogger::rotateLog", "Renamed log to '%s'", log.prevName);
 }
 
-#define ENABLE_OFFLINE_LOGGER 0
+// Append to the open log, retrying short writes.  Returns false on failure.
+static bool writeToLog(ESOfflineLogFile &log,
+                       const char       *ptr,
+                       size_t           length) {
+    if (!ESFile::writeFully(log.fd, ptr, length)) {
+        ESErrorReporter::logError("ESOfflineLogger", "Failed to write %d bytes to fd %d", (int)length, log.fd);
+        ESErrorReporter::checkAndLogSystemError("ESOfflineLogger", errno, "errno from file write");
+        return false;
+    }
+    log.size += length;
+    return true;
+}
 
-/*static*/ void 
-ESOfflineLogger::initialize() {
-#if ENABLE_OFFLINE_LOGGER
-    ESAssert(!workerThread);
-    offlineLogPathName = ESFile::documentDirectory() + "/" + OFFLINE_LOG_NAME;
-    // ESErrorReporter::logInfo("ESOfflineLogger::initialize", "log path name %s", offlineLogPathName.c_str());
-    workerThread = new ESSimpleWorkerThread("ESOfflineLogger", ESChildThreadExitsOnlyByParentRequest);
-    workerThread->start();
-    workerThread->callInThread(checkRename, NULL, NULL);
-#endif
+// Open the log for append if it isn't already, rotating first if it's too big.  Returns false on failure.
+// A new binary log starts with every format seen so far, since records still in the rings or the
+// staging buffer may have had theirs written to the old file.
+static bool openLogIfNecessary(ESOfflineLogFile &log) {
+    ESAssert(workerThread->inThisThread());
+    if (log.fd >= 0) {
+        return true;
+    }
+    for (int attempt = 0; attempt < 2; attempt++) {
+        log.fd = open(log.path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+        if (log.fd < 0) {
+            ESErrorReporter::logError("ESOfflineLogger", "Couldn't append to offline log file '%s'", log.path.c_str());
+            ESErrorReporter::checkAndLogSystemError("ESOfflineLogger", errno, "errno from file append");
+            return false;
+        }
+        struct stat st;
+        log.size = (fstat(log.fd, &st) == 0) ? st.st_size : 0;
+        if (log.size <= MAX_LOG_SIZE) {
+            if (log.isBinary && log.size == 0) {
+                std::string formatRecords;
+                ESBinaryLog::appendAllFormatRecords(&formatRecords);
+                writeToLog(log, formatRecords.data(), formatRecords.size());
+            }
+            return true;
+        }
+        rotateLog(log);
+    }
+    return log.fd >= 0;
+}
+
+// Once each session, open the log (renaming it first if it's too big).
+static void checkRename(void *object, void *param) {
+    openLogIfNecessary(textLog);
 }
 
-static void doLog(const char *text) {
+// Write out the staging buffer, then rotate if we've crossed the limit.
+static void flushStaging(ESOfflineLogFile &log) {
     ESAssert(workerThread);
     ESAssert(workerThread->inThisThread());
-    int fd = open(offlineLogPathName.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
-    if (fd < 0) {
-        ESErrorReporter::logError("ESOfflineLogger::doLog", "Couldn't append to offline log file '%s'", offlineLogPathName.c_str());
-        ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::doLog", errno, "errno from file append");
+    if (log.stagingLength == 0) {
+        return;
     }
-    // ESErrorReporter::logInfo("ESOfflineLogger::doLog", "opened file for append, fd %d", fd);
-    size_t length = strlen(text);
-    ssize_t written = write(fd, text, length);
-    if (written != length) {
-        ESErrorReporter::logError("ESOfflineLogger::doLog", "Wrote %d instead of expected %d bytes to fd %d", (int)written, (int)length, fd);
-        ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::doLog", errno, "errno from file write");
+    if (openLogIfNecessary(log)) {
+        writeToLog(log, log.staging, log.stagingLength);
+        if (log.size > MAX_LOG_SIZE) {
+            rotateLog(log);  // The next write reopens
+        }
     }
-    if (close(fd) != 0) {
-        ESErrorReporter::logError("ESOfflineLogger::doLog", "Close of fd %d failed", fd);
-        ESErrorReporter::checkAndLogSystemError("ESOfflineLogger::doLog", errno, "errno from file close");
+    log.stagingLength = 0;
+}
+
+// Format "MM-DD HH:MM:SS.mmm <text>\n" into the text log's staging buffer, flushing it first if necessary.
+static void stageLine(uint64_t   timestamp,
+                      const char *text,
+                      size_t     length) {
+    // localtime_r and strftime are comparatively slow, and most lines share a second with the one before
+    static time_t prefixSecond = -1;
+    static char prefix[32];
+    static size_t prefixLength;
+    time_t second = (time_t)(timestamp / 1000000);
+    if (second != prefixSecond) {
+        struct tm tm;
+        localtime_r(&second, &tm);
+        prefixLength = strftime(prefix, sizeof prefix, "%m-%d %H:%M:%S", &tm);
+        prefixSecond = second;
     }
+    if (length > 0 && text[length - 1] == '\n') {
+        length--;  // We add our own
+    }
+    size_t needed = prefixLength + 5 + length + 1;
+    if (textLog.stagingLength + needed > OFFLINE_LOG_STAGING_SIZE) {
+        flushStaging(textLog);
+    }
+    char *dst = textLog.staging + textLog.stagingLength;
+    memcpy(dst, prefix, prefixLength);
+    dst += prefixLength;
+    unsigned int millis = (unsigned int)((timestamp / 1000) % 1000);
+    *dst++ = '.';
+    *dst++ = '0' + millis / 100;
+    *dst++ = '0' + (millis / 10) % 10;
+    *dst++ = '0' + millis % 10;
+    *dst++ = ' ';
+    memcpy(dst, text, length);
+    dst += length;
+    *dst++ = '\n';
+    textLog.stagingLength = dst - textLog.staging;
 }
 
-static void logGlue(void *object, void *param) {
-    char *txt = static_cast<char *>(object);
-    doLog(txt);
+// Binary records are already encoded; just copy them.
+static void stageBinaryRecord(const char *record,
+                              size_t     length) {
+    if (binaryLog.stagingLength + length > OFFLINE_LOG_STAGING_SIZE) {
+        flushStaging(binaryLog);
+    }
+    memcpy(binaryLog.staging + binaryLog.stagingLength, record, length);
+    binaryLog.stagingLength += length;
+}
+
+// Empty every ring, oldest record first, and write it all out.  Returns false if there was nothing to do.
+static bool drainOnce() {
+    static char text[OFFLINE_LOG_MAX_LINE];
+    bool foundAny = false;
+    while (true) {
+        ESOfflineLogRing *oldestRing = NULL;
+        uint64_t oldestTimestamp = 0;
+        for (ESOfflineLogRing *ring = allRings.load(); ring; ring = ring->next) {
+            uint64_t timestamp;
+            if (ring->peekTimestamp(&timestamp) && (!oldestRing || timestamp < oldestTimestamp)) {
+                oldestRing = ring;
+                oldestTimestamp = timestamp;
+            }
+        }
+        if (!oldestRing) {
+            break;
+        }
+        foundAny = true;
+        ESOfflineLogRecordKind kind;
+        size_t length = oldestRing->pop(text, &kind);
+        if (kind == ESOfflineLogRecordBinary) {
+            stageBinaryRecord(text, length);
+        } else {
+            stageLine(oldestTimestamp, text, length);
+        }
+    }
+    for (ESOfflineLogRing *ring = allRings.load(); ring; ring = ring->next) {
+        unsigned int dropped = ring->droppedLines.exchange(0);
+        if (dropped) {
+            foundAny = true;
+            char note[64];
+            int noteLength = snprintf(note, sizeof note, "[%u lines dropped: log ring full]", dropped);
+            struct timeval tv;
+            gettimeofday(&tv, NULL);
+            stageLine((uint64_t)tv.tv_sec * 1000000 + tv.tv_usec, note, noteLength);
+        }
+    }
+    flushStaging(textLog);
+    flushStaging(binaryLog);
+    return foundAny;
+}
 
-    // Delete the copy that was created in ESOfflineLogger::log().
-    delete [] txt;
+static void drainGlue(void *object, void *param) {
+    ESAssert(workerThread->inThisThread());
+    // Clear this first, so that anything pushed from now on schedules another drain
+    drainScheduled.store(false);
+    draining = true;
+    while (drainOnce()) {
+        // Again, in case writing logged something (e.g., an error or a rotation)
+        if (overflowPolicy == ESOfflineLoggerBlockWhenFull) {
+            pthread_mutex_lock(&spaceFreedMutex);
+            pthread_cond_broadcast(&spaceFreed);
+            pthread_mutex_unlock(&spaceFreedMutex);
+        }
+    }
+    draining = false;
 }
 
-/*static*/ void 
-ESOfflineLogger::log(const std::string &txt) {
-#if ENABLE_OFFLINE_LOGGER
+static void scheduleDrain() {
+    if (!drainScheduled.load(std::memory_order_relaxed) && !drainScheduled.exchange(true)) {
+        workerThread->callInThread(drainGlue, NULL, NULL);
+    }
+}
+
+// Pushes the record onto this thread's ring, and makes sure the worker will see it.
+static void pushRecord(ESOfflineLogRecordKind kind,
+                       const char             *data,
+                       size_t                 length) {
     ESAssert(workerThread);
 
+    // Record the time in the calling thread; the worker formats it later.
     struct timeval tv;
     gettimeofday(&tv, NULL);
+    uint64_t timestamp = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
 
-    struct tm tm;
-    localtime_r(&tv.tv_sec, &tm);
+    ESOfflineLogRing *ring = ringForThisThread;
+    if (!ring) {
+        // The only allocation, once per thread.  Rings are kept for the life of the process,
+        // since we can't tell when a thread which isn't an ESThread goes away.
+        ring = new ESOfflineLogRing(ringSize);
+        ringRegistrationLock.lock();
+        ring->next = allRings.load();
+        allRings.store(ring);
+        ringRegistrationLock.unlock();
+        ringForThisThread = ring;
+    }
+    if (length > OFFLINE_LOG_MAX_LINE) {
+        ESAssert(kind == ESOfflineLogRecordText);  // Binary records are always smaller than this
+        length = OFFLINE_LOG_MAX_LINE;
+    }
+    bool inWorker = workerThread->inThisThread();
+    if (!ring->tryPush(timestamp, kind, data, length)) {
+        if (overflowPolicy == ESOfflineLoggerDropWhenFull || inWorker) {  // The worker can't wait for itself
+            ring->droppedLines++;
+            return;
+        }
+        pthread_mutex_lock(&spaceFreedMutex);
+        while (!ring->tryPush(timestamp, kind, data, length)) {
+            scheduleDrain();  // If one is already scheduled or running, it will broadcast when it's done
+            pthread_cond_wait(&spaceFreed, &spaceFreedMutex);
+        }
+        pthread_mutex_unlock(&spaceFreedMutex);
+    }
+    if (!inWorker) {
+        scheduleDrain();
+    } else if (!draining && !drainScheduled.exchange(true)) {
+        drainGlue(NULL, NULL);  // Logged by something else running in the worker; write it out now
+    }
+}
 
-    // Make a copy of the string.  We have to anyway, and this lets us record the time in the
-    // calling thread before sending to the subthread (and add a trailing newline, if necessary).
+class ESOfflineBinaryLogWriter : public ESBinaryLogWriter {
+  public:
+    /*virtual*/ void        writeBinaryLogRecord(const void *record,
+                                                 size_t     length) {
+        pushRecord(ESOfflineLogRecordBinary, (const char *)record, length);
+    }
+};
 
-    // First create the format string we're going to use to create 'buf', by running strftime
-    // on formatFormat:
-    static const char formatFormat[] = "%m-%d %H:%M:%S.%%03u";
-    char format[64];
-    strftime(format, sizeof format, formatFormat, &tm);
+static ESOfflineBinaryLogWriter offlineBinaryLogWriter;
 
-    // Now 'format' contains the string we can append the milliseconds to:
-    size_t buflen = txt.length() + 32;  // conservative
-    char *buf = new char[buflen + 1];  // allocated on heap, because we're passing to another thread
-    snprintf(buf, buflen, format, tv.tv_usec / 1000);
+#define ENABLE_OFFLINE_LOGGER 0
 
-    strcat(buf, " ");
-    strcat(buf, txt.c_str());
-    int len = strlen(buf);
-    if (buf[len - 1] != '\n') {
-        buf[len] = '\n';
-        buf[len + 1] = '\0';
+/*static*/ void 
+ESOfflineLogger::initialize(size_t                        ringBytesPerThread,
+                            ESOfflineLoggerOverflowPolicy policy) {
+#if ENABLE_OFFLINE_LOGGER
+    ESAssert(!workerThread);
+    ringSize = OFFLINE_LOG_MIN_RING_SIZE;
+    while (ringSize < ringBytesPerThread) {
+        ringSize *= 2;
     }
-    workerThread->callInThread(logGlue, buf, NULL);
+    overflowPolicy = policy;
+    textLog.path = ESFile::documentDirectory() + "/" + textLog.name;
+    binaryLog.path = ESFile::documentDirectory() + "/" + binaryLog.name;
+    textLog.staging = new char[OFFLINE_LOG_STAGING_SIZE];
+    binaryLog.staging = new char[OFFLINE_LOG_STAGING_SIZE];
+    // ESErrorReporter::logInfo("ESOfflineLogger::initialize", "log path name %s", textLog.path.c_str());
+    workerThread = new ESSimpleWorkerThread("ESOfflineLogger", ESChildThreadExitsOnlyByParentRequest, ESInterThreadTransportMailbox);
+    workerThread->start();
+    workerThread->callInThread(checkRename, NULL, NULL);
+#endif
+}
+
+/*static*/ void 
+ESOfflineLogger::log(const std::string &txt) {
+    log(txt.c_str(), txt.length());
+}
+
+/*static*/ void 
+ESOfflineLogger::log(const char *txt,
+                     size_t     length) {
+#if ENABLE_OFFLINE_LOGGER
+    pushRecord(ESOfflineLogRecordText, txt, length);
+#endif
+}
+
+/*static*/ ESBinaryLogWriter *
+ESOfflineLogger::binaryLogWriter() {
+#if ENABLE_OFFLINE_LOGGER
+    return &offlineBinaryLogWriter;
+#else
+    return NULL;
 #endif
 }
 
@@ -10,11 +10,28 @@
 
 #include <string>
 
-/** class description */
+class ESBinaryLogWriter;
+
+/** What a thread does when its log ring is full */
+enum ESOfflineLoggerOverflowPolicy {
+    ESOfflineLoggerDropWhenFull,   // Drop the line (a count of dropped lines is written to the log later)
+    ESOfflineLoggerBlockWhenFull   // Wait for the logger thread to make room
+};
+
+/** Writes time-stamped lines to a log file in the document directory, via a worker thread.
+ *  Each logging thread has its own ring buffer of pending lines, so log() doesn't allocate or
+ *  lock after a thread's first call. */
 class ESOfflineLogger {
   public:
-    static void             initialize();
+    static void             initialize(size_t                        ringBytesPerThread = 64 * 1024,
+                                       ESOfflineLoggerOverflowPolicy policy = ESOfflineLoggerDropWhenFull);
     static void             log(const std::string &txt);
+    static void             log(const char *txt,
+                                size_t     length);
+
+    /** A writer which sends binary log records to OfflineLog.bin (through the same per-thread
+     *  rings), for ESErrorReporter::registerBinaryLogWriter().  NULL if offline logging is disabled. */
+    static ESBinaryLogWriter *binaryLogWriter();
 
     static void             writeScreenCaptureRequestFile(const std::string &filename,
                                                           const std::string &textToWrite);
@@ -0,0 +1,167 @@
+//
+//  ESParallel.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESParallel.hpp"
+#include "ESThreadPool.hpp"
+#include "ESLock.hpp"
+#include "ESErrorReporter.hpp"
+
+#if !ES_PTHREADS
+error "Need a non-pthreads condition variable on Windows";
+#endif
+
+#include <pthread.h>
+
+#include <atomic>
+
+static ESThreadPool *sharedPool = NULL;
+static ESLock sharedPoolLock;
+
+// The state of one parallel loop.  It lives on the heap, and is reference counted, because
+// helper jobs may still be queued in the pool after the calling thread has finished every
+// chunk and returned.
+struct ESParallelLoop {
+                            ESParallelLoop(long                  begin,
+                                           long                  end,
+                                           long                  grain,
+                                           long                  numChunks,
+                                           void                  (*glue)(void *, long, long, long),
+                                           void                  *context,
+                                           int                   refCount)
+    :   begin(begin),
+        end(end),
+        grain(grain),
+        numChunks(numChunks),
+        glue(glue),
+        context(context),
+        nextChunk(0),
+        chunksFinished(0),
+        refCount(refCount)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&allFinished, NULL);
+    }
+                            ~ESParallelLoop() {
+        pthread_cond_destroy(&allFinished);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Run chunks until there are none left to claim.
+    void                    runAvailableChunks();
+    void                    release() {
+        if (--refCount == 0) {
+            delete this;
+        }
+    }
+
+    long                    begin;
+    long                    end;
+    long                    grain;
+    long                    numChunks;
+    void                    (*glue)(void *, long, long, long);
+    void                    *context;  // Owned by the caller; not touched once all chunks have finished
+    std::atomic<long>       nextChunk;
+    std::atomic<long>       chunksFinished;
+    std::atomic<int>        refCount;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          allFinished;
+};
+
+void
+ESParallelLoop::runAvailableChunks() {
+    while (true) {
+        long chunk = nextChunk++;
+        if (chunk >= numChunks) {
+            return;
+        }
+        long chunkBegin = begin + chunk * grain;
+        long chunkEnd = chunkBegin + grain;
+        if (chunkEnd > end) {
+            chunkEnd = end;
+        }
+        (*glue)(context, chunk, chunkBegin, chunkEnd);
+        if (++chunksFinished == numChunks) {
+            pthread_mutex_lock(&mutex);
+            pthread_cond_signal(&allFinished);
+            pthread_mutex_unlock(&mutex);
+        }
+    }
+}
+
+static void helperGlue(void *obj,
+                       void *param) {
+    ESParallelLoop *loop = static_cast<ESParallelLoop *>(obj);
+    loop->runAvailableChunks();
+    loop->release();
+}
+
+/*static*/ ESThreadPool *
+ESParallel::threadPool() {
+    sharedPoolLock.lock();
+    if (!sharedPool) {
+        sharedPool = new ESThreadPool("ESParallel");
+    }
+    ESThreadPool *pool = sharedPool;
+    sharedPoolLock.unlock();
+    return pool;
+}
+
+/*static*/ void
+ESParallel::setThreadPool(ESThreadPool *pool) {
+    sharedPoolLock.lock();
+    ESAssert(!sharedPool);
+    sharedPool = pool;
+    sharedPoolLock.unlock();
+}
+
+/*static*/ long
+ESParallel::numChunks(long begin,
+                      long end,
+                      long grain) {
+    ESAssert(grain > 0);
+    if (end <= begin) {
+        return 0;
+    }
+    return (end - begin + grain - 1) / grain;
+}
+
+/*static*/ void
+ESParallel::runChunks(long      begin,
+                      long      end,
+                      long      grain,
+                      ChunkGlue glue,
+                      void      *context) {
+    long n = numChunks(begin, end, grain);
+    if (n == 0) {
+        return;
+    }
+    ESThreadPool *pool = threadPool();
+    if (n == 1 || pool->inWorkerThread()) {
+        // Nothing to split, or we're already in a worker and mustn't wait on our own pool
+        for (long chunk = 0; chunk < n; chunk++) {
+            long chunkBegin = begin + chunk * grain;
+            long chunkEnd = chunkBegin + grain;
+            (*glue)(context, chunk, chunkBegin, chunkEnd > end ? end : chunkEnd);
+        }
+        return;
+    }
+    // The calling thread takes chunks too, so it needs one fewer helper than there are chunks.
+    int numHelpers = pool->numWorkers();
+    if (numHelpers > n - 1) {
+        numHelpers = (int)(n - 1);
+    }
+    ESParallelLoop *loop = new ESParallelLoop(begin, end, grain, n, glue, context, numHelpers + 1);
+    for (int i = 0; i < numHelpers; i++) {
+        pool->submit(helperGlue, loop, NULL);
+    }
+    loop->runAvailableChunks();
+    pthread_mutex_lock(&loop->mutex);
+    while (loop->chunksFinished.load() < n) {
+        pthread_cond_wait(&loop->allFinished, &loop->mutex);
+    }
+    pthread_mutex_unlock(&loop->mutex);
+    loop->release();
+}
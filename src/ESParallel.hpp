@@ -0,0 +1,92 @@
+//
+//  ESParallel.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESPARALLEL_HPP_
+#define _ESPARALLEL_HPP_
+
+#include "ESPlatform.h"  // Must be first
+
+class ESThreadPool;
+
+/*! Data-parallel loops on top of a shared ESThreadPool.
+ *
+ *  The index range [begin, end) is split into chunks of 'grain' indices (the last may be
+ *  shorter), and the chunks are run by the pool's workers *and* the calling thread, which
+ *  returns only when every chunk has finished.  A chunk function sees a half-open subrange,
+ *  so the inner loop stays an ordinary serial loop:
+ *
+ *      ESParallel::forRange(0, numObservations, 4096, [&](long b, long e) {
+ *          for (long i = b; i < e; i++) {
+ *              ...
+ *          }
+ *      });
+ *
+ *  If there is only one chunk, or if the caller is itself one of the pool's workers (i.e.,
+ *  we're already inside a parallel loop or pool job), the chunks are simply run in order in
+ *  the calling thread, so nesting can't deadlock.
+ *
+ *  reduce() runs 'map' on each chunk and then combines the per-chunk results in chunk order
+ *  in the calling thread, so the result doesn't depend on how the chunks were scheduled. */
+class ESParallel {
+  public:
+    // fn(long chunkBegin, long chunkEnd)
+    template <class ChunkFn>
+    static void             forRange(long    begin,
+                                     long    end,
+                                     long    grain,
+                                     ChunkFn fn);
+
+    // map(long chunkBegin, long chunkEnd) -> ResultType; combine(ResultType, ResultType) -> ResultType
+    template <class ResultType, class MapFn, class CombineFn>
+    static ResultType       reduce(long       begin,
+                                   long       end,
+                                   long       grain,
+                                   ResultType identity,
+                                   MapFn      map,
+                                   CombineFn  combine);
+
+    /** The pool used by forRange() and reduce().  Created on first use, with one worker per processor, and never destroyed. */
+    static ESThreadPool     *threadPool();
+
+    /** Use the given pool instead of the default one.  Must be called before the first parallel loop. */
+    static void             setThreadPool(ESThreadPool *pool);
+
+  private:
+    typedef void            (*ChunkGlue)(void *context,
+                                         long chunkIndex,
+                                         long chunkBegin,
+                                         long chunkEnd);
+
+    static long             numChunks(long begin,
+                                      long end,
+                                      long grain);
+    static void             runChunks(long      begin,
+                                      long      end,
+                                      long      grain,
+                                      ChunkGlue glue,
+                                      void      *context);
+
+    template <class ChunkFn>
+    static void             forRangeGlue(void *context,
+                                         long chunkIndex,
+                                         long chunkBegin,
+                                         long chunkEnd);
+
+    template <class ResultType, class MapFn>
+    struct ReduceContext {
+        MapFn               *map;
+        ResultType          *results;
+    };
+    template <class ResultType, class MapFn>
+    static void             reduceGlue(void *context,
+                                       long chunkIndex,
+                                       long chunkBegin,
+                                       long chunkEnd);
+};
+
+#include "ESParallelInl.hpp"
+
+#endif  // _ESPARALLEL_HPP_
@@ -0,0 +1,68 @@
+//
+//  ESParallelInl.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESPARALLELINL_HPP_
+#define _ESPARALLELINL_HPP_
+
+#include "ESErrorReporter.hpp"
+
+#include <vector>
+
+// These definitions are inline to avoid portability issues with templates defined in c++ files.
+
+template <class ChunkFn>
+/*static*/ inline void
+ESParallel::forRangeGlue(void *context,
+                         long chunkIndex,
+                         long chunkBegin,
+                         long chunkEnd) {
+    (*static_cast<ChunkFn *>(context))(chunkBegin, chunkEnd);
+}
+
+template <class ChunkFn>
+/*static*/ inline void
+ESParallel::forRange(long    begin,
+                     long    end,
+                     long    grain,
+                     ChunkFn fn) {
+    runChunks(begin, end, grain, forRangeGlue<ChunkFn>, &fn);
+}
+
+template <class ResultType, class MapFn>
+/*static*/ inline void
+ESParallel::reduceGlue(void *context,
+                       long chunkIndex,
+                       long chunkBegin,
+                       long chunkEnd) {
+    ReduceContext<ResultType, MapFn> *ctx = static_cast<ReduceContext<ResultType, MapFn> *>(context);
+    ctx->results[chunkIndex] = (*ctx->map)(chunkBegin, chunkEnd);
+}
+
+template <class ResultType, class MapFn, class CombineFn>
+/*static*/ inline ResultType
+ESParallel::reduce(long       begin,
+                   long       end,
+                   long       grain,
+                   ResultType identity,
+                   MapFn      map,
+                   CombineFn  combine) {
+    long n = numChunks(begin, end, grain);
+    if (n == 0) {
+        return identity;
+    }
+    std::vector<ResultType> results(n, identity);
+    ReduceContext<ResultType, MapFn> context;
+    context.map = &map;
+    context.results = &results[0];
+    runChunks(begin, end, grain, reduceGlue<ResultType, MapFn>, &context);
+    ResultType result = identity;
+    for (long i = 0; i < n; i++) {
+        result = combine(result, results[i]);
+    }
+    return result;
+}
+
+#endif  // _ESPARALLELINL_HPP_
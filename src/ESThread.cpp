@@ -7,10 +7,9 @@
 
 #include "ESUtil.hpp"
 #include "ESThread.hpp"
+#include "ESInterThreadMailbox.hpp"
 #include "ESThreadLocalStorage.hpp"
 #include "ESErrorReporter.hpp"
-#define ESTRACE
-#include "ESTrace.hpp"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -19,30 +18,37 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <atomic>
+
 /*static*/ ESThread *ESThread::_mainThread = NULL;
 
 static ESThreadLocalStorageScalar<bool> *exitingThreadHasBeenJoined = NULL;
 static ESThreadLocalStoragePtr<ESThread> *currentThreadTLS = NULL;
 
-struct ESInterThreadPacket {
-    ESInterThreadFn         fn;
-    void                    *obj;
-    void                    *param;
-};
-
-ESThread::ESThread(const std::string &name)
-:   _name(name)
+ESThread::ESThread(const std::string      &name,
+                   ESInterThreadTransport transport)
+:   _pendingPacketIndex(0),
+    _pendingPacketCount(0),
+    _mailbox(NULL),
+    _name(name)
 {
     if (!currentThreadTLS) {
         initStatics();
     }
+    if (transport == ESInterThreadTransportMailbox) {
+        _mailbox = new ESInterThreadMailbox;
+        _myInterThreadSocket            = _mailbox->readFD();
+        _correspondentInterThreadSocket = _mailbox->writeFD();
+        ESAssert(_mailbox->valid());
+        return;
+    }
     int fds[2];
     int st = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);  // Could possibly use SOCK_DGRAM here, but it can fail in certain low-resource situations
     if (st == 0) {
         _myInterThreadSocket            = fds[0];
         _correspondentInterThreadSocket = fds[1];
-        // ESErrorReporter::logInfo("ESThread::ESThread", "Created socketpair for thread %s with fds %d, %d", 
-        //                          name.c_str(), fds[0], fds[1]);
+        ESLogDebug("ESThread::ESThread", "Created socketpair for thread %s with fds %d, %d",
+                   name.c_str(), fds[0], fds[1]);
 #if !ES_ANDROID
         size_t optval = sizeof(ESInterThreadPacket);
         unsigned int optval_sz = sizeof(optval);
@@ -71,10 +77,14 @@ ESThread::ESThread(const std::string &name)
 
 /*virtual*/
 ESThread::~ESThread() {
-    // ESErrorReporter::logInfo("ESThread dtor", "closing thread %s with sockets %d, %d",
-    //                          _name.c_str(), _myInterThreadSocket, _correspondentInterThreadSocket);
-    close(_myInterThreadSocket);
-    close(_correspondentInterThreadSocket);
+    ESLogDebug("ESThread dtor", "closing thread %s with sockets %d, %d",
+               _name.c_str(), _myInterThreadSocket, _correspondentInterThreadSocket);
+    if (_mailbox) {
+        delete _mailbox;  // Closes its own descriptors
+    } else {
+        close(_myInterThreadSocket);
+        close(_correspondentInterThreadSocket);
+    }
 }
 
 /*static*/ void 
@@ -147,28 +157,41 @@ ESThread::callInThread(ESInterThreadFn fn,
                        void            *object,
                        void            *param,
                        bool            forceUseSocket) {
-    ESAssert(!inThisThread());  // otherwise don't go through this overhead; caller should check or just know
     ESInterThreadPacket packet;
     packet.fn = fn;
     packet.obj = object;
     packet.param = param;
-    ssize_t bytesWritten = write(_correspondentInterThreadSocket, &packet, sizeof(packet));
-    if (bytesWritten != sizeof(packet)) {
+    ESThread::callInThreadBatch(&packet, 1, forceUseSocket);
+}
+
+void 
+ESThread::callInThreadBatch(const ESInterThreadPacket *packets,
+                            int                       numPackets,
+                            bool                      /*forceUseSocket*/) {  // Only Android's main thread has another path
+    ESAssert(!inThisThread());  // otherwise don't go through this overhead; caller should check or just know
+    ESAssert(numPackets > 0 && numPackets <= ES_INTER_THREAD_BATCH_SIZE);  // Larger writes might be split by the kernel
+    if (_mailbox) {
+        _mailbox->post(packets, numPackets);
+        return;
+    }
+    ssize_t bytesToWrite = numPackets * sizeof(ESInterThreadPacket);
+    ssize_t bytesWritten = write(_correspondentInterThreadSocket, packets, bytesToWrite);
+    if (bytesWritten != bytesToWrite) {
         ESErrorReporter::logError("ESThread::callInThread", "bytesWritten (%d) not expected (%d)",
-                                  (int)bytesWritten, (int)sizeof(packet));
+                                  (int)bytesWritten, (int)bytesToWrite);
         ESErrorReporter::checkAndLogSystemError("ESThread", errno, 
                                                 ESUtil::stringWithFormat("Inter-thread socket write to fd %d",
                                                                          _correspondentInterThreadSocket)
                                                 .c_str());
-#ifdef ESTRACE
-#ifndef ES_ANDROID
-        size_t bufsz = 0;
-        unsigned int bufsz_sz = sizeof(bufsz);
-        int st = getsockopt(_correspondentInterThreadSocket, SOL_SOCKET, SO_NWRITE,
-                            &bufsz, &bufsz_sz);
-        printf("remaining bytes to send (st %d): %lu\n", st, bufsz);
+#if !ES_ANDROID && ES_MIN_LOG_LEVEL <= ES_LOG_LEVEL_DEBUG
+        if (ESErrorReporter::logLevelEnabled(ESLogLevelDebug, "ESThread::callInThread")) {
+            size_t bufsz = 0;
+            unsigned int bufsz_sz = sizeof(bufsz);
+            int st = getsockopt(_correspondentInterThreadSocket, SOL_SOCKET, SO_NWRITE,
+                                &bufsz, &bufsz_sz);
+            ESLogDebug("ESThread::callInThread", "remaining bytes to send (st %d): %lu", st, (unsigned long)bufsz);
+        }
 #endif
-#endif        
         ESAssert(false);
     }
 }
@@ -191,27 +214,103 @@ ESThread::setBitsForSelect(fd_set *fdset) {
     return currentThread()->_setBitsForSelect(fdset);
 }
 
+bool
+ESThread::hasPendingInterThreadPackets() const {
+    if (_mailbox) {
+        return !_mailbox->isEmpty();
+    }
+    return _pendingPacketIndex < _pendingPacketCount;
+}
+
+static std::atomic<bool> readsOneInterThreadMessageAtATime(false);
+
+/*static*/ void
+ESThread::setReadsOneInterThreadMessageAtATime(bool readsOne) {
+    readsOneInterThreadMessageAtATime.store(readsOne, std::memory_order_relaxed);
+}
+
+// Read as many packets as are available (up to the size of the pending buffer) with a single
+// kernel call.  Returns false on error.
+bool
+ESThread::readPendingInterThreadPackets() {
+    ESAssert(!_mailbox);
+    ESAssert(!hasPendingInterThreadPackets());
+    _pendingPacketIndex = 0;
+    _pendingPacketCount = 0;
+    char *buf = (char *)_pendingPackets;
+    size_t bytesWanted = readsOneInterThreadMessageAtATime.load(std::memory_order_relaxed) ? sizeof(ESInterThreadPacket) : sizeof(_pendingPackets);
+    ssize_t bytesRead = read(_myInterThreadSocket, buf, bytesWanted);
+    if (bytesRead <= 0) {
+        ESErrorReporter::checkAndLogSystemError("ESThread", errno, "Inter-thread socket read");
+        ESErrorReporter::logInfo("ESThread", ".... from socket %d on thread %s", 
+                                 _myInterThreadSocket, _name.c_str());
+        ESAssert(false);
+        return false;
+    }
+    // Each packet is written with a single write() but that doesn't stop a stream socket from
+    // handing us part of one at the end of the buffer, so finish off the last one if necessary.
+    ssize_t partialBytes = bytesRead % sizeof(ESInterThreadPacket);
+    if (partialBytes != 0) {
+        ssize_t bytesNeeded = sizeof(ESInterThreadPacket) - partialBytes;
+        while (bytesNeeded > 0) {
+            ssize_t st = read(_myInterThreadSocket, buf + bytesRead, bytesNeeded);
+            if (st <= 0) {
+                if (st < 0 && errno == EINTR) {
+                    continue;
+                }
+                ESErrorReporter::checkAndLogSystemError("ESThread", errno, "Inter-thread socket read of partial packet");
+                ESAssert(false);
+                return false;
+            }
+            bytesRead += st;
+            bytesNeeded -= st;
+        }
+    }
+    _pendingPacketCount = (int)(bytesRead / sizeof(ESInterThreadPacket));
+    return true;
+}
+
 void
 ESThread::readAndExecuteInterThreadFunction() {
-    ESInterThreadPacket packet;
-    ssize_t bytesRead = read(_myInterThreadSocket, &packet, sizeof(packet));
-    if (bytesRead == sizeof(packet)) {
+    if (_mailbox) {
+        // We were only woken because the mailbox went from empty to non-empty, so we must empty it
+        // before waiting again.  Clear the wakeup first so none is lost for packets posted after that.
+        _mailbox->clearWakeup();
+        ESInterThreadPacket packet;
+        while (_mailbox->pop(&packet)) {
+            preInterThreadFunction();
+            (*packet.fn)(packet.obj, packet.param);
+            postInterThreadFunction();
+        }
+        return;
+    }
+    if (!hasPendingInterThreadPackets()) {
+        if (!readPendingInterThreadPackets()) {
+            return;
+        }
+    }
+    // Note that _pendingPacketIndex is advanced before the call, since the function we call
+    // might itself process inter-thread messages.
+    while (hasPendingInterThreadPackets()) {
+        ESInterThreadPacket packet = _pendingPackets[_pendingPacketIndex++];
         preInterThreadFunction();
         (*packet.fn)(packet.obj, packet.param);
         postInterThreadFunction();
-    } else {
-        ESErrorReporter::checkAndLogSystemError("ESThread", errno, "Inter-thread socket read");
-        ESErrorReporter::logInfo("ESThread", ".... from socket %d on thread %s", 
-                                 _myInterThreadSocket, _name.c_str());
-        ESAssert(false);
     }
 }
 
+/*static*/ bool
+ESThread::hasPendingInterThreadMessages() {
+    return currentThread()->hasPendingInterThreadPackets();
+}
+
 // Brain-dead standards people decided to make this a function that takes a non-const ptr, when
 // converting from a macro, so with const this crashes on Android as of NDK 15.0.
+// Packets already read (or in the mailbox) are run whether or not select() saw the socket, since
+// it won't see them.
 void
 ESThread::_processInterThreadMessages(fd_set *fdset) {
-    if (FD_ISSET(_myInterThreadSocket, const_cast<fd_set *>(fdset))) {
+    if (hasPendingInterThreadPackets() || FD_ISSET(_myInterThreadSocket, const_cast<fd_set *>(fdset))) {
         readAndExecuteInterThreadFunction();
    }
 }
@@ -223,13 +322,29 @@ ESThread::processInterThreadMessages(fd_set *fdset) {
 
 /*static*/ void 
 ESThread::waitForAndProcessInterThreadMessages() {
-    fd_set readers;
-    FD_ZERO(&readers);
     ESThread *thread = currentThread();
-    int highestThreadFD = thread->_setBitsForSelect(&readers);
-    int nfds = highestThreadFD + 1;
-    select(nfds, &readers, NULL/*writers*/, NULL, NULL);
-    thread->_processInterThreadMessages(&readers);
+    while (true) {
+        if (thread->hasPendingInterThreadPackets()) {
+            // Either we're inside an inter-thread function and should finish the ones already read
+            // before waiting for more, or there are packets in the mailbox.
+            thread->readAndExecuteInterThreadFunction();
+            return;
+        }
+        fd_set readers;
+        FD_ZERO(&readers);
+        int highestThreadFD = thread->_setBitsForSelect(&readers);
+        int nfds = highestThreadFD + 1;
+        select(nfds, &readers, NULL/*writers*/, NULL, NULL);
+        if (!thread->_mailbox) {
+            thread->_processInterThreadMessages(&readers);
+            return;
+        }
+        // A mailbox wakeup can be left over from packets we've already handled, so go around
+        // again and only return once we've actually run something.
+        if (FD_ISSET(thread->_myInterThreadSocket, &readers)) {
+            thread->_mailbox->clearWakeup();
+        }
+    }
 }
 
 /*static*/ int 
@@ -246,6 +361,9 @@ ESThread::correspondentInterThreadSocket() {  // other threads write to this soc
 ESThread::verifyThreadSocketWithPeek(const char *msg) {
     ESThread *thread = currentThread();
     ESAssert(thread->inThisThread());
+    if (thread->_mailbox) {
+        return;  // Nothing to peek at
+    }
     char buf[4];
     ssize_t bytesRead = recv(thread->_myInterThreadSocket, buf, 4, MSG_DONTWAIT | MSG_PEEK);
     if (bytesRead < 0 && errno != EAGAIN) {
@@ -260,7 +378,7 @@ ESThread::verifyThreadSocketWithPeek(const char *msg) {
         ESAssert(false);
     } else {
         if (msg && *msg) {
-            ESErrorReporter::logInfo("verifyThreadSocketWithPeek", "OK %s", msg);
+            ESLogDebug("verifyThreadSocketWithPeek", "OK %s", msg);
         }
     }
 }
@@ -269,14 +387,15 @@ ESThread::verifyThreadSocketWithPeek(const char *msg) {
 ESChildThread::joinGlue(void *obj,
                         void *param) {
 #ifndef NDEBUG    
-    // ESErrorReporter::logInfo("ESChildThread::joinGlue", "enter");
+    ESLogDebug("ESChildThread::joinGlue", "enter");
     ESThread *parentThread = (ESThread *)obj;
     ESAssert(parentThread->inThisThread());
 #endif
     ESChildThread *childThread = (ESChildThread *)param;
     ESAssert(!childThread->inThisThread());
     ESAssert(childThread->_parentThread == parentThread);
-    tracePrintf2("joining child '%s', child pthread id is %x", childThread->name().c_str(), childThread->_pthread);
+    ESLogDebug("ESChildThread::joinGlue", "joining child '%s', child pthread id is %lx",
+               childThread->name().c_str(), (unsigned long)childThread->_pthread);
     childThread->join();
     ESAssert(exitingThreadHasBeenJoined);
     // ESAssert(!*exitingThreadHasBeenJoined);  // Can't assert this, because not set by requestExit() but its caller so other paths here that don't clear the flag.
@@ -287,8 +406,8 @@ ESChildThread::joinGlue(void *obj,
 void 
 ESChildThread::requestJoin() {  // Sends message to creating thread to join immediately prior to exit
     ESAssert(inThisThread());
-    // ESErrorReporter::logInfo("ESChildThread::requestJoin", "child thread requesting join (parent %s, child %s)",
-    //                          _parentThread->name().c_str(), name().c_str());
+    ESLogDebug("ESChildThread::requestJoin", "child thread requesting join (parent %s, child %s)",
+               _parentThread->name().c_str(), name().c_str());
     _parentThread->callInThread(joinGlue, _parentThread, this, _waitingOnSocket);
 }
 
@@ -317,12 +436,12 @@ ESChildThread::requestExitAndWaitForJoin() {
     ESAssert(exitingThreadHasBeenJoined);
     ESAssert(*exitingThreadHasBeenJoined);
     *exitingThreadHasBeenJoined = false;
-    // ESErrorReporter::logInfo("ESChildThread::requestExitAndWaitForJoin", "thread %s waiting for thread %s to join",
-    //                          _parentThread->name().c_str(), name().c_str());
+    ESLogDebug("ESChildThread::requestExitAndWaitForJoin", "thread %s waiting for thread %s to join",
+               _parentThread->name().c_str(), name().c_str());
     _waitingOnSocket = true;
     requestExit();
     while (!*exitingThreadHasBeenJoined) {
-        // ESErrorReporter::logInfo("ESChildThread::requestExitAndWaitForJoin", "in loop, still waiting");
+        ESLogDebug("ESChildThread::requestExitAndWaitForJoin", "in loop, still waiting");
         // The logic here is a little tricky.  It's not safe to call the following method if the thread has been
         // deleted, which can happen more or less at any time.  But note that the TLS variable and the destruction
         // of the class happens in *this* thread, and in the same function (joinGlue above), so it the TLS value
@@ -332,12 +451,13 @@ ESChildThread::requestExitAndWaitForJoin() {
         // TLS bool, but the assert above should catch that when we re-enter this routine in that case.
         waitForAndProcessInterThreadMessages();
     }
-    // ESErrorReporter::logInfo("ESChildThread::requestExitAndWaitForJoin", "Found join true, exiting loop");
+    ESLogDebug("ESChildThread::requestExitAndWaitForJoin", "Found join true, exiting loop");
 }
 
 void
 ESChildThread::cleanupInThread() {
-    tracePrintf2("will be joined by '%s', child (my) pthread id is %x", _parentThread->name().c_str(), pthread_self());
+    ESLogDebug("ESChildThread::cleanupInThread", "will be joined by '%s', child (my) pthread id is %lx",
+               _parentThread->name().c_str(), (unsigned long)pthread_self());
 
     requestJoin();
 
@@ -350,13 +470,47 @@ ESChildThread::cleanupInThread() {
     platformSpecificThreadCleanup();
 }
 
+ESInterThreadCallBatch::ESInterThreadCallBatch(ESThread *targetThread,
+                                               bool     forceUseSocket)
+:   _targetThread(targetThread),
+    _forceUseSocket(forceUseSocket),
+    _numPackets(0)
+{
+}
+
+ESInterThreadCallBatch::~ESInterThreadCallBatch() {
+    flush();
+}
+
+void
+ESInterThreadCallBatch::add(ESInterThreadFn fn,
+                            void            *object,
+                            void            *param) {
+    if (_numPackets == ES_INTER_THREAD_BATCH_SIZE) {
+        flush();
+    }
+    ESInterThreadPacket &packet = _packets[_numPackets++];
+    packet.fn = fn;
+    packet.obj = object;
+    packet.param = param;
+}
+
+void
+ESInterThreadCallBatch::flush() {
+    if (_numPackets > 0) {
+        _targetThread->callInThreadBatch(_packets, _numPackets, _forceUseSocket);
+        _numPackets = 0;
+    }
+}
+
 ESMainThread::~ESMainThread() {
     ESAssert(false);  // Never destroy the main thread.
 }
 
 ESSimpleWorkerThread::ESSimpleWorkerThread(const std::string         &name,
-                                           ESChildThreadExitStrategy exitStrategy)
-:   ESChildThread(name, exitStrategy)
+                                           ESChildThreadExitStrategy exitStrategy,
+                                           ESInterThreadTransport    transport)
+:   ESChildThread(name, exitStrategy, transport)
 {
 }
 
@@ -24,8 +24,30 @@
 
 ES_OPAQUE_OBJC(NSAutoreleasePool);
 
+// Opaque declarations
+class ESInterThreadMailbox;
+
 typedef void (*ESInterThreadFn)(void *object, void *param);
 
+// One callInThread() request, as it travels between threads
+struct ESInterThreadPacket {
+    ESInterThreadFn         fn;
+    void                    *obj;
+    void                    *param;
+};
+
+// The most packets a receiving thread reads in a single kernel call, and the most a sender
+// writes in one.  Kept small so that a single write is never split (and thus possibly
+// interleaved with another sender's write) by the kernel.
+#define ES_INTER_THREAD_BATCH_SIZE 64
+
+// How callInThread() messages get to a thread.  Either way the receiving thread sees a
+// selectable descriptor (myInterThreadSocket()), so select loops work the same.
+enum ESInterThreadTransport {
+    ESInterThreadTransportSocket,   // A socketpair; each message is copied through the kernel
+    ESInterThreadTransportMailbox   // An in-process lock-free queue; the kernel is only used to wake an idle thread
+};
+
 enum ESChildThreadExitStrategy {
     ESChildThreadExitsOnlyByParentRequest,
     ESChildThreadExitsOnlyWhenFinished,
@@ -126,7 +148,8 @@ enum ESChildThreadExitStrategy {
 // be used for the main thread also
 class ESThread {
   public:
-                            ESThread(const std::string &name);
+                            ESThread(const std::string      &name,
+                                     ESInterThreadTransport transport = ESInterThreadTransportSocket);
 
     // The following routines (callIn*Thread) depend on the thread watching a particular
     // socket for messages.  This is set up for reception in the main thread automatically,
@@ -146,11 +169,27 @@ class ESThread {
                                              void            *object,
                                              void            *param);
 
+    // Send several calls at once, with a single kernel call.  The calls are executed in the
+    // order given, exactly as if callInThread() had been called on each in turn.  Most clients
+    // will want to use ESInterThreadCallBatch (below) rather than calling this directly.
+#if ES_ANDROID
+    virtual
+#endif
+    void                    callInThreadBatch(const ESInterThreadPacket *packets,
+                                              int                       numPackets,
+                                              bool                      forceUseSocket = false);
+
     // Convenience functions for inter-thread communication
     // Call these in the thread's select loop
     // The methods below are static, but return different values in different threads
     static int              setBitsForSelect(fd_set *fdset);  // returns highest bit set
-    static void             processInterThreadMessages(fd_set *fdset);
+    static void             processInterThreadMessages(fd_set *fdset);  // Also runs any pending messages (see below)
+
+    /** True if messages have been received but not yet run.  This happens when a select loop
+     *  runs inside an inter-thread function, since the rest of the batch read with it is still
+     *  waiting; select() won't report those messages, so such a loop should poll (pass a zero
+     *  timeout) while this is true, and processInterThreadMessages() will run them. */
+    static bool             hasPendingInterThreadMessages();
 
     /** Wait for at least one message to come in, handle all that have come in, and return.
      *  So this routine will not return until it has processed at least one message.
@@ -160,9 +199,11 @@ class ESThread {
     static void             waitForAndProcessInterThreadMessages();
 
     // If you don't have a select loop, find some way of getting the main loop to check for
-    // input on this socket
+    // input on this socket.  With ESInterThreadTransportMailbox this is an eventfd or pipe which
+    // only signals that messages are waiting; either way, don't read it directly but call
+    // readAndExecuteInterThreadFunction() when it is readable.
     static int              myInterThreadSocket();             // this thread reads from this socket
-    int                     correspondentInterThreadSocket();  // other threads write to this socket
+    int                     correspondentInterThreadSocket();  // other threads write to this socket (socket transport only)
 
     // If the first ESThread is not started in the main thread, or if
     // isMainThread() or mainThread() are called in some non-main
@@ -176,9 +217,14 @@ class ESThread {
     static ESThread         *mainThread();
     static ESThread         *currentThread();
 
-    // Utility method for callback
+    // Utility method for callback.  Reads all of the messages currently available (up to
+    // ES_INTER_THREAD_BATCH_SIZE) in one kernel call and executes them in order.
     void                    readAndExecuteInterThreadFunction();
 
+    // For benchmarking only: read just one message per kernel call, as we did before reads were
+    // batched.  Applies to every thread, from its next read.
+    static void             setReadsOneInterThreadMessageAtATime(bool readsOne);
+
     static void             verifyThreadSocketWithPeek(const char *msg = NULL);
 
     std::string             name() { return _name; }
@@ -208,6 +254,18 @@ class ESThread {
 
     int                     _myInterThreadSocket;
 
+    bool                    hasPendingInterThreadPackets() const;
+    bool                    readPendingInterThreadPackets();
+
+    // Packets which have been read from the socket but not yet executed.  These are kept in the
+    // thread rather than on the stack so that an inter-thread function which itself processes
+    // messages (e.g., via waitForAndProcessInterThreadMessages()) picks up where we left off.
+    ESInterThreadPacket     _pendingPackets[ES_INTER_THREAD_BATCH_SIZE];
+    int                     _pendingPacketIndex;
+    int                     _pendingPacketCount;
+
+    ESInterThreadMailbox    *_mailbox;  // NULL unless using ESInterThreadTransportMailbox
+
 #if ES_PTHREADS
     pthread_t               _pthread;
 #else
@@ -225,7 +283,8 @@ class ESChildThread : public ESThread {
   public:
     // Methods called in the calling thread:
                             ESChildThread(const std::string         &name,          // Primarily for debug
-                                          ESChildThreadExitStrategy exitStrategy);  // Entirely for debug
+                                          ESChildThreadExitStrategy exitStrategy,   // Entirely for debug
+                                          ESInterThreadTransport    transport = ESInterThreadTransportSocket);
     void                    start();
     void                    requestExit();
     void                    requestExitAndWaitForJoin();  // Must be called by parent thread; will block parent thread until child completes, so make sure that happens quickly
@@ -276,6 +335,9 @@ class ESMainThread : public ESThread {
                                          void            *object,
                                          void            *param,
                                          bool            forceUseSocket = false);
+    /*virtual*/ void        callInThreadBatch(const ESInterThreadPacket *packets,
+                                              int                       numPackets,
+                                              bool                      forceUseSocket = false);
     static void             dispatchMethodInThread(JNIEnv  *jniEnv,
                                                    jobject activity,
                                                    jobject message);
@@ -292,8 +354,33 @@ class ESMainThread : public ESThread {
 class ESSimpleWorkerThread: public ESChildThread {
   public:
                             ESSimpleWorkerThread(const std::string         &name,
-                                                 ESChildThreadExitStrategy exitStrategy);
+                                                 ESChildThreadExitStrategy exitStrategy,
+                                                 ESInterThreadTransport    transport = ESInterThreadTransportSocket);
     virtual void            *main();
 };
 
+/** Collects calls destined for a single thread so they can be sent together with one kernel
+ *  call.  Calls are sent when flush() is called, when the batch fills up, or when the batch is
+ *  destroyed, whichever comes first; they are executed in the target thread in the order they
+ *  were added.  A batch belongs to the thread that created it. */
+class ESInterThreadCallBatch {
+  public:
+                            ESInterThreadCallBatch(ESThread *targetThread,
+                                                   bool     forceUseSocket = false);
+                            ~ESInterThreadCallBatch();  // flushes
+
+    void                    add(ESInterThreadFn fn,
+                                void            *object,
+                                void            *param);
+    void                    flush();
+
+    int                     numQueued() const { return _numPackets; }
+
+  private:
+    ESThread                *_targetThread;
+    bool                    _forceUseSocket;
+    int                     _numPackets;
+    ESInterThreadPacket     _packets[ES_INTER_THREAD_BATCH_SIZE];
+};
+
 #endif // ESTHREAD_HPP
@@ -0,0 +1,238 @@
+//
+//  ESThreadPool.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#include "ESThreadPool.hpp"
+#include "ESLock.hpp"
+#include "ESErrorReporter.hpp"
+#include "ESUtil.hpp"
+
+#include <unistd.h>
+
+#include <deque>
+
+struct ESThreadPool::Job {
+    ESInterThreadFn         fn;
+    void                    *object;
+    void                    *param;
+    ESInterThreadFn         completionFn;
+    void                    *completionObject;
+    ESThread                *completionThread;
+};
+
+// Kept in the pool rather than in the worker thread object, since workers look at each other's
+// queues and the thread objects go away one at a time at shutdown.
+struct ESThreadPool::WorkerQueue {
+                            WorkerQueue() : sleeping(false) {}
+    ESLock                  lock;      // Protects jobs
+    std::deque<Job>         jobs;      // Owner takes from the back, thieves from the front
+    std::atomic<bool>       sleeping;  // True while the worker is (about to be) waiting for messages
+};
+
+class ESThreadPoolWorker : public ESChildThread {
+  public:
+                            ESThreadPoolWorker(ESThreadPool      *pool,
+                                               int               index,
+                                               const std::string &name);
+
+    /*virtual*/ void        *main();
+
+    ESThreadPool            *_pool;
+    int                     _index;
+};
+
+static ESThreadLocalStoragePtr<ESThreadPoolWorker> currentWorker;
+
+ESThreadPoolWorker::ESThreadPoolWorker(ESThreadPool      *pool,
+                                       int               index,
+                                       const std::string &name)
+:   ESChildThread(name, ESChildThreadExitsOnlyByParentRequest, ESInterThreadTransportMailbox),
+    _pool(pool),
+    _index(index)
+{
+}
+
+/*virtual*/ void *
+ESThreadPoolWorker::main() {
+    currentWorker = this;
+    ESThreadPool::Job job;
+    ESThreadPool::WorkerQueue &queue = _pool->_queues[_index];
+    while (true) {
+        if (_pool->takeJob(_index, &job)) {
+            _pool->runJob(job);
+            continue;
+        }
+        // Nothing to do.  Say we're going to sleep, then look once more, so that a job submitted
+        // in between is either seen here or by the submitter's check of _sleeping.
+        queue.sleeping.store(true);
+        if (_pool->takeJob(_index, &job)) {
+            queue.sleeping.store(false);
+            _pool->runJob(job);
+            continue;
+        }
+        // Returns after a wakeup (or never, if the message is a request to exit)
+        waitForAndProcessInterThreadMessages();
+        queue.sleeping.store(false);
+    }
+    return NULL;
+}
+
+ESThreadPool::ESThreadPool(const std::string &name,
+                           int               numWorkers)
+:   _name(name),
+    _numWorkers(numWorkers > 0 ? numWorkers : numberOfProcessors()),
+    _creatingThread(ESThread::currentThread()),
+    _nextWorker(0),
+    _outstandingJobs(0),
+    _draining(false)
+{
+    pthread_mutex_init(&_drainedMutex, NULL);
+    pthread_cond_init(&_drained, NULL);
+    _queues = new WorkerQueue[_numWorkers];
+    _workers = new ESThreadPoolWorker *[_numWorkers];
+    for (int i = 0; i < _numWorkers; i++) {
+        _workers[i] = new ESThreadPoolWorker(this, i, ESUtil::stringWithFormat("%s[%d]", name.c_str(), i));
+    }
+    // Start them only after they all exist, since they steal from each other
+    for (int i = 0; i < _numWorkers; i++) {
+        _workers[i]->start();
+    }
+}
+
+ESThreadPool::~ESThreadPool() {
+    ESAssert(_creatingThread->inThisThread());
+    // First let every job (including any jobs they submit) finish, so that nothing is left which
+    // might try to wake a worker after it has gone.
+    // Wait on a condition variable rather than for messages, since the creating thread's messages
+    // might not come through its socket at all (Android's main thread).
+    _draining.store(true);
+    pthread_mutex_lock(&_drainedMutex);
+    while (_outstandingJobs.load() > 0) {
+        pthread_cond_wait(&_drained, &_drainedMutex);
+    }
+    pthread_mutex_unlock(&_drainedMutex);
+    for (int i = 0; i < _numWorkers; i++) {
+        _workers[i]->requestExitAndWaitForJoin();  // Also waits for the last job's signal to finish
+    }
+    delete [] _workers;
+    delete [] _queues;
+    pthread_cond_destroy(&_drained);
+    pthread_mutex_destroy(&_drainedMutex);
+}
+
+/*static*/ int
+ESThreadPool::numberOfProcessors() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+bool
+ESThreadPool::inWorkerThread() const {
+    ESThreadPoolWorker *worker = currentWorker;
+    return worker && worker->_pool == this;
+}
+
+void
+ESThreadPool::submit(ESInterThreadFn fn,
+                     void            *object,
+                     void            *param) {
+    submit(fn, object, param, NULL, NULL);
+}
+
+void
+ESThreadPool::submit(ESInterThreadFn fn,
+                     void            *object,
+                     void            *param,
+                     ESInterThreadFn completionFn,
+                     void            *completionObject) {
+    Job job;
+    job.fn = fn;
+    job.object = object;
+    job.param = param;
+    job.completionFn = completionFn;
+    job.completionObject = completionObject;
+    job.completionThread = completionFn ? ESThread::currentThread() : NULL;
+    ESAssert(!_draining.load() || inWorkerThread());  // No new work from outside once we're being destroyed
+    _outstandingJobs++;
+    submitJob(job);
+}
+
+void
+ESThreadPool::submitJob(const Job &job) {
+    ESThreadPoolWorker *worker = currentWorker;
+    int index;
+    if (worker && worker->_pool == this) {
+        index = worker->_index;
+    } else {
+        index = (int)(_nextWorker++ % _numWorkers);
+    }
+    WorkerQueue &queue = _queues[index];
+    queue.lock.lock();
+    queue.jobs.push_back(job);
+    queue.lock.unlock();
+    wakeOneSleepingWorker(index);
+}
+
+void
+ESThreadPool::wakeOneSleepingWorker(int startingIndex) {
+    // Any worker will do, since they steal; prefer the one we gave the job to.
+    for (int i = 0; i < _numWorkers; i++) {
+        int index = (startingIndex + i) % _numWorkers;
+        bool expected = true;
+        if (_queues[index].sleeping.compare_exchange_strong(expected, false)) {
+            _workers[index]->callInThread(wakeGlue, NULL, NULL);
+            return;
+        }
+    }
+}
+
+/*static*/ void
+ESThreadPool::wakeGlue(void *obj,
+                       void *param) {
+    // Nothing to do; the worker's main loop will go looking for jobs when we return.
+}
+
+bool
+ESThreadPool::takeJob(int workerIndex,
+                      Job *job) {
+    WorkerQueue &own = _queues[workerIndex];
+    own.lock.lock();
+    if (!own.jobs.empty()) {
+        *job = own.jobs.back();
+        own.jobs.pop_back();
+        own.lock.unlock();
+        return true;
+    }
+    own.lock.unlock();
+    for (int i = 1; i < _numWorkers; i++) {
+        WorkerQueue &victim = _queues[(workerIndex + i) % _numWorkers];
+        victim.lock.lock();
+        if (!victim.jobs.empty()) {
+            *job = victim.jobs.front();
+            victim.jobs.pop_front();
+            victim.lock.unlock();
+            return true;
+        }
+        victim.lock.unlock();
+    }
+    return false;
+}
+
+void
+ESThreadPool::runJob(const Job &job) {
+    (*job.fn)(job.object, job.param);
+    if (job.completionFn) {
+        if (job.completionThread->inThisThread()) {
+            (*job.completionFn)(job.completionObject, job.param);  // Submitted from this worker
+        } else {
+            job.completionThread->callInThread(job.completionFn, job.completionObject, job.param);
+        }
+    }
+    if (--_outstandingJobs == 0 && _draining.load()) {
+        pthread_mutex_lock(&_drainedMutex);
+        pthread_cond_signal(&_drained);
+        pthread_mutex_unlock(&_drainedMutex);
+    }
+}
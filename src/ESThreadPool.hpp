@@ -0,0 +1,87 @@
+//
+//  ESThreadPool.hpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+
+#ifndef _ESTHREADPOOL_HPP_
+#define _ESTHREADPOOL_HPP_
+
+#include "ESPlatform.h"  // Must be first
+#include "ESThread.hpp"
+
+#include <pthread.h>
+
+#include <atomic>
+#include <string>
+
+// Opaque declarations
+class ESThreadPoolWorker;
+
+/*! A fixed set of worker threads which run submitted jobs, for CPU-bound work which should
+ *  use every core rather than being serialized on a single ESSimpleWorkerThread.
+ *
+ *  Each worker has its own deque of jobs.  Jobs submitted from outside the pool are spread
+ *  round-robin across the workers; jobs submitted from within a job go on the submitting
+ *  worker's own deque.  A worker runs jobs from the back of its own deque, and when that is
+ *  empty it steals from the front of the others' before going to sleep.  There is no ordering
+ *  guarantee between jobs.
+ *
+ *  A job may optionally post a completion back to the thread which submitted it; the
+ *  completion is called there via callInThread(), once the job has finished, with the
+ *  same param as the job.  So the submitting thread must be running a message loop.
+ *
+ *  The pool must be created and destroyed in the same thread.  Destroying it waits for all
+ *  submitted jobs to finish, blocking the thread without processing its messages (so it works
+ *  on threads whose messages don't come through ESThread's socket, like Android's main thread);
+ *  completions posted to that thread run after the destructor returns. */
+class ESThreadPool {
+  public:
+                            ESThreadPool(const std::string &name,               // For debugging only
+                                         int               numWorkers = 0);     // 0 means one per processor
+                            ~ESThreadPool();
+
+    void                    submit(ESInterThreadFn fn,
+                                   void            *object,
+                                   void            *param);
+    void                    submit(ESInterThreadFn fn,
+                                   void            *object,
+                                   void            *param,
+                                   ESInterThreadFn completionFn,       // Called in the submitting thread with (completionObject, param)
+                                   void            *completionObject);
+
+    int                     numWorkers() const { return _numWorkers; }
+
+    /** True iff the calling thread is one of this pool's workers */
+    bool                    inWorkerThread() const;
+
+    static int              numberOfProcessors();
+
+  private:
+    struct Job;
+    struct WorkerQueue;
+
+    void                    submitJob(const Job &job);
+    bool                    takeJob(int  workerIndex,
+                                    Job  *job);
+    void                    runJob(const Job &job);
+    void                    wakeOneSleepingWorker(int startingIndex);
+
+    static void             wakeGlue(void *obj,
+                                     void *param);
+
+    std::string             _name;
+    int                     _numWorkers;
+    ESThreadPoolWorker      **_workers;
+    WorkerQueue             *_queues;  // One per worker
+    ESThread                *_creatingThread;
+    std::atomic<unsigned int> _nextWorker;  // Round-robin index for jobs submitted from outside the pool
+    std::atomic<int>        _outstandingJobs;  // Submitted but not yet finished (including the completion post)
+    std::atomic<bool>       _draining;  // Set when the destructor starts
+    pthread_mutex_t         _drainedMutex;
+    pthread_cond_t          _drained;  // Signaled when the last job finishes while draining
+
+friend class ESThreadPoolWorker;
+};
+
+#endif  // _ESTHREADPOOL_HPP_
@@ -174,7 +174,21 @@ ESMainThread::callInThread(ESInterThreadFn fn,
     jniEnv->DeleteLocalRef(msg);
 }
 
-/*static*/ void 
+/*virtual*/ void
+ESMainThread::callInThreadBatch(const ESInterThreadPacket *packets,
+                                int                       numPackets,
+                                bool                      forceUseSocket) {
+    if (forceUseSocket) {
+        ESThread::callInThreadBatch(packets, numPackets, true);
+        return;
+    }
+    // The Android main loop takes one Message at a time, so there's nothing to be gained here.
+    for (int i = 0; i < numPackets; i++) {
+        callInThread(packets[i].fn, packets[i].obj, packets[i].param, false);
+    }
+}
+
+/*static*/ void
 ESMainThread::dispatchMethodInThread(JNIEnv  *jniEnv,
                                      jobject ignoredContextWrapper,
                                      jobject msg) {
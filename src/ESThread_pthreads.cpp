@@ -17,12 +17,11 @@ error "Don't include this file in non-pthreads platform builds";
 #include <errno.h>
 
 #include "ESErrorReporter.hpp"
-#undef ESTRACE
-#include "ESTrace.hpp"
 
 ESChildThread::ESChildThread(const std::string         &name,
-                             ESChildThreadExitStrategy exitStrategy)
-:   ESThread(name),
+                             ESChildThreadExitStrategy exitStrategy,
+                             ESInterThreadTransport    transport)
+:   ESThread(name, transport),
     _exitStrategy(exitStrategy),
     _waitingOnSocket(false)
 {        
@@ -74,7 +73,7 @@ ESChildThread::join() {
     assert(_parentThread->inThisThread());
     void *retval = NULL;
     int st = pthread_join(_pthread, &retval);
-    tracePrintf2("join of child thread 0x%08x returned status %d\n", (unsigned long int)this, st);
+    ESLogDebug("ESChildThread::join", "join of child thread %p returned status %d", this, st);
     ESErrorReporter::checkAndLogSystemError("ESThread", st, "thread join");
     return retval;
 }
@@ -7,9 +7,24 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/resource.h>
 #include <sys/time.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define ES_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define ES_CRC32C_ARM 1
+#elif defined(__aarch64__) && ES_ANDROID
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define ES_CRC32C_ARM_RUNTIME 1  // Not every ARMv8.0 core has the CRC instructions, so check first
+#endif
+
+#include <atomic>
 #include <list>
 
 #include "ESUtil.hpp"
@@ -443,3 +458,111 @@ ESUtil::showFDInfo()
     }
 #endif  // ES_ANDROID
 }
+
+// Software CRC-32C, one byte at a time, for CPUs without the instructions
+struct ESCRC32CTable {
+    uint32_t                entries[256];
+
+                            ESCRC32CTable() {
+                                for (uint32_t i = 0; i < 256; i++) {
+                                    uint32_t crc = i;
+                                    for (int bit = 0; bit < 8; bit++) {
+                                        crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+                                    }
+                                    entries[i] = crc;
+                                }
+                            }
+};
+
+static uint32_t crc32cSoftware(const unsigned char *p,
+                               size_t              length,
+                               uint32_t            crc) {
+    // Built on first use; a function-local static is initialized exactly once, and other threads
+    // calling in meanwhile wait for it, so none can see a partly built table
+    static const ESCRC32CTable table;
+    const uint32_t *entries = table.entries;
+    while (length--) {
+        crc = entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if ES_CRC32C_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32cHardware(const unsigned char *p,
+                               size_t              length,
+                               uint32_t            crc) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (length >= 4) {
+        uint32_t word;
+        memcpy(&word, p, 4);
+        crc = _mm_crc32_u32(crc, word);
+        p += 4;
+        length -= 4;
+    }
+    while (length--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#elif ES_CRC32C_ARM || ES_CRC32C_ARM_RUNTIME
+#if ES_CRC32C_ARM_RUNTIME
+__attribute__((target("crc")))
+#endif
+static uint32_t crc32cHardware(const unsigned char *p,
+                               size_t              length,
+                               uint32_t            crc) {
+    while (length >= 8) {
+        uint64_t word;
+        memcpy(&word, p, 8);
+        crc = __crc32cd(crc, word);
+        p += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static bool cpuHasCRC32C() {
+#if ES_CRC32C_X86
+    return __builtin_cpu_supports("sse4.2");
+#elif ES_CRC32C_ARM
+    return true;
+#elif ES_CRC32C_ARM_RUNTIME
+    return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#else
+    return false;
+#endif
+}
+
+/*static*/ uint32_t
+ESUtil::crc32c(const void *data,
+               size_t     length,
+               uint32_t   crc) {
+    static std::atomic<int> hardwareAvailable(-1);  // Unknown; any thread may find out, since they'll all agree
+    int available = hardwareAvailable.load(std::memory_order_relaxed);
+    if (available < 0) {
+        available = cpuHasCRC32C() ? 1 : 0;
+        hardwareAvailable.store(available, std::memory_order_relaxed);
+    }
+    crc = ~crc;
+#if ES_CRC32C_X86 || ES_CRC32C_ARM || ES_CRC32C_ARM_RUNTIME
+    if (available) {
+        return ~crc32cHardware((const unsigned char *)data, length, crc);
+    }
+#endif
+    return ~crc32cSoftware((const unsigned char *)data, length, crc);
+}
@@ -9,6 +9,8 @@
 #define _ESUTIL_HPP_
 
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ESPlatform.h"
 #include "ESThreadLocalStorage.hpp"
@@ -92,6 +94,12 @@ class ESUtil {
     static std::string      deviceID() { return _deviceID; }  // Unique per device + factory-reset
     static std::string      removeLastValidUTFCharacter(const std::string& str);
 
+    /** CRC-32C (Castagnoli) of the given bytes, using the CPU's CRC instructions where available.
+     *  To checksum data in pieces, pass the result for the previous pieces as 'crc'. */
+    static uint32_t         crc32c(const void *data,
+                                   size_t     length,
+                                   uint32_t   crc = 0);
+
     // Following formatters shouldn't be used in performance-critical code without careful analysis
     static std::string      stringWithFormatV(const char *fmt, va_list args);
     static std::string      stringWithFormat(const char *fmt, ...);
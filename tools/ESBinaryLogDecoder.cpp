@@ -0,0 +1,241 @@
+//
+//  ESBinaryLogDecoder.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+//  Host-side tool which turns binary logs written via ESBinaryLog (e.g., OfflineLog.bin pulled
+//  from a device) back into text, one line per message:
+//
+//      MM-DD HH:MM:SS.mmm T<thread> E|I <where>: <message>
+//
+//  Build:  c++ -O2 -I../src -o ESBinaryLogDecoder ESBinaryLogDecoder.cpp
+//  Usage:  ESBinaryLogDecoder OfflineLog-previous.bin OfflineLog.bin > OfflineLog.txt
+//
+//  Each file is decoded on its own, since each carries its own copies of the formats (a new file
+//  starts with every format the writer had seen).
+
+#include "ESBinaryLogFormat.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct FormatDefinition {
+    std::string             where;
+    std::string             format;
+};
+
+// Reads fixed-size fields from a record body, remembering if we ran off the end
+class BodyReader {
+  public:
+                            BodyReader(const unsigned char *body,
+                                       size_t              length)
+    :   _ptr(body),
+        _end(body + length),
+        _overrun(false)
+    {}
+
+    uint16_t                get16() { uint16_t v = 0; get(&v, sizeof(v)); return v; }
+    uint32_t                get32() { uint32_t v = 0; get(&v, sizeof(v)); return v; }
+    uint64_t                get64() { uint64_t v = 0; get(&v, sizeof(v)); return v; }
+    double                  getDouble() { double v = 0; get(&v, sizeof(v)); return v; }
+    std::string             getString() {
+        uint16_t length = get16();
+        if (_ptr + length > _end) {
+            _overrun = true;
+            return std::string();
+        }
+        std::string str((const char *)_ptr, length);
+        _ptr += length;
+        return str;
+    }
+    bool                    overrun() const { return _overrun; }
+
+  private:
+    void                    get(void   *dst,
+                                size_t length) {
+        if (_ptr + length > _end) {
+            _overrun = true;
+            return;
+        }
+        memcpy(dst, _ptr, length);
+        _ptr += length;
+    }
+
+    const unsigned char     *_ptr;
+    const unsigned char     *_end;
+    bool                    _overrun;
+};
+
+static bool
+readFile(const char                 *path,
+         std::vector<unsigned char> *contents) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        contents->insert(contents->end(), buf, buf + n);
+    }
+    fclose(file);
+    return true;
+}
+
+// Rebuild a single conversion spec with star arguments filled in and the length modifier
+// replaced by one matching how the argument was stored.
+static std::string
+rebuildSpec(const ESBinaryLogSpec &spec,
+            const int             *starArgs,
+            const char            *newLength,
+            char                  newConversion) {
+    std::string result;
+    int starIndex = 0;
+    for (const char *p = spec.start; p < spec.modifiersStart; p++) {
+        if (*p == '*') {
+            int value = starArgs[starIndex++];
+            if (value < 0 && p[-1] == '.') {
+                result.erase(result.size() - 1);  // A negative precision means none, as for printf
+                continue;
+            }
+            char num[16];
+            snprintf(num, sizeof(num), "%d", value);
+            result += num;
+        } else {
+            result += *p;
+        }
+    }
+    result += newLength;
+    result += newConversion;
+    return result;
+}
+
+static std::string
+renderMessage(const std::string &format,
+              BodyReader        &reader) {
+    std::string result;
+    const char *fmt = format.c_str();
+    const char *p = fmt;
+    ESBinaryLogSpec spec;
+    char buf[8192];
+    while (ESBinaryLogNextSpec(p, &spec)) {
+        result.append(p, spec.start - p);
+        p = spec.end;
+        int starArgs[2] = { 0, 0 };
+        for (int i = 0; i < spec.numStarArgs && i < 2; i++) {
+            starArgs[i] = (int)reader.get32();
+        }
+        switch(spec.type) {
+          case ESBinaryLogArgNone:
+            result += '%';
+            break;
+          case ESBinaryLogArgInt32:  // Keep any h or hh, which narrow the value when printed
+            snprintf(buf, sizeof(buf), rebuildSpec(spec, starArgs, std::string(spec.modifiersStart, spec.conversion).c_str(), *spec.conversion).c_str(),
+                     (int)reader.get32());
+            result += buf;
+            break;
+          case ESBinaryLogArgInt64:
+            snprintf(buf, sizeof(buf), rebuildSpec(spec, starArgs, "ll", *spec.conversion).c_str(), (long long)reader.get64());
+            result += buf;
+            break;
+          case ESBinaryLogArgDouble:
+            snprintf(buf, sizeof(buf), rebuildSpec(spec, starArgs, "", *spec.conversion).c_str(), reader.getDouble());
+            result += buf;
+            break;
+          case ESBinaryLogArgString:
+            snprintf(buf, sizeof(buf), rebuildSpec(spec, starArgs, "", 's').c_str(), reader.getString().c_str());
+            result += buf;
+            break;
+          case ESBinaryLogArgPointer:
+            snprintf(buf, sizeof(buf), "0x%llx", (unsigned long long)reader.get64());
+            result += buf;
+            break;
+          case ESBinaryLogArgInvalid:
+            result.append(spec.start, spec.end - spec.start);
+            break;
+        }
+        if (reader.overrun()) {
+            result += " <truncated record>";
+            return result;
+        }
+    }
+    result += p;
+    return result;
+}
+
+static void
+decode(const std::vector<unsigned char> &contents,
+       const char                       *path) {
+    // A single pass, since each format record precedes the messages which use it
+    std::map<uint32_t, FormatDefinition> formats;
+    size_t pos = 0;
+    while (pos + ES_BINARY_LOG_RECORD_HEADER_SIZE <= contents.size()) {
+        unsigned char type = contents[pos];
+        uint16_t length;
+        memcpy(&length, &contents[pos + 1], sizeof(length));
+        size_t bodyStart = pos + ES_BINARY_LOG_RECORD_HEADER_SIZE;
+        if (bodyStart + length > contents.size()) {
+            fprintf(stderr, "%s: truncated record at offset %zu\n", path, pos);
+            break;
+        }
+        if (type == ES_BINARY_LOG_RECORD_FORMAT) {
+            BodyReader reader(&contents[bodyStart], length);
+            uint32_t id = reader.get32();
+            FormatDefinition &definition = formats[id];
+            definition.where = reader.getString();
+            definition.format = reader.getString();
+        } else if (type == ES_BINARY_LOG_RECORD_ERROR || type == ES_BINARY_LOG_RECORD_INFO) {
+            BodyReader reader(&contents[bodyStart], length);
+            uint32_t id = reader.get32();
+            uint64_t timestamp = reader.get64();
+            uint32_t thread = reader.get32();
+            time_t seconds = (time_t)(timestamp / 1000000);
+            struct tm tm;
+            localtime_r(&seconds, &tm);
+            char timeString[32];
+            strftime(timeString, sizeof(timeString), "%m-%d %H:%M:%S", &tm);
+            std::map<uint32_t, FormatDefinition>::iterator it = formats.find(id);
+            if (it == formats.end()) {
+                printf("%s.%03u T%u %c <unknown format %u>\n", timeString, (unsigned)((timestamp / 1000) % 1000), thread, type, id);
+            } else {
+                std::string message = renderMessage(it->second.format, reader);
+                size_t messageLength = message.length();
+                if (messageLength > 0 && message[messageLength - 1] == '\n') {
+                    message.erase(messageLength - 1);
+                }
+                printf("%s.%03u T%u %c %s: %s\n", timeString, (unsigned)((timestamp / 1000) % 1000), thread, type,
+                       it->second.where.c_str(), message.c_str());
+            }
+        } else {
+            fprintf(stderr, "%s: unknown record type 0x%02x at offset %zu\n", path, type, pos);
+            break;
+        }
+        pos = bodyStart + length;
+    }
+}
+
+int
+main(int  argc,
+     char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s binaryLogFile ...\n", argv[0]);
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        std::vector<unsigned char> contents;
+        if (!readFile(argv[i], &contents)) {
+            status = 1;
+            continue;
+        }
+        decode(contents, argv[i]);
+    }
+    return status;
+}
@@ -0,0 +1,108 @@
+//
+//  ESInterThreadBenchmark.cpp
+//
+//  Copyright Emerald Sequoia LLC 2026. All rights reserved.
+//
+//  Measures inter-thread message throughput: a worker thread floods the main thread with calls,
+//  in three modes:
+//
+//    unbatched:     one callInThread() (one write()) per message, and the main thread reads one
+//                   message per read(), as before batching (via setReadsOneInterThreadMessageAtATime)
+//    batched read:  one write() per message, but the main thread reads whatever has arrived
+//                   with one read()
+//    batched send:  an ESInterThreadCallBatch (one write() per ES_INTER_THREAD_BATCH_SIZE
+//                   messages), with batched reads
+//
+//  It also checks that the messages run in the order in which they were sent.
+//
+//  Build:  link with the library (e.g., as a command-line target next to esutil in the macOS project)
+//  Usage:  ESInterThreadBenchmark [numMessages]
+//
+//  Output, one line per mode:
+//
+//      unbatched: 1000000 msgs in 1.234s: 810373 msg/s
+
+#include "ESThread.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static long numMessages = 1000000;
+static long messagesRun = 0;
+static long nextExpected = 0;
+
+static double
+now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// Runs in the main thread
+static void
+countMessage(void *obj,
+             void *param) {
+    long sequence = (long)param;
+    if (sequence != nextExpected) {
+        fprintf(stderr, "Message %ld arrived when %ld was expected\n", sequence, nextExpected);
+        exit(1);
+    }
+    nextExpected++;
+    messagesRun++;
+}
+
+// Runs in the worker thread.  forceUseSocket is given so that the Android main thread is measured
+// on the socket too, rather than through the Java message loop.
+static void
+sendSingly(void *obj,
+           void *param) {
+    ESThread *mainThread = (ESThread *)obj;
+    for (long i = 0; i < numMessages; i++) {
+        mainThread->callInThread(countMessage, NULL, (void *)i, true/*forceUseSocket*/);
+    }
+}
+
+static void
+sendInBatches(void *obj,
+              void *param) {
+    ESThread *mainThread = (ESThread *)obj;
+    ESInterThreadCallBatch batch(mainThread, true/*forceUseSocket*/);
+    for (long i = 0; i < numMessages; i++) {
+        batch.add(countMessage, NULL, (void *)i);
+    }
+}  // The batch's destructor sends the remainder
+
+int
+main(int  argc,
+     char **argv) {
+    if (argc > 1) {
+        numMessages = atol(argv[1]);
+    }
+    ESThread::setMainThreadToThisOne();
+    ESSimpleWorkerThread *worker = new ESSimpleWorkerThread("ESInterThreadBenchmark", ESChildThreadExitsOnlyByParentRequest);
+    worker->start();
+    struct {
+        const char      *name;
+        ESInterThreadFn sender;
+        bool            readsOneAtATime;
+    } modes[] = {
+        { "unbatched",    sendSingly,    true },
+        { "batched read", sendSingly,    false },
+        { "batched send", sendInBatches, false },
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        ESThread::setReadsOneInterThreadMessageAtATime(modes[i].readsOneAtATime);
+        messagesRun = 0;
+        nextExpected = 0;
+        double start = now();
+        worker->callInThread(modes[i].sender, ESThread::mainThread(), NULL);
+        while (messagesRun < numMessages) {
+            ESThread::waitForAndProcessInterThreadMessages();
+        }
+        double elapsed = now() - start;
+        printf("%s: %ld msgs in %.3fs: %.0f msg/s\n", modes[i].name, numMessages, elapsed, numMessages / elapsed);
+    }
+    worker->requestExitAndWaitForJoin();
+    return 0;
+}